@@ -1,84 +1,280 @@
 #include "air_compiler.h"
+#include "process.h"
 
+#include <atomic>
+#include <csignal>
 #include <fstream>
 #include <iterator>
-#include <spawn.h>
+#include <thread>
 #include <unistd.h>
 
-struct TemporaryPath
+static const std::vector<std::string> METAL_ARGUMENTS =
 {
-    const std::string path;
+    "-Wno-unused-variable", "-frecord-sources", "-gline-tables-only", "-fmetal-math-mode=relaxed", "-D__air__",
+#ifdef UNLEASHED_RECOMP
+    "-DUNLEASHED_RECOMP",
+#endif
+#ifdef MARATHON_RECOMP
+    "-DMARATHON_RECOMP",
+#endif
+};
+
+// Sends the shaders in the range to the worker and reads back their results. Returns false if the
+// worker stopped responding, in which case the shaders without a result are left untouched.
+static bool compileBatch(Process& worker, const std::vector<std::string>& shaderSources, size_t begin, size_t end, std::vector<AirCompileResult>& results)
+{
+    std::string request = fmt::format("{}\n", end - begin);
+    for (size_t i = begin; i < end; i++)
+    {
+        request += fmt::format("{}\n", shaderSources[i].size());
+        request += shaderSources[i];
+    }
 
-    explicit TemporaryPath(std::string_view path) : path(path) {}
+    if (!writeAll(worker.input, request.data(), request.size()))
+        return false;
 
-    ~TemporaryPath()
+    for (size_t i = begin; i < end; i++)
     {
-        unlink(path.c_str());
+        std::string header;
+        if (!readLine(worker.output, header))
+            return false;
+
+        int status = 0;
+        size_t size = 0;
+        if (sscanf(header.c_str(), "%d %zu", &status, &size) != 2)
+            return false;
+
+        std::vector<uint8_t> data(size);
+        if (!readExact(worker.output, data.data(), size))
+            return false;
+
+        if (status == 0)
+            results[i].data = std::move(data);
+        else
+            results[i].error = fmt::format("AIR compiler exited with status {}:\n{}", status, std::string_view(reinterpret_cast<const char*>(data.data()), data.size()));
     }
-};
 
-static int executeCommand(const char** argv)
+    return true;
+}
+
+std::vector<AirCompileResult> AirCompiler::compile(const std::vector<std::string>& shaderSources) const
+{
+    // Report workers exiting early as failed writes instead of terminating.
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<AirCompileResult> results(shaderSources.size());
+
+    size_t batchCount = (shaderSources.size() + batchSize - 1) / batchSize;
+    std::atomic<size_t> nextBatch = 0;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min<size_t>(workerCount, batchCount); i++)
+    {
+        threads.emplace_back([&]
+            {
+                Process worker;
+
+                while (true)
+                {
+                    size_t batch = nextBatch++;
+                    if (batch >= batchCount)
+                        break;
+
+                    size_t begin = batch * batchSize;
+                    size_t end = std::min<size_t>(begin + batchSize, shaderSources.size());
+
+                    const char* failure = nullptr;
+
+                    if (worker.pid == -1 && !spawnProcess(workerCommand, false, worker))
+                        failure = "Failed to start AIR compiler worker";
+                    else if (!compileBatch(worker, shaderSources, begin, end, results))
+                        failure = "AIR compiler worker exited unexpectedly";
+
+                    if (failure != nullptr)
+                    {
+                        for (size_t j = begin; j < end; j++)
+                        {
+                            if (results[j].data.empty() && results[j].error.empty())
+                                results[j].error = failure;
+                        }
+
+                        // Start a new worker for the next batch.
+                        worker.wait();
+                    }
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    return results;
+}
+
+// Finds a tool of the Metal toolchain once, so the worker can spawn it directly instead of going through xcrun for every shader.
+static std::string findMetalTool(const char* name)
 {
-    pid_t pid;
-    if (posix_spawn(&pid, argv[0], nullptr, nullptr, const_cast<char**>(argv), nullptr) != 0)
-        return -1;
+    std::vector<uint8_t> output;
+    std::string error;
+    if (runProcess({ "/usr/bin/xcrun", "-sdk", "macosx", "-f", name }, {}, output, error) != 0)
+        return {};
+
+    std::string path(output.begin(), output.end());
+    while (!path.empty() && isspace(uint8_t(path.back())))
+        path.pop_back();
 
-    int status;
-    if (waitpid(pid, &status, 0) == -1)
-        return -1;
+    return path;
+}
+
+static bool readFile(const std::string& filePath, std::vector<uint8_t>& data)
+{
+    std::ifstream stream(filePath, std::ios::binary);
+    if (!stream.is_open())
+        return false;
 
-    return status;
+    data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    return true;
 }
 
-std::vector<uint8_t> AirCompiler::compile(const std::string& shaderSource)
+struct MetalTools
+{
+    std::string metal;
+    std::string metallib;
+};
+
+// Compiles all the shaders of a batch with a single invocation of the Metal compiler, which writes an AIR module for
+// each source to the working directory, and then links each module into its own library. Shaders without a module
+// are compiled again on their own, for an error output that only covers them.
+static void compileWorkerBatch(const MetalTools& tools, const std::vector<std::string>& shaderSources, std::vector<AirCompileResult>& results,
+    std::vector<int>& statuses)
 {
-    // Save source to a location on disk for the compiler to read.
-    char sourcePathTemplate[PATH_MAX] = "/tmp/xenos_metal_XXXXXX.metal";
-    const int sourceFd = mkstemps(sourcePathTemplate, 6);
-    if (sourceFd == -1)
+    std::vector<std::string> compileCommand = { tools.metal, "-c" };
+    compileCommand.insert(compileCommand.end(), METAL_ARGUMENTS.begin(), METAL_ARGUMENTS.end());
+
+    for (size_t i = 0; i < shaderSources.size(); i++)
     {
-        fmt::println("Failed to create temporary file for shader source: {}", strerror(errno));
-        std::exit(1);
+        std::string sourcePath = fmt::format("{}.metal", i);
+        std::ofstream stream(sourcePath, std::ios::binary);
+        stream.write(shaderSources[i].data(), shaderSources[i].size());
+
+        if (stream.good())
+            compileCommand.push_back(sourcePath);
     }
 
-    const TemporaryPath sourcePath(sourcePathTemplate);
-    const TemporaryPath irPath(sourcePath.path + ".ir");
-    const TemporaryPath metalLibPath(sourcePath.path + ".metallib");
+    std::vector<uint8_t> output;
+    std::string error;
+    runProcess(compileCommand, {}, output, error);
 
-    const ssize_t sourceWritten = write(sourceFd, shaderSource.data(), shaderSource.size());
-    close(sourceFd);
-    if (sourceWritten < 0)
+    for (size_t i = 0; i < shaderSources.size(); i++)
     {
-        fmt::println("Failed to write shader source to disk: {}", strerror(errno));
-        std::exit(1);
+        std::string sourcePath = fmt::format("{}.metal", i);
+        std::string airPath = fmt::format("{}.air", i);
+        std::string libraryPath = fmt::format("{}.metallib", i);
+
+        auto& result = results[i];
+        int& status = statuses[i];
+
+        if (access(airPath.c_str(), F_OK) == 0)
+        {
+            output.clear();
+            status = runProcess({ tools.metallib, "-o", libraryPath, airPath }, {}, output, result.error);
+
+            if (status == 0 && !readFile(libraryPath, result.data))
+            {
+                status = -1;
+                result.error = fmt::format("Failed to read {}", libraryPath);
+            }
+        }
+        else
+        {
+            std::vector<std::string> command = { tools.metal, "-x", "metal", "-o", "-", "-" };
+            command.insert(command.end(), METAL_ARGUMENTS.begin(), METAL_ARGUMENTS.end());
+
+            status = runProcess(command, shaderSources[i], result.data, result.error);
+        }
+
+        unlink(sourcePath.c_str());
+        unlink(airPath.c_str());
+        unlink(libraryPath.c_str());
     }
+}
 
-    const char* compileCommand[] = {
-        "/usr/bin/xcrun", "-sdk", "macosx", "metal", "-o", irPath.path.c_str(), "-c", sourcePath.path.c_str(), "-Wno-unused-variable", "-frecord-sources", "-gline-tables-only", "-fmetal-math-mode=relaxed", "-D__air__",
-#ifdef UNLEASHED_RECOMP
-        "-DUNLEASHED_RECOMP",
-#endif
-#ifdef MARATHON_RECOMP
-        "-DMARATHON_RECOMP",
-#endif
-        nullptr
-    };
-    if (const int compileStatus = executeCommand(compileCommand); compileStatus != 0)
+int AirCompiler::runWorker()
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    MetalTools tools;
+    tools.metal = findMetalTool("metal");
+    tools.metallib = findMetalTool("metallib");
+
+    if (tools.metal.empty() || tools.metallib.empty())
+    {
+        fprintf(stderr, "Failed to find the Metal toolchain\n");
+        return 1;
+    }
+
+    // The Metal compiler writes the AIR modules of a batch to the working directory, which is private to the worker.
+    char directory[] = "/tmp/xenos_metal_XXXXXX";
+    if (mkdtemp(directory) == nullptr || chdir(directory) != 0)
     {
-        fmt::println("Metal compiler exited with status: {}", compileStatus);
-        fmt::println("Generated source:\n{}", shaderSource);
-        std::exit(1);
+        fprintf(stderr, "Failed to create a working directory for the Metal compiler\n");
+        return 1;
     }
 
-    const char* linkCommand[] = { "/usr/bin/xcrun", "-sdk", "macosx", "metallib", "-o", metalLibPath.path.c_str(), irPath.path.c_str(), nullptr };
-    if (const int linkStatus = executeCommand(linkCommand); linkStatus != 0)
+    int exitCode = 0;
+
+    std::string line;
+    while (exitCode == 0 && readLine(STDIN_FILENO, line))
     {
-        fmt::println("Metal linker exited with status: {}", linkStatus);
-        fmt::println("Generated source:\n{}", shaderSource);
-        std::exit(1);
+        std::vector<std::string> shaderSources(std::stoull(line));
+        for (auto& shaderSource : shaderSources)
+        {
+            if (!readLine(STDIN_FILENO, line))
+            {
+                exitCode = 1;
+                break;
+            }
+
+            shaderSource.resize(std::stoull(line));
+            if (!readExact(STDIN_FILENO, shaderSource.data(), shaderSource.size()))
+            {
+                exitCode = 1;
+                break;
+            }
+        }
+
+        if (exitCode != 0)
+            break;
+
+        std::vector<AirCompileResult> results(shaderSources.size());
+        std::vector<int> statuses(shaderSources.size());
+        compileWorkerBatch(tools, shaderSources, results, statuses);
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            std::string header;
+            bool written;
+
+            if (statuses[i] == 0)
+            {
+                header = fmt::format("0 {}\n", results[i].data.size());
+                written = writeAll(STDOUT_FILENO, header.data(), header.size()) && writeAll(STDOUT_FILENO, results[i].data.data(), results[i].data.size());
+            }
+            else
+            {
+                header = fmt::format("{} {}\n", statuses[i], results[i].error.size());
+                written = writeAll(STDOUT_FILENO, header.data(), header.size()) && writeAll(STDOUT_FILENO, results[i].error.data(), results[i].error.size());
+            }
+
+            if (!written)
+            {
+                exitCode = 1;
+                break;
+            }
+        }
     }
 
-    std::ifstream libStream(metalLibPath.path, std::ios::binary);
-    std::vector<uint8_t> data((std::istreambuf_iterator(libStream)), std::istreambuf_iterator<char>());
-    return data;
+    rmdir(directory);
+
+    return exitCode;
 }
@@ -3,8 +3,27 @@
 #include <string>
 #include <vector>
 
+struct AirCompileResult
+{
+    std::vector<uint8_t> data;
+    std::string error; // Compiler output if the shader failed to compile.
+};
+
 class AirCompiler
 {
 public:
-    [[nodiscard]] static std::vector<uint8_t> compile(const std::string& shaderSource);
-};
\ No newline at end of file
+    // Command of the workers compiling the shaders, the current executable in worker mode by default.
+    // Workers stay alive for the whole compilation and exchange batches of shaders over stdin and stdout:
+    //   request:  "<shader count>\n", then "<source size>\n<source>" for each shader
+    //   response: "<status> <size>\n<data>" for each shader, data being the metallib if the status
+    //             is 0, or the error output otherwise
+    // The worker exits once stdin is closed.
+    std::vector<std::string> workerCommand;
+    uint32_t workerCount = 1;
+    uint32_t batchSize = 64;
+
+    [[nodiscard]] std::vector<AirCompileResult> compile(const std::vector<std::string>& shaderSources) const;
+
+    // Runs the worker loop on stdin and stdout, compiling each batch with a single invocation of the Metal compiler.
+    static int runWorker();
+};
@@ -11,7 +11,7 @@ DxcCompiler::~DxcCompiler()
     dxcCompiler->Release();
 }
 
-IDxcBlob* DxcCompiler::compile(const std::string& shaderSource, bool compilePixelShader, bool compileLibrary, bool compileSpirv)
+IDxcBlob* DxcCompiler::compile(const std::string& shaderSource, bool compilePixelShader, bool compileLibrary, bool compileSpirv, bool enable16BitTypes, DxcProfile profile)
 {
     DxcBuffer source{};
     source.Ptr = shaderSource.c_str();
@@ -29,7 +29,7 @@ IDxcBlob* DxcCompiler::compile(const std::string& shaderSource, bool compilePixe
     else
     {
         if (compilePixelShader)
-            target = L"-T ps_6_0";
+            target = enable16BitTypes ? L"-T ps_6_2" : L"-T ps_6_0";
         else
             target = L"-T vs_6_0";
     }
@@ -43,6 +43,12 @@ IDxcBlob* DxcCompiler::compile(const std::string& shaderSource, bool compilePixe
     args[argCount++] = L"-HV 2021";
     args[argCount++] = L"-all-resources-bound";
 
+    if (enable16BitTypes)
+        args[argCount++] = L"-enable-16bit-types";
+
+    if (profile == DxcProfile::Fast)
+        args[argCount++] = L"-O0";
+
     if (compileSpirv)
     {
         args[argCount++] = L"-spirv";
@@ -50,6 +56,12 @@ IDxcBlob* DxcCompiler::compile(const std::string& shaderSource, bool compilePixe
 
         if (!compilePixelShader)
             args[argCount++] = L"-fvk-invert-y";
+
+        if (profile == DxcProfile::SpirvLegalize)
+        {
+            args[argCount++] = L"-fspv-reduce-load-size";
+            args[argCount++] = L"-fspv-fix-func-call-arguments";
+        }
     }
     else
     {
@@ -106,3 +118,30 @@ IDxcBlob* DxcCompiler::compile(const std::string& shaderSource, bool compilePixe
 
     return object;
 }
+
+std::string DxcCompiler::disassemble(const void* data, size_t dataSize)
+{
+    DxcBuffer object{};
+    object.Ptr = data;
+    object.Size = dataSize;
+
+    IDxcResult* result = nullptr;
+    HRESULT hr = dxcCompiler->Disassemble(&object, IID_PPV_ARGS(&result));
+
+    std::string disassembly;
+    if (SUCCEEDED(hr))
+    {
+        assert(result != nullptr);
+
+        IDxcBlobUtf8* text = nullptr;
+        if (result->HasOutput(DXC_OUT_DISASSEMBLY) && SUCCEEDED(result->GetOutput(DXC_OUT_DISASSEMBLY, IID_PPV_ARGS(&text), nullptr)) && text != nullptr)
+        {
+            disassembly.assign(text->GetStringPointer(), text->GetStringLength());
+            text->Release();
+        }
+
+        result->Release();
+    }
+
+    return disassembly;
+}
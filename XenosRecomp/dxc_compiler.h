@@ -1,5 +1,19 @@
 #pragma once
 
+enum class DxcProfile
+{
+    Fast, // No optimizations, for quick iteration.
+    Default,
+    SpirvLegalize // Extra SPIR-V load size reduction and function call argument legalization.
+};
+
+static constexpr const char* DXC_PROFILE_NAMES[] =
+{
+    "fast",
+    "default",
+    "spirv-legalize"
+};
+
 struct DxcCompiler
 {
     IDxcCompiler3* dxcCompiler = nullptr;
@@ -7,5 +21,8 @@ struct DxcCompiler
     DxcCompiler();
     ~DxcCompiler();
 
-    IDxcBlob* compile(const std::string& shaderSource, bool compilePixelShader, bool compileLibrary, bool compileSpirv);
+    IDxcBlob* compile(const std::string& shaderSource, bool compilePixelShader, bool compileLibrary, bool compileSpirv, bool enable16BitTypes, DxcProfile profile);
+
+    // Textual LLVM IR of a DXIL container, or an empty string if it can't be disassembled.
+    std::string disassemble(const void* data, size_t dataSize);
 };
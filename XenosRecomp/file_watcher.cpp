@@ -0,0 +1,142 @@
+#include "file_watcher.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Changes arriving this close together are reported at once, as saving a file usually produces several events.
+static constexpr int SETTLE_TIME_MS = 50;
+
+#ifdef __linux__
+
+FileWatcher::~FileWatcher()
+{
+    if (fd != -1)
+        close(fd);
+}
+
+void FileWatcher::addDirectory(const std::filesystem::path& directory)
+{
+    int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF);
+    if (wd == -1)
+        return;
+
+    directories[wd] = directory;
+
+    std::error_code ec;
+    for (auto& entry : std::filesystem::directory_iterator(directory, ec))
+    {
+        if (entry.is_directory(ec))
+            addDirectory(entry.path());
+    }
+}
+
+bool FileWatcher::watch(const std::filesystem::path& directory)
+{
+    if (fd == -1)
+        fd = inotify_init1(IN_CLOEXEC);
+
+    if (fd == -1)
+        return false;
+
+    roots.push_back(directory);
+    addDirectory(directory);
+    return !directories.empty();
+}
+
+std::vector<std::filesystem::path> FileWatcher::waitForChanges()
+{
+    std::vector<std::filesystem::path> changes;
+    int timeout = -1;
+
+    while (true)
+    {
+        pollfd pfd = { fd, POLLIN, 0 };
+        int result = poll(&pfd, 1, timeout);
+
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        if (result <= 0)
+            break;
+
+        alignas(inotify_event) char buffer[16384];
+        ssize_t size = read(fd, buffer, sizeof(buffer));
+        if (size <= 0)
+            break;
+
+        for (ssize_t offset = 0; offset < size;)
+        {
+            auto event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            // Events were dropped, so anything may have changed, including directories that aren't watched yet.
+            if ((event->mask & IN_Q_OVERFLOW) != 0)
+            {
+                for (auto& root : roots)
+                {
+                    addDirectory(root);
+                    changes.push_back(root);
+                }
+
+                continue;
+            }
+
+            auto findResult = directories.find(event->wd);
+            if (findResult == directories.end())
+                continue;
+
+            if ((event->mask & (IN_DELETE_SELF | IN_IGNORED)) != 0)
+            {
+                directories.erase(findResult);
+                continue;
+            }
+
+            if (event->len == 0)
+                continue;
+
+            std::filesystem::path path = findResult->second / event->name;
+
+            // New directories may already contain files by the time they are watched, so they are reported as a whole.
+            if ((event->mask & IN_ISDIR) != 0 && (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0)
+                addDirectory(path);
+
+            // Files are only reported once written and closed, not when created empty.
+            if ((event->mask & IN_CREATE) == 0 || (event->mask & IN_ISDIR) != 0)
+                changes.push_back(std::move(path));
+        }
+
+        timeout = SETTLE_TIME_MS;
+    }
+
+    std::sort(changes.begin(), changes.end());
+    changes.erase(std::unique(changes.begin(), changes.end()), changes.end());
+
+    return changes;
+}
+
+#else
+
+FileWatcher::~FileWatcher()
+{
+}
+
+void FileWatcher::addDirectory(const std::filesystem::path& directory)
+{
+}
+
+bool FileWatcher::watch(const std::filesystem::path& directory)
+{
+    return false;
+}
+
+std::vector<std::filesystem::path> FileWatcher::waitForChanges()
+{
+    return {};
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+class FileWatcher
+{
+public:
+    FileWatcher() = default;
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    ~FileWatcher();
+
+    // Watches the directory and all of its subdirectories, including the ones created later.
+    // Returns false if watching failed or is not supported on this platform.
+    bool watch(const std::filesystem::path& directory);
+
+    // Blocks until something changes, then waits for changes to settle and returns the paths of every
+    // file or directory that was written, created, moved or removed in the meantime. If changes were
+    // lost, the watched directories themselves are returned so they can be scanned again as a whole.
+    std::vector<std::filesystem::path> waitForChanges();
+
+private:
+    int fd = -1;
+    std::vector<std::filesystem::path> roots;
+    std::unordered_map<int, std::filesystem::path> directories;
+
+    void addDirectory(const std::filesystem::path& directory);
+};
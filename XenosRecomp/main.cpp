@@ -1,10 +1,29 @@
+#include <chrono>
+#include <condition_variable>
 #include <deque>
+#include <fstream>
+#include <iterator>
 #include <mutex>
+#include <sstream>
 #include <thread>
 
 #include "shader.h"
+#include "shader_common.h"
 #include "shader_recompiler.h"
+#include "shader_cache_writer.h"
 #include "dxc_compiler.h"
+#include "file_watcher.h"
+#include "memory_governor.h"
+#include "shader_source.h"
+#include "shader_cost.h"
+#include "shader_interpreter.h"
+
+#ifndef _WIN32
+#include "process.h"
+
+#include <csignal>
+#include <unistd.h>
+#endif
 
 #ifdef XENOS_RECOMP_AIR
 #include "air_compiler.h"
@@ -13,6 +32,12 @@
 static std::unique_ptr<uint8_t[]> readAllBytes(const char* filePath, size_t& fileSize)
 {
     FILE* file = fopen(filePath, "rb");
+    if (file == nullptr)
+    {
+        fileSize = 0;
+        return nullptr;
+    }
+
     fseek(file, 0, SEEK_END);
     fileSize = ftell(file);
     fseek(file, 0, SEEK_SET);
@@ -22,61 +47,1744 @@ static std::unique_ptr<uint8_t[]> readAllBytes(const char* filePath, size_t& fil
     return data;
 }
 
-static void writeAllBytes(const char* filePath, const void* data, size_t dataSize)
-{
-    FILE* file = fopen(filePath, "wb");
-    fwrite(data, 1, dataSize, file);
-    fclose(file);
-}
+static void writeAllBytes(const char* filePath, const void* data, size_t dataSize)
+{
+    FILE* file = fopen(filePath, "wb");
+    fwrite(data, 1, dataSize, file);
+    fclose(file);
+}
+
+struct Options
+{
+    // Precompile fully specialized variants for every combination of the spec constant bits a shader uses.
+    bool allSpecConstantsVariants = false;
+
+    // Per shader spec constant combinations to precompile, loaded from a variant list file.
+    std::unordered_map<XXH64_hash_t, std::vector<uint64_t>> specConstantsVariants;
+
+    // Precompile variants with interpolators packed into the fewest float4 slots.
+    bool packInterpolators = false;
+
+    // Pixel shader hashes each vertex shader is used with, loaded from a pair list file.
+    std::unordered_map<XXH64_hash_t, std::vector<uint64_t>> shaderPairs;
+
+    // Pixel shaders resolved from the pairs, along with the interpolator components they read.
+    std::unordered_map<XXH64_hash_t, std::vector<std::pair<XXH64_hash_t, std::vector<uint32_t>>>> linkedPixelShaders;
+
+    // Per shader g_Booleans values to precompile, loaded from a variant list file.
+    std::unordered_map<XXH64_hash_t, std::vector<uint64_t>> booleansVariants;
+
+    // Store pixel shader registers only carrying colors with reduced precision.
+    bool reducedPrecision = false;
+
+    // Load each constant register and descriptor index once at the start of the shader instead of at every use.
+    bool hoistConstantLoads = false;
+
+    // Store each fetch result in a local and reuse it for identical fetches that provably read the same address.
+    bool reuseFetches = false;
+
+    // Read the swapped vertex element masks and the clip plane flag through specialization constants.
+    bool specializeSharedFlags = false;
+
+    // Compile pixel shaders with native 16-bit types instead of minimum precision hints.
+    bool enable16BitTypes = false;
+
+    // Hand each compiler a source specialized for its target, optionally with indentation, comments and empty lines stripped.
+    bool specializeSource = false;
+    bool minifySource = false;
+
+    // DXC optimization profile used for DXIL and SPIR-V.
+    DxcProfile dxcProfile = DxcProfile::Default;
+
+    // Number of shaders to compile under every profile for a comparison instead of building the cache.
+    size_t profileReportSampleCount = 0;
+
+    // Number of random inputs to run every shader on in the reference interpreter instead of building the cache.
+    size_t validateInputCount = 0;
+
+    // Only recompile the shaders whose hash modulo the shard count equals the shard index, and write them to a shard file.
+    uint32_t shardIndex = 0;
+    uint32_t shardCount = 0;
+
+    // Merge shard files into a shader cache instead of recompiling.
+    bool merge = false;
+
+    // Compress shaders into the cache on disk as they finish, holding at most this many bytes of finished shaders in memory.
+    size_t streamMemoryBudget = 0;
+
+    // Recompile shaders in this many worker processes instead of threads, so a shader crashing the recompiler or DXC
+    // only takes down its worker. Workers are started with the same arguments and --recompile-worker.
+    uint32_t isolatedWorkerCount = 0;
+    std::vector<std::string> recompileWorkerCommand;
+
+    // Seconds a worker may spend on a shader before it's considered hung, killed and the shader quarantined.
+    size_t isolatedWorkerTimeout = 600;
+
+    // Limits concurrent DXC compiles against a memory budget, if one was given.
+    std::unique_ptr<MemoryGovernor> memoryGovernor;
+
+    // Run as a worker process, recompiling shaders sent over stdin.
+    bool recompileWorker = false;
+
+    // File recompiled shaders are saved to as they finish, and restored from when a build is restarted.
+    const char* checkpointPath = nullptr;
+
+    // Existing shader cache whose shaders are reused instead of recompiled, only recompiling shaders missing from it.
+    const char* patchCachePath = nullptr;
+
+    // File the static instruction counts of every compiled shader are written to, as JSON if it ends with .json or CSV otherwise.
+    const char* costReportPath = nullptr;
+
+    // Keep running after the first build, recompiling new shaders and rewriting the cache whenever the input changes.
+    bool watch = false;
+
+#ifdef XENOS_RECOMP_AIR
+    // Command and number of the persistent workers compiling shaders to AIR.
+    std::vector<std::string> airWorkerCommand;
+    uint32_t airWorkerCount = std::max(std::thread::hardware_concurrency(), 1u);
+#endif
+
+    bool hasVariants() const
+    {
+        return allSpecConstantsVariants || !specConstantsVariants.empty() || packInterpolators || !shaderPairs.empty() || !booleansVariants.empty();
+    }
+};
+
+// Each line contains a shader hash followed by any number of values, all separated by whitespace.
+// Lines starting with '#' are ignored.
+static std::unordered_map<XXH64_hash_t, std::vector<uint64_t>> readHashListFile(const char* filePath)
+{
+    std::unordered_map<XXH64_hash_t, std::vector<uint64_t>> hashList;
+
+    std::ifstream stream(filePath);
+    if (!stream.is_open())
+    {
+        fmt::println("Failed to open {}", filePath);
+        exit(1);
+    }
+
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        std::istringstream lineStream(line);
+        std::string token;
+
+        if (!(lineStream >> token) || token[0] == '#')
+            continue;
+
+        auto& values = hashList[std::stoull(token, nullptr, 16)];
+        while (lineStream >> token)
+            values.push_back(std::stoull(token, nullptr, 0));
+    }
+
+    return hashList;
+}
+
+// Parses the count or size given to an option, raised to at least 1. Returns false if it's not a number.
+static bool parseCount(const char* argument, size_t& count)
+{
+    char trailing;
+    if (argument[0] < '0' || argument[0] > '9' || sscanf(argument, "%zu%c", &count, &trailing) != 1)
+        return false;
+
+    count = std::max<size_t>(count, 1);
+    return true;
+}
+
+// Applies the options shared by every recompiler, including the ones emitting variants.
+static void configureRecompiler(ShaderRecompiler& recompiler, const Options& options)
+{
+    recompiler.reducedPrecision = options.reducedPrecision;
+    recompiler.hoistConstantLoads = options.hoistConstantLoads;
+    recompiler.reuseFetches = options.reuseFetches;
+    recompiler.specializeSharedFlags = options.specializeSharedFlags;
+}
+
+// Rough memory DXC needs to compile a shader: a fixed cost for the compiler and its passes, plus a cost growing with
+// the size of the source, which mostly comes from unrolled control flow and the declarations the code uses.
+static constexpr size_t DXC_BASE_MEMORY_ESTIMATE = 64 * 1024 * 1024;
+static constexpr size_t DXC_SOURCE_MEMORY_FACTOR = 1024;
+
+// Returns the source specialized for the target if enabled, using the storage to hold it.
+static const std::string& getTargetSource(const std::string& source, ShaderTarget target, const Options& options, std::string& storage)
+{
+    if (!options.specializeSource)
+        return source;
+
+    storage = specializeShaderSource(source, target, options.minifySource);
+    return storage;
+}
+
+static void compileShader(CompiledShader& shader, const std::string& source, bool isPixelShader, bool compileLibrary, const Options& options)
+{
+    thread_local DxcCompiler dxcCompiler;
+
+    size_t memoryEstimate = DXC_BASE_MEMORY_ESTIMATE + source.size() * DXC_SOURCE_MEMORY_FACTOR;
+    if (options.memoryGovernor != nullptr)
+        options.memoryGovernor->acquire(memoryEstimate);
+
+    bool enable16BitTypes = isPixelShader && options.enable16BitTypes;
+    std::string targetSource;
+
+#ifdef XENOS_RECOMP_DXIL
+    IDxcBlob* dxil = dxcCompiler.compile(getTargetSource(source, ShaderTarget::Dxil, options, targetSource), isPixelShader, compileLibrary, false, enable16BitTypes, options.dxcProfile);
+    assert(dxil != nullptr);
+    assert(*(reinterpret_cast<uint32_t *>(dxil->GetBufferPointer()) + 1) != 0 && "DXIL was not signed properly!");
+
+    shader.dxil.assign(reinterpret_cast<uint8_t *>(dxil->GetBufferPointer()),
+        reinterpret_cast<uint8_t *>(dxil->GetBufferPointer()) + dxil->GetBufferSize());
+
+    dxil->Release();
+#endif
+
+#ifdef XENOS_RECOMP_AIR
+    shader.airSource = getTargetSource(source, ShaderTarget::Air, options, targetSource);
+#endif
+
+    IDxcBlob* spirv = dxcCompiler.compile(getTargetSource(source, ShaderTarget::Spirv, options, targetSource), isPixelShader, false, true, enable16BitTypes, options.dxcProfile);
+    assert(spirv != nullptr);
+
+    bool result = smolv::Encode(spirv->GetBufferPointer(), spirv->GetBufferSize(), shader.spirv, smolv::kEncodeFlagStripDebugInfo);
+    assert(result);
+
+    spirv->Release();
+
+    if (options.memoryGovernor != nullptr)
+        options.memoryGovernor->release(memoryEstimate);
+}
+
+// Opcode of OpLoad, the instruction reading constants and descriptor indices from memory.
+static constexpr uint32_t SPIRV_OP_LOAD = 61;
+
+// SPIR-V starts with a 5 word header, and the word count of each instruction is stored in the upper half of its first word,
+// the opcode in the lower half.
+static void countSpirvInstructions(IDxcBlob* spirv, size_t& instructionCount, size_t& loadCount)
+{
+    auto words = reinterpret_cast<const uint32_t*>(spirv->GetBufferPointer());
+    size_t wordCount = spirv->GetBufferSize() / sizeof(uint32_t);
+
+    for (size_t i = 5; i < wordCount; i += std::max(words[i] >> 16, 1u))
+    {
+        ++instructionCount;
+
+        if ((words[i] & 0xFFFF) == SPIRV_OP_LOAD)
+            ++loadCount;
+    }
+}
+
+// Compiles a sample of the shaders under every DXC profile and prints the total compile time and output sizes of each.
+static void reportProfiles(const std::map<XXH64_hash_t, RecompiledShader>& shaders, const std::string_view include, const Options& options)
+{
+    size_t step = std::max<size_t>(shaders.size() / options.profileReportSampleCount, 1);
+    std::vector<const uint8_t*> samples;
+
+    size_t index = 0;
+    for (auto& [hash, shader] : shaders)
+    {
+        if ((index++ % step) == 0 && samples.size() < options.profileReportSampleCount)
+            samples.push_back(shader.data);
+    }
+
+    std::vector<ShaderRecompiler> recompilers(samples.size());
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        configureRecompiler(recompilers[i], options);
+        recompilers[i].recompile(samples[i], include);
+    }
+
+    fmt::println("Compiling {} shaders under each profile", samples.size());
+    fmt::println("{:<16}{:>12}{:>14}{:>20}{:>13}{:>14}{:>22}{:>15}", "Profile", "Time (ms)", "DXIL size", "DXIL instructions", "DXIL loads",
+        "SPIR-V size", "SPIR-V instructions", "SPIR-V loads");
+
+    DxcCompiler dxcCompiler;
+
+    for (size_t i = 0; i < std::size(DXC_PROFILE_NAMES); i++)
+    {
+        DxcProfile profile = DxcProfile(i);
+        size_t dxilSize = 0;
+        std::vector<IDxcBlob*> dxilBlobs;
+        size_t spirvSize = 0;
+        size_t spirvInstructionCount = 0;
+        size_t spirvLoadCount = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (auto& recompiler : recompilers)
+        {
+            bool enable16BitTypes = recompiler.isPixelShader && options.enable16BitTypes;
+
+        #ifdef XENOS_RECOMP_DXIL
+            IDxcBlob* dxil = dxcCompiler.compile(recompiler.out, recompiler.isPixelShader, recompiler.specConstantsMask != 0, false, enable16BitTypes, profile);
+            assert(dxil != nullptr);
+            dxilSize += dxil->GetBufferSize();
+            dxilBlobs.push_back(dxil);
+        #endif
+
+            IDxcBlob* spirv = dxcCompiler.compile(recompiler.out, recompiler.isPixelShader, false, true, enable16BitTypes, profile);
+            assert(spirv != nullptr);
+            spirvSize += spirv->GetBufferSize();
+            countSpirvInstructions(spirv, spirvInstructionCount, spirvLoadCount);
+            spirv->Release();
+        }
+
+        auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+        // Counted once the timing is done, disassembling isn't part of the compile time.
+        ShaderCost dxilCost;
+        for (IDxcBlob* dxil : dxilBlobs)
+        {
+            ShaderCost cost = getDxilCost(dxcCompiler.disassemble(dxil->GetBufferPointer(), dxil->GetBufferSize()));
+            dxilCost.instructionCount += cost.instructionCount;
+            dxilCost.loadCount += cost.loadCount;
+            dxil->Release();
+        }
+
+        fmt::println("{:<16}{:>12.1f}{:>14}{:>20}{:>13}{:>14}{:>22}{:>15}", DXC_PROFILE_NAMES[i], duration.count(), dxilSize, dxilCost.instructionCount,
+            dxilCost.loadCount, spirvSize, spirvInstructionCount, spirvLoadCount);
+    }
+}
+
+static const char* const SHADER_VARIANT_NAMES[] =
+{
+    "spec_constants",
+    "packed_interpolators",
+    "linked_pair",
+    "booleans"
+};
+
+// Counts the instructions of every compiled shader and variant, and writes them sorted by hash so the reports
+// of two builds can be diffed.
+static bool writeCostReport(const char* filePath, const std::map<XXH64_hash_t, RecompiledShader>& shaders)
+{
+    struct CostJob
+    {
+        XXH64_hash_t hash;
+        const char* variant;
+        uint64_t key;
+        const CompiledShader* shader;
+    };
+
+    std::vector<CostJob> jobs;
+    for (auto& [hash, shader] : shaders)
+    {
+        jobs.push_back({ hash, "none", 0, &shader });
+
+        for (auto& variant : shader.variants)
+            jobs.push_back({ hash, variant.kind < std::size(SHADER_VARIANT_NAMES) ? SHADER_VARIANT_NAMES[variant.kind] : "unknown", variant.key, &variant });
+    }
+
+    // A SPIR-V and a DXIL row for each job, rows of targets that weren't compiled are left without a target.
+    std::vector<ShaderCostReportRow> rows(jobs.size() * 2);
+
+    std::for_each(std::execution::par, jobs.begin(), jobs.end(), [&](const CostJob& job)
+        {
+            size_t index = size_t(&job - jobs.data()) * 2;
+            const auto& spirv = job.shader->spirv;
+
+            if (!spirv.empty())
+            {
+                std::vector<uint32_t> words(smolv::GetDecodedBufferSize(spirv.data(), spirv.size()) / sizeof(uint32_t));
+                auto& row = rows[index];
+
+                if (smolv::Decode(spirv.data(), spirv.size(), words.data(), words.size() * sizeof(uint32_t)) && getSpirvCost(words.data(), words.size(), row.cost))
+                    row.target = "spirv";
+            }
+
+        #ifdef XENOS_RECOMP_DXIL
+            const auto& dxil = job.shader->dxil;
+
+            if (!dxil.empty())
+            {
+                thread_local DxcCompiler dxcCompiler;
+                std::string disassembly = dxcCompiler.disassemble(dxil.data(), dxil.size());
+
+                if (!disassembly.empty())
+                {
+                    auto& row = rows[index + 1];
+                    row.cost = getDxilCost(disassembly);
+                    row.target = "dxil";
+                }
+            }
+        #endif
+
+            for (size_t i = index; i < index + 2; i++)
+            {
+                rows[i].hash = job.hash;
+                rows[i].variant = job.variant;
+                rows[i].key = job.key;
+            }
+        });
+
+    rows.erase(std::remove_if(rows.begin(), rows.end(), [](const ShaderCostReportRow& row) { return row.target == nullptr; }), rows.end());
+
+    for (const char* target : { "spirv", "dxil" })
+    {
+        ShaderCost total;
+        size_t count = 0;
+
+        for (auto& row : rows)
+        {
+            if (strcmp(row.target, target) == 0)
+            {
+                total.instructionCount += row.cost.instructionCount;
+                total.aluCount += row.cost.aluCount;
+                total.sampleCount += row.cost.sampleCount;
+                total.loadCount += row.cost.loadCount;
+                total.branchCount += row.cost.branchCount;
+                total.loopCount += row.cost.loopCount;
+                total.variableCount += row.cost.variableCount;
+                ++count;
+            }
+        }
+
+        if (count != 0)
+        {
+            fmt::println("{} {} shaders: {} instructions, {} ALU, {} samples, {} loads, {} branches, {} loops, {} variables", count, target,
+                total.instructionCount, total.aluCount, total.sampleCount, total.loadCount, total.branchCount, total.loopCount, total.variableCount);
+        }
+    }
+
+    std::string_view path = filePath;
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    std::string report = createShaderCostReport(rows, json);
+
+    FILE* file = fopen(filePath, "wb");
+    if (file == nullptr)
+        return false;
+
+    bool written = fwrite(report.data(), 1, report.size(), file) == report.size();
+    return (fclose(file) == 0) && written;
+}
+
+// Deterministic value in [min, max) derived from the seed and the key, so every interpreter run of a shader sees the same inputs.
+static float getRandomInput(XXH64_hash_t seed, uint64_t key, float min, float max)
+{
+    uint64_t bits = XXH3_64bits_withSeed(&key, sizeof(key), seed);
+    return min + (max - min) * (float(bits >> 40) / float(1 << 24));
+}
+
+static uint64_t getLaneInputKey(uint64_t key, size_t lane, uint32_t component)
+{
+    return (key << 8) | (lane << 2) | component;
+}
+
+// Runs every shader on random inputs in the reference interpreter, checking that the ranges the recompiler proved to remove
+// clamps and bounds checks hold, and that linked vertex shaders export the same values the linked pixel shaders read.
+// Returns the number of shaders that failed.
+static size_t validateShaders(const std::map<XXH64_hash_t, RecompiledShader>& shaders, const std::string_view include, const Options& options)
+{
+    std::vector<std::pair<XXH64_hash_t, const uint8_t*>> jobs;
+    for (auto& [hash, shader] : shaders)
+        jobs.emplace_back(hash, shader.data);
+
+    std::vector<std::string> failures(jobs.size());
+    size_t runCount = (options.validateInputCount + INTERPRETER_LANE_COUNT - 1) / INTERPRETER_LANE_COUNT;
+
+    fmt::println("Validating {} shaders with {} inputs each...", jobs.size(), runCount * INTERPRETER_LANE_COUNT);
+
+    std::for_each(std::execution::par, jobs.begin(), jobs.end(), [&](const std::pair<XXH64_hash_t, const uint8_t*>& job)
+        {
+            XXH64_hash_t hash = job.first;
+            const uint8_t* data = job.second;
+            std::string& failure = failures[&job - jobs.data()];
+
+            ShaderRecompiler recompiler;
+            configureRecompiler(recompiler, options);
+            recompiler.recompile(data, include);
+
+            ShaderInterpreter interpreter;
+            interpreter.clampRanges = recompiler.clampRanges;
+            interpreter.uncheckedConstantAccesses = recompiler.uncheckedConstantAccesses;
+            interpreter.load(data);
+
+            struct LinkedShader
+            {
+                XXH64_hash_t pixelShaderHash;
+                ShaderInterpreter interpreter;
+                uint32_t exportMasks[16];
+            };
+
+            std::vector<std::unique_ptr<LinkedShader>> linkedShaders;
+
+            auto findResult = options.linkedPixelShaders.find(hash);
+            if (!interpreter.isPixelShader() && findResult != options.linkedPixelShaders.end())
+            {
+                for (auto& [pixelShaderHash, interpolatorMasks] : findResult->second)
+                {
+                    ShaderRecompiler linkedRecompiler;
+                    linkedRecompiler.linkedInterpolatorMasks = interpolatorMasks;
+                    configureRecompiler(linkedRecompiler, options);
+                    linkedRecompiler.packInterpolators = options.packInterpolators;
+                    linkedRecompiler.recompile(data, include);
+
+                    auto& linkedShader = *linkedShaders.emplace_back(std::make_unique<LinkedShader>());
+                    linkedShader.pixelShaderHash = pixelShaderHash;
+                    linkedShader.interpreter.instructionOverrides = std::move(linkedRecompiler.linkedInstructions);
+                    linkedShader.interpreter.load(data);
+                    memcpy(linkedShader.exportMasks, linkedRecompiler.linkedExportMasks, sizeof(linkedShader.exportMasks));
+                }
+            }
+
+            auto inputs = std::make_unique<ShaderInterpreterInputs>();
+            auto outputs = std::make_unique<ShaderInterpreterOutputs>();
+            auto linkedOutputs = std::make_unique<ShaderInterpreterOutputs>();
+
+            for (size_t run = 0; run < runCount && failure.empty(); run++)
+            {
+                XXH64_hash_t seed = hash + run;
+
+                for (uint32_t i = 0; i < std::size(inputs->float4Constants); i++)
+                {
+                    for (uint32_t j = 0; j < 4; j++)
+                        inputs->float4Constants[i][j] = getRandomInput(seed, (1ull << 32) | (i * 4 + j), -4.0f, 4.0f);
+                }
+
+                inputs->booleans = uint32_t(XXH3_64bits_withSeed(&run, sizeof(run), hash));
+
+                for (uint32_t i = 0; i < std::size(inputs->loopCounts); i++)
+                    inputs->loopCounts[i] = int32_t(getRandomInput(seed, (2ull << 32) | i, 0.0f, 5.0f));
+
+                inputs->fetchVertex = [&](const VertexElement& element, LaneVector& value)
+                    {
+                        uint64_t key = (3ull << 32) | element.address;
+
+                        for (size_t lane = 0; lane < INTERPRETER_LANE_COUNT; lane++)
+                        {
+                            for (uint32_t component = 0; component < 4; component++)
+                            {
+                                // Blend indices are proven to be integers indexing at most 255 registers.
+                                if (element.usage == DeclUsage::BlendIndices)
+                                    value.values[component][lane] = std::floor(getRandomInput(seed, getLaneInputKey(key, lane, component), 0.0f, 256.0f));
+                                else
+                                    value.values[component][lane] = getRandomInput(seed, getLaneInputKey(key, lane, component), -2.0f, 2.0f);
+                            }
+                        }
+                    };
+
+                inputs->fetchInterpolator = [&](DeclUsage usage, uint32_t usageIndex, LaneVector& value)
+                    {
+                        uint64_t key = (4ull << 32) | (uint32_t(usage) << 4) | usageIndex;
+
+                        for (size_t lane = 0; lane < INTERPRETER_LANE_COUNT; lane++)
+                        {
+                            for (uint32_t component = 0; component < 4; component++)
+                                value.values[component][lane] = getRandomInput(seed, getLaneInputKey(key, lane, component), -2.0f, 2.0f);
+                        }
+                    };
+
+                inputs->fetchPixelPosition = [&](LaneVector& value)
+                    {
+                        for (size_t lane = 0; lane < INTERPRETER_LANE_COUNT; lane++)
+                        {
+                            value.values[0][lane] = std::floor(getRandomInput(seed, getLaneInputKey(5ull << 32, lane, 0), -1280.0f, 1280.0f));
+                            value.values[1][lane] = std::floor(getRandomInput(seed, getLaneInputKey(5ull << 32, lane, 1), 0.0f, 720.0f));
+                        }
+                    };
+
+                // Samples depend on the coordinates, so the same coordinates give the same sample in every run.
+                inputs->fetchTexture = [&](uint32_t samplerIndex, TextureDimension, bool weights, const LaneVector& texCoord, const float (&)[3], LaneVector& value)
+                    {
+                        for (size_t lane = 0; lane < INTERPRETER_LANE_COUNT; lane++)
+                        {
+                            uint32_t coordBits[3];
+                            for (uint32_t i = 0; i < 3; i++)
+                                memcpy(&coordBits[i], &texCoord.values[i][lane], sizeof(uint32_t));
+
+                            uint64_t key = XXH3_64bits_withSeed(coordBits, sizeof(coordBits), samplerIndex);
+
+                            for (uint32_t component = 0; component < 4; component++)
+                                value.values[component][lane] = getRandomInput(seed, key + component, weights ? 0.0f : -1.0f, 1.0f);
+                        }
+                    };
+
+                interpreter.run(*inputs, *outputs);
+
+                if (outputs->rangeViolations != 0)
+                {
+                    failure = fmt::format("Shader {:X} violates a range the recompiler assumed on lane mask {:X}", hash, outputs->rangeViolations);
+                    break;
+                }
+
+                for (auto& linkedShader : linkedShaders)
+                {
+                    linkedShader->interpreter.run(*inputs, *linkedOutputs);
+
+                    auto equals = [](float left, float right)
+                        {
+                            return left == right || (std::isnan(left) && std::isnan(right));
+                        };
+
+                    auto compareExport = [&](uint32_t exportIndex, uint32_t mask)
+                        {
+                            for (uint32_t component = 0; component < 4; component++)
+                            {
+                                if ((mask >> component) & 0x1)
+                                {
+                                    auto& values = outputs->exports[exportIndex].values[component];
+                                    auto& linkedValues = linkedOutputs->exports[exportIndex].values[component];
+
+                                    for (size_t lane = 0; lane < INTERPRETER_LANE_COUNT; lane++)
+                                    {
+                                        if (!equals(values[lane], linkedValues[lane]))
+                                            return false;
+                                    }
+                                }
+                            }
+
+                            return true;
+                        };
+
+                    if (!compareExport(uint32_t(ExportRegister::VSPosition), 0b1111))
+                    {
+                        failure = fmt::format("Shader {:X} linked with {:X} exports a different position", hash, linkedShader->pixelShaderHash);
+                        break;
+                    }
+
+                    for (uint32_t i = 0; i < std::size(linkedShader->exportMasks); i++)
+                    {
+                        if (!compareExport(i, linkedShader->exportMasks[i]))
+                        {
+                            failure = fmt::format("Shader {:X} linked with {:X} exports a different value to interpolator {}", hash, linkedShader->pixelShaderHash, i);
+                            break;
+                        }
+                    }
+
+                    if (!failure.empty())
+                        break;
+                }
+            }
+        });
+
+    size_t failureCount = 0;
+
+    for (auto& failure : failures)
+    {
+        if (!failure.empty())
+        {
+            fmt::println("{}", failure);
+            ++failureCount;
+        }
+    }
+
+    fmt::println("{} of {} shaders passed validation", jobs.size() - failureCount, jobs.size());
+    return failureCount;
+}
+
+// Spec constant combinations to precompile for a shader reading the given spec constants.
+static std::vector<uint64_t> getSpecConstantsVariants(XXH64_hash_t hash, uint32_t specConstantsMask, const Options& options)
+{
+    std::vector<uint64_t> specConstantsVariants;
+
+    if (options.allSpecConstantsVariants)
+    {
+        // Enumerate every subset of the mask, including the empty one.
+        uint32_t specConstants = specConstantsMask;
+        while (true)
+        {
+            specConstantsVariants.push_back(specConstants);
+            if (specConstants == 0)
+                break;
+
+            specConstants = (specConstants - 1) & specConstantsMask;
+        }
+    }
+    else
+    {
+        auto findResult = options.specConstantsVariants.find(hash);
+        if (findResult != options.specConstantsVariants.end())
+        {
+            for (uint64_t specConstants : findResult->second)
+                specConstantsVariants.push_back(specConstants & specConstantsMask);
+        }
+    }
+
+    std::sort(specConstantsVariants.begin(), specConstantsVariants.end());
+    specConstantsVariants.erase(std::unique(specConstantsVariants.begin(), specConstantsVariants.end()), specConstantsVariants.end());
+
+    return specConstantsVariants;
+}
+
+// g_Booleans values to precompile for a shader branching on the given bits.
+static std::vector<uint32_t> getBooleansVariants(XXH64_hash_t hash, uint32_t booleansMask, const Options& options)
+{
+    std::vector<uint32_t> booleansVariants;
+
+    auto findResult = options.booleansVariants.find(hash);
+    if (findResult != options.booleansVariants.end())
+    {
+        for (uint64_t booleans : findResult->second)
+            booleansVariants.push_back(uint32_t(booleans) & booleansMask);
+    }
+
+    std::sort(booleansVariants.begin(), booleansVariants.end());
+    booleansVariants.erase(std::unique(booleansVariants.begin(), booleansVariants.end()), booleansVariants.end());
+
+    return booleansVariants;
+}
+
+void recompileShader(RecompiledShader& shader, XXH64_hash_t hash, const std::string_view include, const Options& options)
+{
+    thread_local ShaderRecompiler recompiler;
+    recompiler = {};
+    configureRecompiler(recompiler, options);
+    recompiler.recompile(shader.data, include);
+
+    shader.specConstantsMask = recompiler.specConstantsMask;
+    shader.inputElements = recompiler.inputElements;
+    shader.clampsRemoved = recompiler.clampsRemoved;
+
+    compileShader(shader, recompiler.out, recompiler.isPixelShader, recompiler.specConstantsMask != 0, options);
+
+    if (shader.specConstantsMask != 0)
+    {
+        for (uint64_t specConstants : getSpecConstantsVariants(hash, shader.specConstantsMask, options))
+        {
+            auto& variant = shader.variants.emplace_back();
+            variant.kind = SHADER_VARIANT_SPEC_CONSTANTS;
+            variant.key = specConstants;
+
+            std::string source = fmt::format("#define SPEC_CONSTANTS_VALUE 0x{:X}\n", specConstants);
+            source += recompiler.out;
+
+            compileShader(variant, source, recompiler.isPixelShader, false, options);
+        }
+    }
+
+    // Vertex shaders write interpolator components their pixel shaders might not read, so a packed layout derived from
+    // the vertex shader alone would rarely match the one of the pixel shader. Vertex shaders are only packed through
+    // their linked pair variants instead, which use the layout of the pixel shader they are linked with.
+    if (options.packInterpolators && recompiler.isPixelShader)
+    {
+        ShaderRecompiler packedRecompiler;
+        configureRecompiler(packedRecompiler, options);
+        packedRecompiler.packInterpolators = true;
+        packedRecompiler.recompile(shader.data, include);
+
+        // Keyed by the packing signature, which identifies the layout linked vertex shader variants are packed with.
+        auto& variant = shader.variants.emplace_back();
+        variant.kind = SHADER_VARIANT_PACKED_INTERPOLATORS;
+        variant.key = packedRecompiler.interpolatorSignature;
+
+        compileShader(variant, packedRecompiler.out, packedRecompiler.isPixelShader, packedRecompiler.specConstantsMask != 0, options);
+    }
+
+    auto findResult = options.linkedPixelShaders.find(hash);
+    if (!recompiler.isPixelShader && findResult != options.linkedPixelShaders.end())
+    {
+        for (auto& [pixelShaderHash, interpolatorMasks] : findResult->second)
+        {
+            ShaderRecompiler linkedRecompiler;
+            linkedRecompiler.linkedInterpolatorMasks = interpolatorMasks;
+            configureRecompiler(linkedRecompiler, options);
+            linkedRecompiler.packInterpolators = options.packInterpolators;
+            linkedRecompiler.recompile(shader.data, include);
+
+            auto& variant = shader.variants.emplace_back();
+            variant.kind = SHADER_VARIANT_LINKED_PAIR;
+            variant.key = pixelShaderHash;
+
+            compileShader(variant, linkedRecompiler.out, false, linkedRecompiler.specConstantsMask != 0, options);
+        }
+    }
+
+    if (recompiler.booleansMask != 0)
+    {
+        for (uint32_t booleans : getBooleansVariants(hash, recompiler.booleansMask, options))
+        {
+            ShaderRecompiler booleansRecompiler;
+            configureRecompiler(booleansRecompiler, options);
+            booleansRecompiler.specializeBooleans = true;
+            booleansRecompiler.specializedBooleans = booleans;
+            booleansRecompiler.recompile(shader.data, include);
+
+            // The mask of used bits is stored in the upper half of the key, so the runtime can mask
+            // g_Booleans before comparing it against the lower half.
+            auto& variant = shader.variants.emplace_back();
+            variant.kind = SHADER_VARIANT_BOOLEANS;
+            variant.key = (uint64_t(recompiler.booleansMask) << 32) | booleans;
+
+            compileShader(variant, booleansRecompiler.out, booleansRecompiler.isPixelShader, booleansRecompiler.specConstantsMask != 0, options);
+        }
+    }
+}
+
+// Returns whether a shader read back from a cache lacks a spec constant, g_Booleans or linked pair variant requested
+// by the variant lists.
+static bool isMissingVariants(XXH64_hash_t hash, const RecompiledShader& cachedShader, const uint8_t* data, const std::string_view include, const Options& options)
+{
+    auto hasVariant = [&](uint32_t kind, uint64_t key)
+        {
+            return std::any_of(cachedShader.variants.begin(), cachedShader.variants.end(), [&](const RecompiledShaderVariant& variant)
+                {
+                    return variant.kind == kind && variant.key == key;
+                });
+        };
+
+    if (cachedShader.specConstantsMask != 0)
+    {
+        for (uint64_t specConstants : getSpecConstantsVariants(hash, cachedShader.specConstantsMask, options))
+        {
+            if (!hasVariant(SHADER_VARIANT_SPEC_CONSTANTS, specConstants))
+                return true;
+        }
+    }
+
+    bool isPixelShader = (reinterpret_cast<const ShaderContainer*>(data)->flags & 0x1) == 0;
+    auto linkedResult = options.linkedPixelShaders.find(hash);
+    if (!isPixelShader && linkedResult != options.linkedPixelShaders.end())
+    {
+        for (auto& [pixelShaderHash, _] : linkedResult->second)
+        {
+            if (!hasVariant(SHADER_VARIANT_LINKED_PAIR, pixelShaderHash))
+                return true;
+        }
+    }
+
+    if (options.booleansVariants.find(hash) != options.booleansVariants.end())
+    {
+        // The bits the shader branches on are in the upper half of the keys of its variants. Without any, the shader
+        // is recompiled to find them, as it may not branch on booleans at all.
+        uint32_t booleansMask = 0;
+        auto booleansVariant = std::find_if(cachedShader.variants.begin(), cachedShader.variants.end(), [](const RecompiledShaderVariant& variant)
+            {
+                return variant.kind == SHADER_VARIANT_BOOLEANS;
+            });
+
+        if (booleansVariant != cachedShader.variants.end())
+        {
+            booleansMask = uint32_t(booleansVariant->key >> 32);
+        }
+        else
+        {
+            ShaderRecompiler recompiler;
+            configureRecompiler(recompiler, options);
+            recompiler.recompile(data, include);
+            booleansMask = recompiler.booleansMask;
+        }
+
+        if (booleansMask != 0)
+        {
+            for (uint32_t booleans : getBooleansVariants(hash, booleansMask, options))
+            {
+                if (!hasVariant(SHADER_VARIANT_BOOLEANS, (uint64_t(booleansMask) << 32) | booleans))
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Finds the shader containers in the file, returning the hash and offset of each.
+static std::vector<std::pair<XXH64_hash_t, size_t>> findShaderContainers(const uint8_t* data, size_t dataSize)
+{
+    std::vector<std::pair<XXH64_hash_t, size_t>> containers;
+
+    for (size_t i = 0; dataSize > sizeof(ShaderContainer) && i < dataSize - sizeof(ShaderContainer) - 1;)
+    {
+        auto shaderContainer = reinterpret_cast<const ShaderContainer*>(data + i);
+        size_t containerSize = shaderContainer->virtualSize + shaderContainer->physicalSize;
+
+        if ((shaderContainer->flags & 0xFFFFFF00) == 0x102A1100 &&
+            containerSize <= (dataSize - i) &&
+            shaderContainer->field1C == 0 &&
+            shaderContainer->field20 == 0)
+        {
+            containers.emplace_back(XXH3_64bits(shaderContainer, containerSize), i);
+            i += containerSize;
+        }
+        else
+        {
+            i += sizeof(uint32_t);
+        }
+    }
+
+    return containers;
+}
+
+static std::string getShaderFilename(const std::filesystem::path& path)
+{
+    std::string filename = path.string();
+    size_t shaderPos = filename.find("shader");
+    if (shaderPos != std::string::npos) {
+        filename = filename.substr(shaderPos);
+        // Prevent bad escape sequences in Windows shader path.
+        std::replace(filename.begin(), filename.end(), '\\', '/');
+    }
+
+    return filename;
+}
+
+static void resolveShaderPairs(const std::map<XXH64_hash_t, RecompiledShader>& shaders, Options& options)
+{
+    options.linkedPixelShaders.clear();
+
+    for (auto& [vertexShaderHash, pixelShaderHashes] : options.shaderPairs)
+    {
+        auto& linkedPixelShaders = options.linkedPixelShaders[vertexShaderHash];
+
+        for (uint64_t pixelShaderHash : pixelShaderHashes)
+        {
+            auto findResult = shaders.find(pixelShaderHash);
+            if (findResult == shaders.end() || (reinterpret_cast<const ShaderContainer*>(findResult->second.data)->flags & 0x1) != 0)
+            {
+                fmt::println("Pixel shader {:X} paired with {:X} was not found", pixelShaderHash, vertexShaderHash);
+                continue;
+            }
+
+            linkedPixelShaders.emplace_back(pixelShaderHash, getInterpolatorMasks(findResult->second.data));
+        }
+
+        std::sort(linkedPixelShaders.begin(), linkedPixelShaders.end());
+        linkedPixelShaders.erase(std::unique(linkedPixelShaders.begin(), linkedPixelShaders.end()), linkedPixelShaders.end());
+    }
+}
+
+// Compiles the AIR sources of the shaders and their variants in a single pass through the worker pool.
+// Returns the number of shaders that failed to compile.
+static size_t compileAirShaders(std::map<XXH64_hash_t, RecompiledShader>& shaders, const XXH64_hash_t* hashes, size_t hashCount, const Options& options, const char* executablePath)
+{
+    size_t failureCount = 0;
+
+#ifdef XENOS_RECOMP_AIR
+    std::vector<std::pair<XXH64_hash_t, CompiledShader*>> airShaders;
+    std::vector<std::string> airSources;
+
+    for (size_t i = 0; i < hashCount; i++)
+    {
+        auto& shader = shaders[hashes[i]];
+        airShaders.emplace_back(hashes[i], &shader);
+        for (auto& variant : shader.variants)
+            airShaders.emplace_back(hashes[i], &variant);
+    }
+
+    for (auto& [hash, shader] : airShaders)
+        airSources.push_back(std::move(shader->airSource));
+
+    AirCompiler airCompiler;
+    airCompiler.workerCommand = options.airWorkerCommand;
+    airCompiler.workerCount = options.airWorkerCount;
+
+    if (airCompiler.workerCommand.empty())
+        airCompiler.workerCommand = { executablePath, "--air-worker" };
+
+    fmt::println("Compiling {} AIR shaders with {} workers...", airSources.size(), airCompiler.workerCount);
+
+    auto airResults = airCompiler.compile(airSources);
+
+    for (size_t i = 0; i < airResults.size(); i++)
+    {
+        if (airResults[i].error.empty())
+        {
+            airShaders[i].second->air = std::move(airResults[i].data);
+        }
+        else
+        {
+            fmt::println("Failed to compile shader {:X} to AIR: {}", airShaders[i].first, airResults[i].error);
+            fmt::println("Generated source:\n{}", airSources[i]);
+            ++failureCount;
+        }
+    }
+#endif
+
+    return failureCount;
+}
+
+static size_t getCompiledSize(const CompiledShader& shader)
+{
+    return shader.dxil.size() + shader.spirv.size() + shader.air.size() + shader.airSource.size();
+}
+
+#ifndef _WIN32
+// Requests are a "<hash> <container size> <linked pixel shader count>" line followed by the container, and a
+// "<pixel shader hash> <mask count> <masks...>" line for each linked pixel shader. Responses are a "<size>" line
+// followed by the serialized shader.
+static bool sendRecompileRequest(Process& worker, XXH64_hash_t hash, const RecompiledShader& shader, const Options& options)
+{
+    auto shaderContainer = reinterpret_cast<const ShaderContainer*>(shader.data);
+    size_t containerSize = shaderContainer->virtualSize + shaderContainer->physicalSize;
+
+    auto findResult = options.linkedPixelShaders.find(hash);
+    size_t linkedCount = findResult != options.linkedPixelShaders.end() ? findResult->second.size() : 0;
+
+    std::string request = fmt::format("{:X} {} {}\n", hash, containerSize, linkedCount);
+    request.append(reinterpret_cast<const char*>(shader.data), containerSize);
+
+    for (size_t i = 0; i < linkedCount; i++)
+    {
+        auto& [pixelShaderHash, interpolatorMasks] = findResult->second[i];
+        request += fmt::format("{:X} {}", pixelShaderHash, interpolatorMasks.size());
+        for (uint32_t interpolatorMask : interpolatorMasks)
+            request += fmt::format(" {}", interpolatorMask);
+
+        request += '\n';
+    }
+
+    return writeAll(worker.input, request.data(), request.size());
+}
+
+// Upper bound of a response size, anything larger is taken as a garbled response rather than allocated.
+static constexpr size_t MAX_RECOMPILE_RESPONSE_SIZE = size_t(1) << 32;
+
+static bool receiveRecompileResponse(Process& worker, RecompiledShader& shader, std::chrono::steady_clock::time_point deadline)
+{
+    std::string header;
+    if (!readLine(worker.output, header, deadline))
+        return false;
+
+    size_t size = 0;
+    char trailing;
+    if (header.empty() || !isdigit(uint8_t(header[0])) || sscanf(header.c_str(), "%zu%c", &size, &trailing) != 1 || size > MAX_RECOMPILE_RESPONSE_SIZE)
+        return false;
+
+    std::vector<uint8_t> data(size);
+    return readExact(worker.output, data.data(), data.size(), deadline) && deserializeShader(data.data(), data.size(), shader);
+}
+
+// Recompiles the shader in a worker process, starting a new worker if there is none. A worker crashing on a shader is
+// restarted and given the shader once more, as the crash may have been caused by something else, such as running out
+// of memory. A worker taking longer than the timeout is killed, and the shader is not retried. Returns false if the
+// shader crashed both workers or timed out.
+static bool recompileShaderInWorker(Process& worker, RecompiledShader& shader, XXH64_hash_t hash, const Options& options)
+{
+    for (uint32_t attempt = 0; attempt < 2; attempt++)
+    {
+        if (worker.pid == -1 && !spawnProcess(options.recompileWorkerCommand, false, worker))
+        {
+            fmt::println("Failed to start recompiler worker: {}", strerror(errno));
+            return false;
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options.isolatedWorkerTimeout);
+        if (sendRecompileRequest(worker, hash, shader, options) && receiveRecompileResponse(worker, shader, deadline))
+            return true;
+
+        // A worker still running either sent a garbled response or is stuck, and crashed workers are only reaped.
+        bool timedOut = std::chrono::steady_clock::now() >= deadline;
+        int status = worker.kill();
+
+        if (timedOut)
+        {
+            fmt::println("Recompiler worker timed out after {} seconds on shader {:X}", options.isolatedWorkerTimeout, hash);
+            return false;
+        }
+
+        fmt::println("Recompiler worker exited with {} on shader {:X}", describeExitStatus(status), hash);
+    }
+
+    return false;
+}
+
+// Recompiles shaders sent by the parent process over stdin until it is closed.
+static int runRecompileWorker(const std::string_view include, Options& options)
+{
+    // Responses are written to the original stdout, while everything printed goes to stderr instead.
+    int output = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string line;
+    while (readLine(STDIN_FILENO, line))
+    {
+        std::istringstream requestStream(line);
+        std::string hashToken;
+        size_t containerSize = 0;
+        size_t linkedCount = 0;
+
+        if (!(requestStream >> hashToken >> containerSize >> linkedCount))
+            return 1;
+
+        XXH64_hash_t hash = std::stoull(hashToken, nullptr, 16);
+        auto data = std::make_unique<uint8_t[]>(containerSize);
+        if (!readExact(STDIN_FILENO, data.get(), containerSize))
+            return 1;
+
+        options.linkedPixelShaders.erase(hash);
+        for (size_t i = 0; i < linkedCount; i++)
+        {
+            if (!readLine(STDIN_FILENO, line))
+                return 1;
+
+            std::istringstream linkedStream(line);
+            std::string pixelShaderHash;
+            size_t maskCount = 0;
+            linkedStream >> pixelShaderHash >> maskCount;
+
+            auto& [linkedHash, interpolatorMasks] = options.linkedPixelShaders[hash].emplace_back();
+            linkedHash = std::stoull(pixelShaderHash, nullptr, 16);
+            interpolatorMasks.resize(maskCount);
+            for (auto& interpolatorMask : interpolatorMasks)
+                linkedStream >> interpolatorMask;
+        }
+
+        RecompiledShader shader;
+        shader.data = data.get();
+        recompileShader(shader, hash, include, options);
+
+        std::vector<uint8_t> response = serializeShader(shader);
+        std::string header = fmt::format("{}\n", response.size());
+
+        if (!writeAll(output, header.data(), header.size()) || !writeAll(output, response.data(), response.size()))
+            return 1;
+    }
+
+    return 0;
+}
+#endif
+
+// Arguments that don't affect the recompiled shaders, and are left out of the options fingerprint, along with their values.
+static const char* const FINGERPRINT_IGNORED_ARGUMENTS[] = { "--checkpoint", "--patch", "--shard", "--isolate", "--isolate-timeout", "--stream-cache",
+    "--air-compiler", "--air-workers", "--cost-report", "--memory-budget" };
+
+// Arguments selecting the variants to precompile, along with their values.
+static const char* const VARIANT_LIST_ARGUMENTS[] = { "--spec-variants", "--pairs", "--booleans" };
+
+// Fingerprint of everything the recompiled shaders depend on: the arguments, the shader common header, and the
+// contents of the list files. Paths are left out if requested, for shards that are written to different files,
+// possibly on different machines, but must have been built the same way. Variant lists are left out if requested,
+// for caches that are patched with new variants.
+static uint64_t computeOptionsFingerprint(int argc, char** argv, const std::vector<const char*>& arguments, const std::string_view include, bool ignorePaths, bool ignoreVariantLists)
+{
+    std::string fingerprint(include);
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto isArgument = [&](const char* argument) { return strcmp(argv[i], argument) == 0; };
+
+        if (std::any_of(std::begin(FINGERPRINT_IGNORED_ARGUMENTS), std::end(FINGERPRINT_IGNORED_ARGUMENTS), isArgument) ||
+            (ignoreVariantLists && std::any_of(std::begin(VARIANT_LIST_ARGUMENTS), std::end(VARIANT_LIST_ARGUMENTS), isArgument)))
+        {
+            ++i;
+            continue;
+        }
+
+        if (isArgument("--watch"))
+            continue;
+
+        if (ignorePaths && std::find(arguments.begin(), arguments.end(), argv[i]) != arguments.end())
+            continue;
+
+        fingerprint += argv[i];
+        fingerprint += '\0';
+
+        if ((isArgument("--spec-variants") || isArgument("--pairs") || isArgument("--booleans")) && (i + 1) < argc && std::filesystem::is_regular_file(argv[i + 1]))
+        {
+            size_t fileSize = 0;
+            auto fileData = readAllBytes(argv[i + 1], fileSize);
+            fingerprint.append(reinterpret_cast<const char*>(fileData.get()), fileSize);
+
+            // The contents are what matters.
+            if (ignorePaths)
+                ++i;
+        }
+    }
+
+    return XXH3_64bits(fingerprint.data(), fingerprint.size());
+}
+
+// Recompiles the shaders with the given hashes on every hardware thread, or in isolated worker processes if enabled,
+// then compiles them to AIR. Shaders crashing their workers are quarantined and removed. Returns the number of shaders
+// that failed to compile.
+//
+// If a checkpoint is given, shaders saved to it are restored instead of recompiled, and recompiled shaders are saved.
+//
+// If a stream is given, the shaders are recompiled in the order of the hashes and added to the stream as soon as
+// every shader before them is done. Workers stop taking new shaders while the finished ones waiting to be added
+// exceed the memory budget.
+static size_t recompileShaders(std::map<XXH64_hash_t, RecompiledShader>& shaders, const std::vector<XXH64_hash_t>& hashes, const std::string_view include, const Options& options, const char* executablePath, ShaderCacheStream* stream = nullptr, ShaderCheckpoint* checkpoint = nullptr)
+{
+    std::mutex shaderQueueMutex;
+    std::condition_variable shaderQueueCondition;
+    size_t nextShader = 0;
+    std::vector<size_t> pendingSizes(hashes.size());
+    std::vector<bool> finished(hashes.size());
+    std::vector<uint8_t> quarantined(hashes.size());
+    size_t pendingSize = 0;
+
+    uint32_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if (options.isolatedWorkerCount != 0)
+    {
+#ifndef _WIN32
+        // Report workers exiting early as failed writes instead of terminating.
+        signal(SIGPIPE, SIG_IGN);
+#endif
+
+        numThreads = options.isolatedWorkerCount;
+        fmt::println("Recompiling shaders with {} worker processes", numThreads);
+    }
+    else
+    {
+        fmt::println("Recompiling shaders with {} threads", numThreads);
+    }
+
+    std::atomic<uint32_t> progress = 0;
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (uint32_t i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back([&]
+        {
+#ifndef _WIN32
+            Process worker;
+#endif
+
+            while (true)
+            {
+                size_t shaderIndex;
+                {
+                    // The first unfinished shader is always being recompiled, so the stream keeps moving while waiting.
+                    std::unique_lock lock(shaderQueueMutex);
+                    shaderQueueCondition.wait(lock, [&] { return stream == nullptr || pendingSize <= options.streamMemoryBudget; });
+                    if (nextShader == hashes.size()) {
+                        return;
+                    }
+                    shaderIndex = nextShader++;
+                }
+
+                XXH64_hash_t shaderHash = hashes[shaderIndex];
+                auto& shader = shaders[shaderHash];
+
+                if (checkpoint == nullptr || !checkpoint->restore(shaderHash, shader))
+                {
+#ifndef _WIN32
+                    if (options.isolatedWorkerCount != 0)
+                        quarantined[shaderIndex] = !recompileShaderInWorker(worker, shader, shaderHash, options);
+                    else
+#endif
+                        recompileShader(shader, shaderHash, include, options);
+
+                    if (quarantined[shaderIndex])
+                        fmt::println("Quarantined shader {:X} from {}", shaderHash, shader.filename);
+                    else if (checkpoint != nullptr)
+                        checkpoint->save(shaderHash, shader);
+                }
+
+                size_t currentProgress = ++progress;
+                if ((currentProgress % 10) == 0 || (currentProgress == hashes.size() - 1))
+                    fmt::println("Recompiling shaders... {}%", currentProgress / float(hashes.size()) * 100.0f);
+
+                if (stream != nullptr)
+                {
+                    size_t shaderSize = getCompiledSize(shader);
+                    for (auto& variant : shader.variants)
+                        shaderSize += getCompiledSize(variant);
+
+                    std::lock_guard lock(shaderQueueMutex);
+                    pendingSizes[shaderIndex] = shaderSize;
+                    pendingSize += shaderSize;
+                    finished[shaderIndex] = true;
+                    shaderQueueCondition.notify_all();
+                }
+            }
+        });
+    }
+
+    size_t failureCount = 0;
+
+    if (stream != nullptr)
+    {
+        for (size_t begin = 0; begin < hashes.size();)
+        {
+            size_t end = begin;
+            std::vector<XXH64_hash_t> finishedHashes;
+            {
+                std::unique_lock lock(shaderQueueMutex);
+                shaderQueueCondition.wait(lock, [&] { return finished[begin]; });
+                for (; end < hashes.size() && finished[end]; end++)
+                {
+                    if (!quarantined[end])
+                        finishedHashes.push_back(hashes[end]);
+                }
+            }
+
+            failureCount += compileAirShaders(shaders, finishedHashes.data(), finishedHashes.size(), options, executablePath);
+
+            for (XXH64_hash_t hash : finishedHashes)
+                stream->add(hash, shaders[hash]);
+
+            {
+                std::lock_guard lock(shaderQueueMutex);
+                for (size_t i = begin; i < end; i++)
+                    pendingSize -= pendingSizes[i];
+            }
+
+            shaderQueueCondition.notify_all();
+            begin = end;
+        }
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (options.memoryGovernor != nullptr && options.isolatedWorkerCount == 0)
+    {
+        fmt::println("Memory budget allowed up to {} concurrent DXC compiles, and delayed {} compiles",
+            options.memoryGovernor->getPeakRunningCount(), options.memoryGovernor->getThrottledCount());
+    }
+
+    std::vector<XXH64_hash_t> compiledHashes;
+    for (size_t i = 0; i < hashes.size(); i++)
+    {
+        if (quarantined[i])
+        {
+            shaders.erase(hashes[i]);
+            ++failureCount;
+        }
+        else
+        {
+            compiledHashes.push_back(hashes[i]);
+        }
+    }
+
+    if (stream == nullptr)
+        failureCount += compileAirShaders(shaders, compiledHashes.data(), compiledHashes.size(), options, executablePath);
+
+    return failureCount;
+}
+
+// Watch mode favors compression speed, as the cache is rewritten after every change.
+static constexpr int WATCH_COMPRESSION_LEVEL = 1;
+
+struct WatchedFile
+{
+    std::unique_ptr<uint8_t[]> data;
+    std::vector<std::pair<XXH64_hash_t, size_t>> containers;
+};
+
+// Builds the shader cache, then rebuilds it whenever files in the input directory change. Every compiled shader is kept
+// in memory, so only the changed files are rescanned and only shaders with hashes not seen before are recompiled.
+static int watchShaders(const char* input, const char* output, const std::string_view include, Options& options, uint64_t optionsFingerprint, const char* executablePath)
+{
+    FileWatcher watcher;
+    if (!watcher.watch(input))
+    {
+        fmt::println("Failed to watch {} for changes", input);
+        return 1;
+    }
+
+    std::map<std::filesystem::path, WatchedFile> files;
+    std::map<XXH64_hash_t, RecompiledShader> shaders;
+    std::vector<std::filesystem::path> changes = { input };
+
+    auto isWithin = [](const std::filesystem::path& path, const std::filesystem::path& directory)
+        {
+            return std::mismatch(directory.begin(), directory.end(), path.begin(), path.end()).first == directory.end();
+        };
+
+    auto scanFile = [&](const std::filesystem::path& path)
+        {
+            WatchedFile file;
+            size_t fileSize = 0;
+            file.data = readAllBytes(path.string().c_str(), fileSize);
+            file.containers = findShaderContainers(file.data.get(), fileSize);
+
+            if (!file.containers.empty())
+                files[path] = std::move(file);
+        };
+
+    while (true)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        for (auto& change : changes)
+        {
+            // Paths are ordered by their elements, so the changed path is followed by everything inside it.
+            for (auto it = files.lower_bound(change); it != files.end() && isWithin(it->first, change);)
+                it = files.erase(it);
+
+            std::error_code ec;
+            if (std::filesystem::is_directory(change, ec))
+            {
+                for (auto& file : std::filesystem::recursive_directory_iterator(change, ec))
+                {
+                    if (!file.is_directory(ec))
+                        scanFile(file.path());
+                }
+            }
+            else if (std::filesystem::is_regular_file(change, ec))
+            {
+                scanFile(change);
+            }
+        }
+
+        // Shaders are moved over from the previous build, and pointed to the data of the files they are found in now.
+        std::map<XXH64_hash_t, RecompiledShader> nextShaders;
+        std::vector<XXH64_hash_t> recompileHashes;
+        bool changed = false;
 
-struct RecompiledShader
-{
-    uint8_t* data = nullptr;
-    IDxcBlob* dxil = nullptr;
-    std::vector<uint8_t> spirv;
-    std::vector<uint8_t> air;
-    uint32_t specConstantsMask = 0;
-};
+        for (auto& [path, file] : files)
+        {
+            for (auto& [hash, offset] : file.containers)
+            {
+                auto shader = nextShaders.try_emplace(hash);
+                if (!shader.second)
+                    continue;
 
-void recompileShader(RecompiledShader& shader, const std::string_view include, std::atomic<uint32_t>& progress, uint32_t numShaders)
-{
-    thread_local ShaderRecompiler recompiler;
-    recompiler = {};
-    recompiler.recompile(shader.data, include);
+                std::string filename = getShaderFilename(path);
+                auto findResult = shaders.find(hash);
 
-    shader.specConstantsMask = recompiler.specConstantsMask;
+                if (findResult != shaders.end())
+                {
+                    changed |= findResult->second.filename != filename;
+                    shader.first->second = std::move(findResult->second);
+                }
+                else
+                {
+                    recompileHashes.push_back(hash);
+                }
 
-    thread_local DxcCompiler dxcCompiler;
+                shader.first->second.data = file.data.get() + offset;
+                shader.first->second.filename = std::move(filename);
+            }
+        }
 
-#ifdef XENOS_RECOMP_DXIL
-    shader.dxil = dxcCompiler.compile(recompiler.out, recompiler.isPixelShader, recompiler.specConstantsMask != 0, false);
-    assert(shader.dxil != nullptr);
-    assert(*(reinterpret_cast<uint32_t *>(shader.dxil->GetBufferPointer()) + 1) != 0 && "DXIL was not signed properly!");
-#endif
+        changed |= !recompileHashes.empty() || nextShaders.size() != shaders.size();
+        shaders = std::move(nextShaders);
 
-#ifdef XENOS_RECOMP_AIR
-    shader.air = AirCompiler::compile(recompiler.out);
-#endif
+        // Vertex shaders are also recompiled when the pixel shaders they are linked with appear or disappear.
+        auto previousLinkedPixelShaders = std::move(options.linkedPixelShaders);
+        resolveShaderPairs(shaders, options);
 
-    IDxcBlob* spirv = dxcCompiler.compile(recompiler.out, recompiler.isPixelShader, false, true);
-    assert(spirv != nullptr);
+        for (auto& [hash, linkedPixelShaders] : options.linkedPixelShaders)
+        {
+            auto findResult = previousLinkedPixelShaders.find(hash);
+            if (shaders.find(hash) != shaders.end() && (findResult == previousLinkedPixelShaders.end() || findResult->second != linkedPixelShaders))
+                recompileHashes.push_back(hash);
+        }
 
-    bool result = smolv::Encode(spirv->GetBufferPointer(), spirv->GetBufferSize(), shader.spirv, smolv::kEncodeFlagStripDebugInfo);
-    assert(result);
+        std::sort(recompileHashes.begin(), recompileHashes.end());
+        recompileHashes.erase(std::unique(recompileHashes.begin(), recompileHashes.end()), recompileHashes.end());
 
-    spirv->Release();
+        if (changed || !recompileHashes.empty())
+        {
+            for (XXH64_hash_t hash : recompileHashes)
+            {
+                auto& shader = shaders[hash];
+                RecompiledShader recompiledShader;
+                recompiledShader.data = shader.data;
+                recompiledShader.filename = std::move(shader.filename);
+                shader = std::move(recompiledShader);
+            }
+
+            size_t failureCount = 0;
+            if (!recompileHashes.empty())
+                failureCount = recompileShaders(shaders, recompileHashes, include, options, executablePath);
+
+            // Compressed at a fast level to keep iteration quick, and written to a temporary file first
+            // so builds picking up the output never see it half written.
+            std::string cache = createShaderCache(shaders, DXC_PROFILE_NAMES[uint32_t(options.dxcProfile)], options.hasVariants(), optionsFingerprint, WATCH_COMPRESSION_LEVEL);
+            std::string temporaryOutput = fmt::format("{}.tmp", output);
+            writeAllBytes(temporaryOutput.c_str(), cache.data(), cache.size());
+
+            std::error_code ec;
+            std::filesystem::rename(temporaryOutput, output, ec);
+            if (ec)
+                fmt::println("Failed to write shader cache to {}: {}", output, ec.message());
+
+            auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+            fmt::println("Updated shader cache with {} shaders in {:.1f} ms, {} recompiled, {} failed", shaders.size(), duration.count(), recompileHashes.size(), failureCount);
+        }
 
-    size_t currentProgress = ++progress;
-    if ((currentProgress % 10) == 0 || (currentProgress == numShaders - 1))
-        fmt::println("Recompiling shaders... {}%", currentProgress / float(numShaders) * 100.0f);
+        fmt::println("Watching {} for changes...", input);
+        changes = watcher.waitForChanges();
+    }
 }
 
 int main(int argc, char** argv)
 {
+    Options options;
+    std::vector<const char*> arguments;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--spec-variants") == 0 && (i + 1) < argc)
+        {
+            const char* specVariants = argv[++i];
+            if (strcmp(specVariants, "all") == 0)
+                options.allSpecConstantsVariants = true;
+            else
+                options.specConstantsVariants = readHashListFile(specVariants);
+        }
+        else if (strcmp(argv[i], "--pack-interpolators") == 0)
+        {
+            options.packInterpolators = true;
+        }
+        else if (strcmp(argv[i], "--pairs") == 0 && (i + 1) < argc)
+        {
+            options.shaderPairs = readHashListFile(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--booleans") == 0 && (i + 1) < argc)
+        {
+            options.booleansVariants = readHashListFile(argv[++i]);
+        }
+#ifdef XENOS_RECOMP_AIR
+        else if (strcmp(argv[i], "--air-worker") == 0)
+        {
+            return AirCompiler::runWorker();
+        }
+        else if (strcmp(argv[i], "--air-compiler") == 0 && (i + 1) < argc)
+        {
+            std::istringstream commandStream(argv[++i]);
+            options.airWorkerCommand.assign(std::istream_iterator<std::string>(commandStream), std::istream_iterator<std::string>());
+        }
+        else if (strcmp(argv[i], "--air-workers") == 0 && (i + 1) < argc)
+        {
+            size_t workerCount = 0;
+            if (!parseCount(argv[++i], workerCount))
+            {
+                fmt::println("Invalid worker count {}", argv[i]);
+                return 1;
+            }
+
+            options.airWorkerCount = uint32_t(workerCount);
+        }
+#endif
+        else if (strcmp(argv[i], "--shard") == 0 && (i + 1) < argc)
+        {
+            if (sscanf(argv[++i], "%u/%u", &options.shardIndex, &options.shardCount) != 2 || options.shardIndex >= options.shardCount)
+            {
+                fmt::println("Invalid shard {}, expected index/count", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--merge") == 0)
+        {
+            options.merge = true;
+        }
+        else if (strcmp(argv[i], "--cost-report") == 0 && (i + 1) < argc)
+        {
+            options.costReportPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream-cache") == 0 && (i + 1) < argc)
+        {
+            if (!parseCount(argv[++i], options.streamMemoryBudget))
+            {
+                fmt::println("Invalid memory budget {}", argv[i]);
+                return 1;
+            }
+
+            options.streamMemoryBudget *= 1024 * 1024;
+        }
+        else if (strcmp(argv[i], "--isolate") == 0 && (i + 1) < argc)
+        {
+            size_t workerCount = 0;
+            if (!parseCount(argv[++i], workerCount))
+            {
+                fmt::println("Invalid worker count {}", argv[i]);
+                return 1;
+            }
+
+            options.isolatedWorkerCount = uint32_t(workerCount);
+        }
+        else if (strcmp(argv[i], "--isolate-timeout") == 0 && (i + 1) < argc)
+        {
+            if (!parseCount(argv[++i], options.isolatedWorkerTimeout))
+            {
+                fmt::println("Invalid timeout {}", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--memory-budget") == 0 && (i + 1) < argc)
+        {
+            size_t memoryBudget = 0;
+            if (!parseCount(argv[++i], memoryBudget))
+            {
+                fmt::println("Invalid memory budget {}", argv[i]);
+                return 1;
+            }
+
+            options.memoryGovernor = std::make_unique<MemoryGovernor>(memoryBudget * 1024 * 1024);
+        }
+        else if (strcmp(argv[i], "--recompile-worker") == 0)
+        {
+            options.recompileWorker = true;
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && (i + 1) < argc)
+        {
+            options.checkpointPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--patch") == 0 && (i + 1) < argc)
+        {
+            options.patchCachePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--watch") == 0)
+        {
+            options.watch = true;
+        }
+        else if (strcmp(argv[i], "--hoist-constants") == 0)
+        {
+            options.hoistConstantLoads = true;
+        }
+        else if (strcmp(argv[i], "--reuse-fetches") == 0)
+        {
+            options.reuseFetches = true;
+        }
+        else if (strcmp(argv[i], "--spec-shared-flags") == 0)
+        {
+            options.specializeSharedFlags = true;
+        }
+        else if (strcmp(argv[i], "--specialize-source") == 0)
+        {
+            options.specializeSource = true;
+        }
+        else if (strcmp(argv[i], "--minify-source") == 0)
+        {
+            options.specializeSource = true;
+            options.minifySource = true;
+        }
+        else if (strcmp(argv[i], "--dxc-profile") == 0 && (i + 1) < argc)
+        {
+            const char* profile = argv[++i];
+            auto findResult = std::find_if(std::begin(DXC_PROFILE_NAMES), std::end(DXC_PROFILE_NAMES), [&](const char* name) { return strcmp(name, profile) == 0; });
+            if (findResult == std::end(DXC_PROFILE_NAMES))
+            {
+                fmt::println("Unknown DXC profile {}", profile);
+                return 1;
+            }
+
+            options.dxcProfile = DxcProfile(findResult - std::begin(DXC_PROFILE_NAMES));
+        }
+        else if (strcmp(argv[i], "--profile-report") == 0 && (i + 1) < argc)
+        {
+            if (!parseCount(argv[++i], options.profileReportSampleCount))
+            {
+                fmt::println("Invalid sample count {}", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--validate") == 0 && (i + 1) < argc)
+        {
+            if (!parseCount(argv[++i], options.validateInputCount))
+            {
+                fmt::println("Invalid input count {}", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--reduced-precision") == 0 && (i + 1) < argc)
+        {
+            const char* precision = argv[++i];
+            options.reducedPrecision = true;
+
+            if (strcmp(precision, "half") == 0)
+            {
+                options.enable16BitTypes = true;
+            }
+            else if (strcmp(precision, "min16float") != 0)
+            {
+                fmt::println("Unknown reduced precision type {}", precision);
+                return 1;
+            }
+        }
+        else
+        {
+            arguments.push_back(argv[i]);
+        }
+    }
+
+    if (options.merge)
+    {
+        if (arguments.size() < 2)
+        {
+            printf("Usage: XenosRecomp --merge [output path] [shard file paths...]\n");
+            return 0;
+        }
+
+        std::map<XXH64_hash_t, RecompiledShader> shaders;
+        std::vector<bool> mergedShards;
+        ShaderCacheShard firstShard;
+
+        for (size_t i = 1; i < arguments.size(); i++)
+        {
+            ShaderCacheShard shard;
+            if (!readShaderCacheShard(arguments[i], shard))
+            {
+                fmt::println("Failed to read shard {}", arguments[i]);
+                return 1;
+            }
+
+            if (i == 1)
+            {
+                firstShard.count = shard.count;
+                firstShard.profile = shard.profile;
+                firstShard.hasVariants = shard.hasVariants;
+                firstShard.optionsFingerprint = shard.optionsFingerprint;
+                firstShard.variantListsFingerprint = shard.variantListsFingerprint;
+                mergedShards.resize(shard.count);
+            }
+            else if (shard.count != firstShard.count || shard.profile != firstShard.profile || shard.hasVariants != firstShard.hasVariants ||
+                shard.variantListsFingerprint != firstShard.variantListsFingerprint)
+            {
+                fmt::println("Shard {} was built with different options", arguments[i]);
+                return 1;
+            }
+
+            if (shard.index >= shard.count || mergedShards[shard.index])
+            {
+                fmt::println("Shard {}/{} was provided more than once", shard.index, shard.count);
+                return 1;
+            }
+
+            mergedShards[shard.index] = true;
+            shaders.merge(shard.shaders);
+        }
+
+        for (size_t i = 0; i < mergedShards.size(); i++)
+        {
+            if (!mergedShards[i])
+            {
+                fmt::println("Shard {}/{} is missing", i, mergedShards.size());
+                return 1;
+            }
+        }
+
+        fmt::println("Creating shader cache...");
+
+        std::string cache = createShaderCache(shaders, firstShard.profile, firstShard.hasVariants, firstShard.optionsFingerprint, ZSTD_maxCLevel());
+        writeAllBytes(arguments[0], cache.data(), cache.size());
+
+        if (options.costReportPath != nullptr && !writeCostReport(options.costReportPath, shaders))
+        {
+            fmt::println("Failed to write cost report to {}", options.costReportPath);
+            return 1;
+        }
+
+        return 0;
+    }
+
 #ifndef XENOS_RECOMP_INPUT
-    if (argc < 4)
+    if (arguments.size() < 3)
     {
-        printf("Usage: XenosRecomp [input path] [output path] [shader common header file path]");
+        printf("Usage: XenosRecomp [input path] [output path] [shader common header file path] [options]\n");
+        printf("Options:\n");
+        printf("  --spec-variants [all|variant list file path]  Precompile fully specialized shaders for spec constant combinations.\n");
+        printf("  --pack-interpolators                          Precompile pixel shader variants with read interpolator components packed together.\n");
+        printf("  --pairs [pair list file path]                 Precompile vertex shaders linked with the pixel shaders they are used with.\n");
+        printf("  --booleans [variant list file path]           Precompile shaders with branches resolved for g_Booleans values.\n");
+        printf("  --reduced-precision [min16float|half]         Store pixel shader registers only carrying colors with reduced precision.\n");
+        printf("  --hoist-constants                             Load each constant register and descriptor index once at the start of the shader.\n");
+        printf("  --reuse-fetches                               Reuse the results of identical texture and vertex fetches.\n");
+        printf("  --spec-shared-flags                           Read swapped vertex element masks and the clip plane flag through spec constants.\n");
+        printf("  --specialize-source                           Compile each target from a source with the branches of other targets removed.\n");
+        printf("  --minify-source                               Specialize the source and strip indentation, comments and empty lines.\n");
+        printf("  --dxc-profile [fast|default|spirv-legalize]   Select the DXC optimization profile.\n");
+        printf("  --shard [index/count]                         Recompile a part of the shaders and write them to a shard file at the output path.\n");
+        printf("  --merge [output path] [shard file paths...]   Merge shard files into a shader cache.\n");
+        printf("  --stream-cache [memory budget in MB]          Compress shaders into the cache as they finish instead of holding the whole cache in memory.\n");
+        printf("  --isolate [worker count]                      Recompile shaders in worker processes, quarantining shaders that crash them.\n");
+        printf("  --isolate-timeout [seconds]                   Quarantine shaders keeping a worker busy for longer, 600 by default.\n");
+        printf("  --memory-budget [MB]                          Limit concurrent DXC compiles to keep the process within a memory budget.\n");
+        printf("  --checkpoint [file path]                      Save recompiled shaders to a file, and resume from it when restarted.\n");
+        printf("  --patch [shader cache path]                   Reuse the shaders of an existing cache, only recompiling new shaders.\n");
+        printf("  --watch                                       Keep running and update the shader cache whenever the input directory changes.\n");
+        printf("  --cost-report [file path]                     Write instruction counts of every compiled shader as CSV, or JSON for .json paths.\n");
+        printf("  --profile-report [sample count]               Compare compile times and output sizes of each DXC profile on a sample of shaders.\n");
+        printf("  --validate [input count]                      Run every shader on random inputs in a CPU interpreter to check the recompiler's assumptions.\n");
+#ifdef XENOS_RECOMP_AIR
+        printf("  --air-compiler [command]                      Compile AIR shaders with a custom worker command.\n");
+        printf("  --air-workers [count]                         Set the number of AIR compiler workers.\n");
+#endif
         return 0;
     }
 #endif
@@ -85,7 +1793,7 @@ int main(int argc, char** argv)
 #ifdef XENOS_RECOMP_INPUT 
         XENOS_RECOMP_INPUT
 #else
-        argv[1]
+        arguments[0]
 #endif
     ;
 
@@ -93,7 +1801,7 @@ int main(int argc, char** argv)
 #ifdef XENOS_RECOMP_OUTPUT 
         XENOS_RECOMP_OUTPUT
 #else
-        argv[2]
+        arguments[1]
 #endif
         ;
     
@@ -101,7 +1809,7 @@ int main(int argc, char** argv)
 #ifdef XENOS_RECOMP_INCLUDE_INPUT
         XENOS_RECOMP_INCLUDE_INPUT
 #else
-        argv[3]
+        arguments[2]
 #endif
         ;
 
@@ -109,11 +1817,52 @@ int main(int argc, char** argv)
     auto includeData = readAllBytes(includeInput, includeSize);
     std::string_view include(reinterpret_cast<const char*>(includeData.get()), includeSize);
 
+    if (options.recompileWorker || options.isolatedWorkerCount != 0)
+    {
+#ifdef _WIN32
+        fmt::println("--isolate is not supported on Windows");
+        return 1;
+#else
+        if (options.recompileWorker)
+            return runRecompileWorker(include, options);
+
+        options.recompileWorkerCommand.assign(argv, argv + argc);
+        options.recompileWorkerCommand.push_back("--recompile-worker");
+#endif
+    }
+
+    // Written to caches and compared by --patch. Variant lists are left out, as patching recompiles shaders missing variants.
+    uint64_t optionsFingerprint = computeOptionsFingerprint(argc, argv, arguments, include, true, true);
+
+    // Streamed shaders release their blobs once written, leaving nothing to count.
+    if (options.costReportPath != nullptr && options.streamMemoryBudget != 0 && options.shardCount == 0)
+    {
+        fmt::println("--cost-report cannot be combined with --stream-cache");
+        return 1;
+    }
+
+    // Shards and streamed caches only contain the shaders recompiled by the build itself.
+    if (options.patchCachePath != nullptr && (options.shardCount != 0 || options.streamMemoryBudget != 0))
+    {
+        fmt::println("--patch cannot be combined with --shard or --stream-cache");
+        return 1;
+    }
+
+    if (options.watch)
+    {
+        if (!std::filesystem::is_directory(input) || options.shardCount != 0 || options.profileReportSampleCount != 0 || options.validateInputCount != 0 || options.costReportPath != nullptr || options.patchCachePath != nullptr)
+        {
+            fmt::println("--watch requires an input directory, and cannot be combined with --shard, --profile-report, --validate, --cost-report or --patch");
+            return 1;
+        }
+
+        return watchShaders(input, output, include, options, optionsFingerprint, argv[0]);
+    }
+
     if (std::filesystem::is_directory(input))
     {
         std::vector<std::unique_ptr<uint8_t[]>> files;
         std::map<XXH64_hash_t, RecompiledShader> shaders;
-        std::map<XXH64_hash_t, std::string> shaderFilenames;
 
         for (auto& file : std::filesystem::recursive_directory_iterator(input))
         {
@@ -126,30 +1875,14 @@ int main(int argc, char** argv)
             auto fileData = readAllBytes(file.path().string().c_str(), fileSize);
             bool foundAny = false;
 
-            for (size_t i = 0; fileSize > sizeof(ShaderContainer) && i < fileSize - sizeof(ShaderContainer) - 1;)
+            for (auto& [hash, offset] : findShaderContainers(fileData.get(), fileSize))
             {
-                auto shaderContainer = reinterpret_cast<const ShaderContainer*>(fileData.get() + i);
-                size_t dataSize = shaderContainer->virtualSize + shaderContainer->physicalSize;
-
-                if ((shaderContainer->flags & 0xFFFFFF00) == 0x102A1100 &&
-                    dataSize <= (fileSize - i) &&
-                    shaderContainer->field1C == 0 &&
-                    shaderContainer->field20 == 0)
-                {
-                    XXH64_hash_t hash = XXH3_64bits(shaderContainer, dataSize);
-                    auto shader = shaders.try_emplace(hash);
-                    if (shader.second)
-                    {
-                        shader.first->second.data = fileData.get() + i;
-                        foundAny = true;
-                        shaderFilenames[hash] = file.path().string();
-                    }
-
-                    i += dataSize;
-                }
-                else
+                auto shader = shaders.try_emplace(hash);
+                if (shader.second)
                 {
-                    i += sizeof(uint32_t);
+                    shader.first->second.data = fileData.get() + offset;
+                    shader.first->second.filename = getShaderFilename(file.path());
+                    foundAny = true;
                 }
             }
 
@@ -157,137 +1890,184 @@ int main(int argc, char** argv)
                 files.emplace_back(std::move(fileData));
         }
 
-        std::mutex shaderQueueMutex;
-        std::deque<XXH64_hash_t> shaderQueue;
-        for (const auto& [hash, _] : shaders)
+        resolveShaderPairs(shaders, options);
+
+        if (options.profileReportSampleCount != 0)
         {
-            shaderQueue.emplace_back(hash);
+            reportProfiles(shaders, include, options);
+            return 0;
         }
 
-        const uint32_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
-        fmt::println("Recompiling shaders with {} threads", numThreads);
+        if (options.validateInputCount != 0)
+            return validateShaders(shaders, include, options) != 0 ? 1 : 0;
 
-        std::atomic<uint32_t> progress = 0;
-        std::vector<std::thread> threads;
-        threads.reserve(numThreads);
-        for (uint32_t i = 0; i < numThreads; i++)
+        // Pairs are resolved before this, as linked vertex shaders need pixel shaders from other shards.
+        if (options.shardCount != 0)
         {
-            threads.emplace_back([&]
+            for (auto it = shaders.begin(); it != shaders.end();)
             {
-                while (true)
-                {
-                    XXH64_hash_t shaderHash;
-                    {
-                        std::lock_guard lock(shaderQueueMutex);
-                        if (shaderQueue.empty()) {
-                            return;
-                        }
-                        shaderHash = shaderQueue.front();
-                        shaderQueue.pop_front();
-                    }
-                    recompileShader(shaders[shaderHash], include, progress, shaders.size());
-                }
-            });
+                if ((it->first % options.shardCount) != options.shardIndex)
+                    it = shaders.erase(it);
+                else
+                    ++it;
+            }
         }
-        for (auto& thread : threads)
+
+        std::vector<XXH64_hash_t> hashes;
+        for (const auto& [hash, _] : shaders)
         {
-            thread.join();
+            hashes.push_back(hash);
         }
 
-        fmt::println("Creating shader cache...");
-
-        StringBuffer f;
-        f.println("#include \"shader_cache.h\"");
-        f.println("ShaderCacheEntry g_shaderCacheEntries[] = {{");
-
-        std::vector<uint8_t> dxil;
-        std::vector<uint8_t> spirv;
-        std::vector<uint8_t> air;
-
-        for (auto& [hash, shader] : shaders)
+        if (options.patchCachePath != nullptr)
         {
-            const std::string& fullFilename = shaderFilenames[hash];
-            std::string filename = fullFilename;
-            size_t shaderPos = filename.find("shader");
-            if (shaderPos != std::string::npos) {
-                filename = filename.substr(shaderPos);
-                // Prevent bad escape sequences in Windows shader path.
-                std::replace(filename.begin(), filename.end(), '\\', '/');
+            ShaderCacheShard patchedCache;
+            if (!readShaderCache(options.patchCachePath, patchedCache))
+            {
+                fmt::println("Failed to read shader cache {}", options.patchCachePath);
+                return 1;
             }
-            f.println("\t{{ 0x{:X}, {}, {}, {}, {}, {}, {}, {}, \"{}\" }},",
-                hash, dxil.size(), (shader.dxil != nullptr) ? shader.dxil->GetBufferSize() : 0,
-                spirv.size(), shader.spirv.size(), air.size(), shader.air.size(), shader.specConstantsMask, filename);
 
-            if (shader.dxil != nullptr)
+            if (patchedCache.profile != DXC_PROFILE_NAMES[uint32_t(options.dxcProfile)] || patchedCache.hasVariants != options.hasVariants() ||
+                patchedCache.optionsFingerprint != optionsFingerprint)
             {
-                dxil.insert(dxil.end(), reinterpret_cast<uint8_t *>(shader.dxil->GetBufferPointer()),
-                    reinterpret_cast<uint8_t *>(shader.dxil->GetBufferPointer()) + shader.dxil->GetBufferSize());
+                fmt::println("Shader cache {} was created with different options", options.patchCachePath);
+                return 1;
             }
 
-#ifdef XENOS_RECOMP_AIR
-            air.insert(air.end(), shader.air.begin(), shader.air.end());
-#endif
+            // Shaders missing variants requested by the variant lists, such as new entries or pairs with pixel shaders new
+            // to this build, are recompiled instead of reused.
+            size_t incompleteCount = 0;
+            for (auto it = patchedCache.shaders.begin(); it != patchedCache.shaders.end();)
+            {
+                auto findResult = shaders.find(it->first);
+                if (findResult != shaders.end() && isMissingVariants(it->first, it->second, findResult->second.data, include, options))
+                {
+                    it = patchedCache.shaders.erase(it);
+                    ++incompleteCount;
+                }
+                else
+                {
+                    ++it;
+                }
+            }
 
-            spirv.insert(spirv.end(), shader.spirv.begin(), shader.spirv.end());
-        }
+            // Shaders missing from the input directory are kept, as the input may only contain the new shaders.
+            size_t reusedCount = 0;
+            for (auto& [hash, cachedShader] : patchedCache.shaders)
+            {
+                auto findResult = shaders.find(hash);
+                if (findResult != shaders.end())
+                {
+                    cachedShader.data = findResult->second.data;
+                    cachedShader.filename = std::move(findResult->second.filename);
+                    ++reusedCount;
+                }
 
-        f.println("}};");
+                shaders[hash] = std::move(cachedShader);
+            }
 
-        fmt::println("Compressing DXIL cache...");
+            hashes.erase(std::remove_if(hashes.begin(), hashes.end(), [&](XXH64_hash_t hash) { return patchedCache.shaders.count(hash) != 0; }), hashes.end());
 
-        int level = ZSTD_maxCLevel();
+            fmt::println("Reusing {} shaders from shader cache {}, {} shaders are new or missing variants, {} shaders are kept",
+                reusedCount, options.patchCachePath, hashes.size(), patchedCache.shaders.size() - reusedCount);
 
-#ifdef XENOS_RECOMP_DXIL
-        std::vector<uint8_t> dxilCompressed(ZSTD_compressBound(dxil.size()));
-        dxilCompressed.resize(ZSTD_compress(dxilCompressed.data(), dxilCompressed.size(), dxil.data(), dxil.size(), level));
+            if (incompleteCount != 0)
+                fmt::println("Recompiling {} shaders missing requested variants", incompleteCount);
+        }
 
-        f.print("const uint8_t g_compressedDxilCache[] = {{");
+        ShaderCheckpoint checkpoint;
+        ShaderCheckpoint* checkpointToUse = nullptr;
 
-        for (auto data : dxilCompressed)
-            f.print("{},", data);
+        if (options.checkpointPath != nullptr)
+        {
+            if (!checkpoint.open(options.checkpointPath, computeOptionsFingerprint(argc, argv, arguments, include, false, false)))
+            {
+                fmt::println("Failed to open checkpoint {}", options.checkpointPath);
+                return 1;
+            }
 
-        f.println("}};");
-        f.println("const size_t g_dxilCacheCompressedSize = {};", dxilCompressed.size());
-        f.println("const size_t g_dxilCacheDecompressedSize = {};", dxil.size());
-#endif
+            fmt::println("Restoring {} shaders from checkpoint {}", checkpoint.getRestorableCount(), options.checkpointPath);
+            checkpointToUse = &checkpoint;
+        }
 
-#ifdef XENOS_RECOMP_AIR
-        fmt::println("Compressing AIR cache...");
+        // Shards are written as a whole, so they are never streamed.
+        bool streamCache = options.streamMemoryBudget != 0 && options.shardCount == 0;
+        size_t failureCount = 0;
 
-        std::vector<uint8_t> airCompressed(ZSTD_compressBound(air.size()));
-        airCompressed.resize(ZSTD_compress(airCompressed.data(), airCompressed.size(), air.data(), air.size(), level));
+        if (streamCache)
+        {
+            ShaderCacheStream stream;
+            if (!stream.open(output, DXC_PROFILE_NAMES[uint32_t(options.dxcProfile)], options.hasVariants(), optionsFingerprint, ZSTD_maxCLevel()))
+            {
+                fmt::println("Failed to create shader cache at {}", output);
+                return 1;
+            }
 
-        f.print("const uint8_t g_compressedAirCache[] = {{");
+            failureCount = recompileShaders(shaders, hashes, include, options, argv[0], &stream, checkpointToUse);
 
-        for (auto data : airCompressed)
-            f.print("{},", data);
+            fmt::println("Creating shader cache...");
 
-        f.println("}};");
-        f.println("const size_t g_airCacheCompressedSize = {};", airCompressed.size());
-        f.println("const size_t g_airCacheDecompressedSize = {};", air.size());
-#endif
+            if (!stream.close())
+            {
+                fmt::println("Failed to write shader cache to {}", output);
+                return 1;
+            }
+        }
+        else
+        {
+            failureCount = recompileShaders(shaders, hashes, include, options, argv[0], nullptr, checkpointToUse);
+        }
 
-        fmt::println("Compressing SPIRV cache...");
+        uint32_t clampsRemoved = 0;
+        for (auto& [hash, shader] : shaders)
+            clampsRemoved += shader.clampsRemoved;
+
+        fmt::println("Removed {} clamps in total", clampsRemoved);
 
-        std::vector<uint8_t> spirvCompressed(ZSTD_compressBound(spirv.size()));
-        spirvCompressed.resize(ZSTD_compress(spirvCompressed.data(), spirvCompressed.size(), spirv.data(), spirv.size(), level));
+        if (options.costReportPath != nullptr && !writeCostReport(options.costReportPath, shaders))
+        {
+            fmt::println("Failed to write cost report to {}", options.costReportPath);
+            return 1;
+        }
 
-        f.print("const uint8_t g_compressedSpirvCache[] = {{");
+        if (options.shardCount != 0)
+        {
+            ShaderCacheShard shard;
+            shard.index = options.shardIndex;
+            shard.count = options.shardCount;
+            shard.profile = DXC_PROFILE_NAMES[uint32_t(options.dxcProfile)];
+            shard.hasVariants = options.hasVariants();
+            shard.optionsFingerprint = optionsFingerprint;
+            shard.variantListsFingerprint = computeOptionsFingerprint(argc, argv, arguments, include, true, false);
+            shard.shaders = std::move(shaders);
 
-        for (auto data : spirvCompressed)
-            f.print("{},", data);
+            fmt::println("Writing shard {}/{}...", shard.index, shard.count);
 
-        f.println("}};");
+            if (!writeShaderCacheShard(output, shard))
+            {
+                fmt::println("Failed to write shard to {}", output);
+                return 1;
+            }
+        }
+        else if (!streamCache)
+        {
+            fmt::println("Creating shader cache...");
 
-        f.println("const size_t g_spirvCacheCompressedSize = {};", spirvCompressed.size());
-        f.println("const size_t g_spirvCacheDecompressedSize = {};", spirv.size());
-        f.println("const size_t g_shaderCacheEntryCount = {};", shaders.size());
+            std::string cache = createShaderCache(shaders, DXC_PROFILE_NAMES[uint32_t(options.dxcProfile)], options.hasVariants(), optionsFingerprint, ZSTD_maxCLevel());
+            writeAllBytes(output, cache.data(), cache.size());
+        }
 
-        writeAllBytes(output, f.out.data(), f.out.size());
+        if (failureCount != 0)
+        {
+            fmt::println("{} shaders failed to compile", failureCount);
+            return 1;
+        }
     }
     else
     {
         ShaderRecompiler recompiler;
+        configureRecompiler(recompiler, options);
         size_t fileSize;
         recompiler.recompile(readAllBytes(input, fileSize).get(), include);
         writeAllBytes(output, recompiler.out.data(), recompiler.out.size());
@@ -0,0 +1,76 @@
+#include "memory_governor.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+// Resident memory is polled at this interval while waiting, as it can drop without any job finishing.
+static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(20);
+
+size_t getResidentMemorySize()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+
+    return 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+        return info.resident_size;
+
+    return 0;
+#else
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file == nullptr)
+        return 0;
+
+    size_t pageCount = 0;
+    size_t residentPageCount = 0;
+    if (fscanf(file, "%zu %zu", &pageCount, &residentPageCount) != 2)
+        residentPageCount = 0;
+
+    fclose(file);
+    return residentPageCount * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void MemoryGovernor::acquire(size_t estimate)
+{
+    std::unique_lock lock(mutex);
+    uint64_t ticket = nextTicket++;
+    bool throttled = false;
+
+    while (ticket != servedTicket || (runningCount != 0 && getResidentMemorySize() + reserved + estimate > budget))
+    {
+        throttled |= ticket == servedTicket;
+        condition.wait_for(lock, POLL_INTERVAL);
+    }
+
+    if (throttled)
+        ++throttledCount;
+
+    ++servedTicket;
+    reserved += estimate;
+    ++runningCount;
+    peakRunningCount = std::max(peakRunningCount, runningCount);
+
+    condition.notify_all();
+}
+
+void MemoryGovernor::release(size_t estimate)
+{
+    std::lock_guard lock(mutex);
+    reserved -= estimate;
+    --runningCount;
+
+    condition.notify_all();
+}
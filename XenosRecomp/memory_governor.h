@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+// Resident memory of the current process in bytes, or 0 if it can't be queried.
+size_t getResidentMemorySize();
+
+// Limits how many jobs run at once against a memory budget. A job starts only if the resident memory, plus the
+// estimates of the jobs already running, plus its own estimate fits in the budget. The estimates of running jobs are
+// counted in full even though part of them is already resident, erring on the side of running fewer jobs.
+// Jobs start in the order they asked to, so a large job is not starved by smaller ones, and a job always starts when
+// nothing else is running.
+class MemoryGovernor
+{
+public:
+    explicit MemoryGovernor(size_t budget)
+        : budget(budget)
+    {
+    }
+
+    void acquire(size_t estimate);
+    void release(size_t estimate);
+
+    uint32_t getPeakRunningCount() const
+    {
+        return peakRunningCount;
+    }
+
+    uint32_t getThrottledCount() const
+    {
+        return throttledCount;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t budget = 0;
+    size_t reserved = 0;
+    uint32_t runningCount = 0;
+    uint32_t peakRunningCount = 0;
+    uint32_t throttledCount = 0;
+    uint64_t nextTicket = 0;
+    uint64_t servedTicket = 0;
+};
@@ -9,6 +9,7 @@
 
 #include <bit>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <execution>
 #include <filesystem>
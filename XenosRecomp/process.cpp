@@ -0,0 +1,317 @@
+#include "process.h"
+
+#include <climits>
+#include <csignal>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+void Process::closeDescriptor(int& fd)
+{
+    if (fd != -1)
+    {
+        close(fd);
+        fd = -1;
+    }
+}
+
+int Process::wait()
+{
+    closeDescriptor(input);
+    closeDescriptor(output);
+    closeDescriptor(error);
+
+    int status = -1;
+    if (pid != -1 && waitpid(pid, &status, 0) == -1)
+        status = -1;
+
+    pid = -1;
+    return status;
+}
+
+int Process::kill()
+{
+    if (pid != -1)
+        ::kill(pid, SIGKILL);
+
+    return wait();
+}
+
+Process::~Process()
+{
+    wait();
+}
+
+std::string describeExitStatus(int status)
+{
+    if (status == -1)
+        return "unknown status";
+
+    if (WIFSIGNALED(status))
+        return fmt::format("signal {}", WTERMSIG(status));
+
+    return fmt::format("exit status {}", WEXITSTATUS(status));
+}
+
+bool spawnProcess(const std::vector<std::string>& command, bool captureErrors, Process& process)
+{
+    // Pipes are created and marked close-on-exec under a lock, so processes spawned from other
+    // threads don't inherit them and keep them open.
+    static std::mutex spawnMutex;
+    std::lock_guard lock(spawnMutex);
+
+    int pipes[3][2];
+    uint32_t pipeCount = captureErrors ? 3 : 2;
+
+    for (uint32_t i = 0; i < pipeCount; i++)
+    {
+        if (pipe(pipes[i]) != 0)
+        {
+            for (uint32_t j = 0; j < i; j++)
+            {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+
+            return false;
+        }
+
+        fcntl(pipes[i][0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipes[i][1], F_SETFD, FD_CLOEXEC);
+    }
+
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_adddup2(&fileActions, pipes[0][0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&fileActions, pipes[1][1], STDOUT_FILENO);
+    if (captureErrors)
+        posix_spawn_file_actions_adddup2(&fileActions, pipes[2][1], STDERR_FILENO);
+
+    std::vector<char*> argv;
+    for (auto& argument : command)
+        argv.push_back(const_cast<char*>(argument.c_str()));
+
+    argv.push_back(nullptr);
+
+    bool spawned = posix_spawnp(&process.pid, argv[0], &fileActions, nullptr, argv.data(), environ) == 0;
+    posix_spawn_file_actions_destroy(&fileActions);
+
+    close(pipes[0][0]);
+    close(pipes[1][1]);
+    if (captureErrors)
+        close(pipes[2][1]);
+
+    if (!spawned)
+    {
+        process.pid = -1;
+        close(pipes[0][1]);
+        close(pipes[1][0]);
+        if (captureErrors)
+            close(pipes[2][0]);
+
+        return false;
+    }
+
+    process.input = pipes[0][1];
+    process.output = pipes[1][0];
+    process.error = captureErrors ? pipes[2][0] : -1;
+
+    return true;
+}
+
+bool writeAll(int fd, const void* data, size_t size)
+{
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        if (written <= 0)
+            return false;
+
+        bytes += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+bool readExact(int fd, void* data, size_t size)
+{
+    auto bytes = reinterpret_cast<uint8_t*>(data);
+
+    while (size > 0)
+    {
+        ssize_t bytesRead = read(fd, bytes, size);
+        if (bytesRead < 0 && errno == EINTR)
+            continue;
+
+        if (bytesRead <= 0)
+            return false;
+
+        bytes += bytesRead;
+        size -= bytesRead;
+    }
+
+    return true;
+}
+
+bool readLine(int fd, std::string& line)
+{
+    line.clear();
+
+    char c;
+    while (readExact(fd, &c, 1))
+    {
+        if (c == '\n')
+            return true;
+
+        line += c;
+    }
+
+    return false;
+}
+
+// Waits for data to read, returning false once the deadline passes.
+static bool waitForInput(int fd, std::chrono::steady_clock::time_point deadline)
+{
+    while (true)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+            return false;
+
+        pollfd fds = { fd, POLLIN, 0 };
+        int result = poll(&fds, 1, int(std::min<long long>(remaining, INT_MAX)));
+
+        if (result < 0 && errno == EINTR)
+            continue;
+
+        return result > 0;
+    }
+}
+
+bool readExact(int fd, void* data, size_t size, std::chrono::steady_clock::time_point deadline)
+{
+    auto bytes = reinterpret_cast<uint8_t*>(data);
+
+    while (size > 0)
+    {
+        if (!waitForInput(fd, deadline))
+            return false;
+
+        ssize_t bytesRead = read(fd, bytes, size);
+        if (bytesRead < 0 && errno == EINTR)
+            continue;
+
+        if (bytesRead <= 0)
+            return false;
+
+        bytes += bytesRead;
+        size -= bytesRead;
+    }
+
+    return true;
+}
+
+bool readLine(int fd, std::string& line, std::chrono::steady_clock::time_point deadline)
+{
+    line.clear();
+
+    char c;
+    while (readExact(fd, &c, 1, deadline))
+    {
+        if (c == '\n')
+            return true;
+
+        line += c;
+    }
+
+    return false;
+}
+
+int runProcess(const std::vector<std::string>& command, const std::string& input, std::vector<uint8_t>& output, std::string& error)
+{
+    Process process;
+    if (!spawnProcess(command, true, process))
+    {
+        error = fmt::format("Failed to start {}: {}", command[0], strerror(errno));
+        return -1;
+    }
+
+    size_t inputOffset = 0;
+    if (input.empty())
+        Process::closeDescriptor(process.input);
+    else
+        fcntl(process.input, F_SETFL, fcntl(process.input, F_GETFL) | O_NONBLOCK);
+
+    // Streams are serviced together, as the process may block on a full output pipe before reading all of its input.
+    // Writes are non-blocking, so they only fill the room left in the input pipe and return to reading.
+    while (process.input != -1 || process.output != -1 || process.error != -1)
+    {
+        pollfd fds[3];
+        int* descriptors[3];
+        nfds_t fdCount = 0;
+
+        for (int* fd : { &process.input, &process.output, &process.error })
+        {
+            if (*fd != -1)
+            {
+                fds[fdCount] = { *fd, short(fd == &process.input ? POLLOUT : POLLIN), 0 };
+                descriptors[fdCount] = fd;
+                ++fdCount;
+            }
+        }
+
+        if (poll(fds, fdCount, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        for (nfds_t i = 0; i < fdCount; i++)
+        {
+            if (fds[i].revents == 0)
+                continue;
+
+            if (descriptors[i] == &process.input)
+            {
+                ssize_t written = write(process.input, input.data() + inputOffset, input.size() - inputOffset);
+                if (written > 0)
+                    inputOffset += written;
+
+                if ((written < 0 && errno != EINTR && errno != EAGAIN) || inputOffset == input.size())
+                    Process::closeDescriptor(process.input);
+            }
+            else
+            {
+                char buffer[4096];
+                ssize_t bytesRead = read(*descriptors[i], buffer, sizeof(buffer));
+
+                if (bytesRead > 0)
+                {
+                    if (descriptors[i] == &process.output)
+                        output.insert(output.end(), buffer, buffer + bytesRead);
+                    else
+                        error.append(buffer, bytesRead);
+                }
+                else if (bytesRead == 0 || (errno != EINTR && errno != EAGAIN))
+                {
+                    Process::closeDescriptor(*descriptors[i]);
+                }
+            }
+        }
+    }
+
+    return process.wait();
+}
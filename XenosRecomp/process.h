@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+struct Process
+{
+    pid_t pid = -1;
+    int input = -1;
+    int output = -1;
+    int error = -1;
+
+    static void closeDescriptor(int& fd);
+
+    // Closes the pipes and waits for the process to exit, returning its wait status.
+    int wait();
+
+    // Kills the process if it's still running, for processes that stopped responding, then waits for it like wait.
+    int kill();
+
+    ~Process();
+};
+
+std::string describeExitStatus(int status);
+
+// Spawns the command with pipes connected to its stdin and stdout, and to its stderr if requested.
+bool spawnProcess(const std::vector<std::string>& command, bool captureErrors, Process& process);
+
+bool writeAll(int fd, const void* data, size_t size);
+bool readExact(int fd, void* data, size_t size);
+bool readLine(int fd, std::string& line);
+
+// Same as above, but failing once the deadline passes before all of the data was read.
+bool readExact(int fd, void* data, size_t size, std::chrono::steady_clock::time_point deadline);
+bool readLine(int fd, std::string& line, std::chrono::steady_clock::time_point deadline);
+
+// Runs the command to completion, feeding it the input and collecting its output and errors.
+int runProcess(const std::vector<std::string>& command, const std::string& input, std::vector<uint8_t>& output, std::string& error);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Minimal perfect hash of the shader hashes in g_shaderCacheEntries, generated with the cache. A shader hash selects a
+// bucket using the global seed, and the displacement of the bucket then either holds the slot directly, for buckets
+// with a single hash, or the seed that spreads the hashes of the bucket over free slots. Each slot holds the index of
+// an entry. Header only, so the runtime can include it without linking anything from the recompiler.
+
+// Set on displacements holding a slot instead of a seed.
+constexpr uint32_t SHADER_CACHE_INDEX_DIRECT_SLOT = 0x80000000;
+
+constexpr uint64_t mixShaderCacheIndexHash(uint64_t hash, uint64_t seed)
+{
+    // splitmix64 finalizer.
+    uint64_t value = hash + seed * 0x9E3779B97F4A7C15ull;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+constexpr size_t getShaderCacheIndexBucket(uint64_t hash, uint32_t seed, size_t displacementCount)
+{
+    return size_t(mixShaderCacheIndexHash(hash, seed) % displacementCount);
+}
+
+constexpr size_t getShaderCacheIndexSlot(uint64_t hash, uint32_t displacement, size_t slotCount)
+{
+    if ((displacement & SHADER_CACHE_INDEX_DIRECT_SLOT) != 0)
+        return displacement & ~SHADER_CACHE_INDEX_DIRECT_SLOT;
+
+    // Kept apart from the bucket hash, which uses the same mix with the global seed.
+    return size_t(mixShaderCacheIndexHash(~hash, displacement) % slotCount);
+}
+
+// Returns the index of the only entry that can have the given hash. Hashes missing from the cache map to an arbitrary
+// entry, so the caller must compare the hash of the returned entry.
+constexpr size_t findShaderCacheIndex(uint64_t hash, uint32_t seed, const uint32_t* displacements, size_t displacementCount,
+    const uint32_t* slots, size_t slotCount)
+{
+    size_t bucket = getShaderCacheIndexBucket(hash, seed, displacementCount);
+    return slots[getShaderCacheIndexSlot(hash, displacements[bucket], slotCount)];
+}
@@ -0,0 +1,988 @@
+#include "shader_cache_writer.h"
+#include "shader_cache_index.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <unordered_set>
+
+// Gives up on a global seed once a bucket can't be placed with this many seeds of its own.
+static constexpr uint32_t MAX_SHADER_CACHE_INDEX_DISPLACEMENT = 1 << 16;
+
+ShaderCacheIndex createShaderCacheIndex(const std::vector<XXH64_hash_t>& hashes)
+{
+    ShaderCacheIndex index;
+    size_t slotCount = std::max<size_t>(hashes.size(), 1);
+    size_t displacementCount = std::max<size_t>((hashes.size() + 1) / 2, 1);
+
+    std::vector<std::vector<uint32_t>> buckets(displacementCount);
+    std::vector<uint32_t> order(displacementCount);
+    std::vector<bool> occupied(slotCount);
+    std::vector<size_t> bucketSlots;
+
+    for (index.seed = 0; ; index.seed++)
+    {
+        for (auto& bucket : buckets)
+            bucket.clear();
+
+        for (size_t i = 0; i < hashes.size(); i++)
+            buckets[getShaderCacheIndexBucket(hashes[i], index.seed, displacementCount)].push_back(uint32_t(i));
+
+        // Larger buckets are placed first, while most slots are still free.
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) { return buckets[lhs].size() > buckets[rhs].size(); });
+
+        index.displacements.assign(displacementCount, 0);
+        index.slots.assign(slotCount, 0);
+        std::fill(occupied.begin(), occupied.end(), false);
+
+        bool placed = true;
+        size_t orderIndex = 0;
+
+        for (; orderIndex < order.size() && buckets[order[orderIndex]].size() > 1; orderIndex++)
+        {
+            auto& bucket = buckets[order[orderIndex]];
+
+            uint32_t displacement = 0;
+            for (; displacement < MAX_SHADER_CACHE_INDEX_DISPLACEMENT; displacement++)
+            {
+                bucketSlots.clear();
+
+                for (uint32_t entry : bucket)
+                {
+                    size_t slot = getShaderCacheIndexSlot(hashes[entry], displacement, slotCount);
+                    if (occupied[slot] || std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end())
+                        break;
+
+                    bucketSlots.push_back(slot);
+                }
+
+                if (bucketSlots.size() == bucket.size())
+                    break;
+            }
+
+            if (displacement == MAX_SHADER_CACHE_INDEX_DISPLACEMENT)
+            {
+                placed = false;
+                break;
+            }
+
+            index.displacements[order[orderIndex]] = displacement;
+
+            for (size_t i = 0; i < bucket.size(); i++)
+            {
+                occupied[bucketSlots[i]] = true;
+                index.slots[bucketSlots[i]] = bucket[i];
+            }
+        }
+
+        if (!placed)
+            continue;
+
+        // Buckets with a single hash take the remaining slots directly.
+        size_t freeSlot = 0;
+        for (; orderIndex < order.size() && buckets[order[orderIndex]].size() == 1; orderIndex++)
+        {
+            while (occupied[freeSlot])
+                ++freeSlot;
+
+            occupied[freeSlot] = true;
+            index.displacements[order[orderIndex]] = SHADER_CACHE_INDEX_DIRECT_SLOT | uint32_t(freeSlot);
+            index.slots[freeSlot] = buckets[order[orderIndex]][0];
+        }
+
+        return index;
+    }
+}
+
+static void printIndexArray(StringBuffer& f, const char* name, const char* countName, const std::vector<uint32_t>& values)
+{
+    f.print("const uint32_t {}[] = {{", name);
+    for (size_t i = 0; i < values.size(); i++)
+        f.print("{}0x{:X},", (i % 16) == 0 ? "\n\t" : " ", values[i]);
+
+    f.println("\n}};");
+    f.println("const size_t {} = {};", countName, values.size());
+}
+
+void ShaderCacheTables::add(XXH64_hash_t hash, const RecompiledShader& shader)
+{
+    entries.println("\t{{ 0x{:X}, {}, {}, {}, {}, {}, {}, {}, \"{}\" }},",
+        hash, dxilSize, shader.dxil.size(), spirvSize, shader.spirv.size(), airSize, shader.air.size(), shader.specConstantsMask, shader.filename);
+
+    dxilSize += shader.dxil.size();
+    spirvSize += shader.spirv.size();
+    airSize += shader.air.size();
+    ++entryCount;
+    hashes.push_back(hash);
+
+    inputSignatures.println("\t{{ {}, {} }},", inputElementCount, shader.inputElements.size());
+
+    for (auto& inputElement : shader.inputElements)
+    {
+        inputElements.println("\t{{ \"{}\", {}, {}, {}, {} }},", inputElement.semanticName,
+            uint32_t(inputElement.usage), inputElement.usageIndex, inputElement.location, inputElement.componentType);
+    }
+
+    inputElementCount += shader.inputElements.size();
+
+    for (auto& variant : shader.variants)
+    {
+        variantEntries.println("\t{{ 0x{:X}, {}, 0x{:X}, {}, {}, {}, {}, {}, {} }},",
+            hash, variant.kind, variant.key, dxilSize, variant.dxil.size(),
+            spirvSize, variant.spirv.size(), airSize, variant.air.size());
+
+        dxilSize += variant.dxil.size();
+        spirvSize += variant.spirv.size();
+        airSize += variant.air.size();
+        ++variantCount;
+    }
+}
+
+void ShaderCacheTables::print(StringBuffer& f, const std::string& profile, bool hasVariants, uint64_t optionsFingerprint) const
+{
+    f.println("#include \"shader_cache.h\"");
+    f.println("const char* g_shaderCacheProfile = \"{}\";", profile);
+
+    // Read back by --patch, which only reuses shaders recompiled with the same options.
+    f.println("const uint64_t g_shaderCacheOptionsFingerprint = 0x{:X};", optionsFingerprint);
+    f.println("ShaderCacheEntry g_shaderCacheEntries[] = {{");
+    f.out += entries.out;
+    f.println("}};");
+
+    // Finds entries in constant time with findShaderCacheIndex from shader_cache_index.h.
+    ShaderCacheIndex index = createShaderCacheIndex(hashes);
+    f.println("const uint32_t g_shaderCacheIndexSeed = {};", index.seed);
+    printIndexArray(f, "g_shaderCacheIndexDisplacements", "g_shaderCacheIndexDisplacementCount", index.displacements);
+    printIndexArray(f, "g_shaderCacheIndexSlots", "g_shaderCacheIndexSlotCount", index.slots);
+
+    // Parallel to g_shaderCacheEntries, referencing a range of g_shaderCacheInputElements. Empty for pixel shaders.
+    f.println("ShaderCacheInputSignature g_shaderCacheInputSignatures[] = {{");
+    f.out += inputSignatures.out;
+    f.println("}};");
+
+    f.println("ShaderCacheInputElement g_shaderCacheInputElements[] = {{");
+    f.out += inputElements.out;
+    if (inputElementCount == 0)
+        f.println("\t{{}}, // Placeholder to prevent an empty array.");
+    f.println("}};");
+    f.println("const size_t g_shaderCacheInputElementCount = {};", inputElementCount);
+
+    if (hasVariants)
+    {
+        // Sorted by hash, then by kind and key, allowing the runtime to binary search for a variant.
+        f.println("ShaderCacheVariantEntry g_shaderCacheVariantEntries[] = {{");
+        f.out += variantEntries.out;
+        if (variantCount == 0)
+            f.println("\t{{}}, // Placeholder to prevent an empty array.");
+        f.println("}};");
+        f.println("const size_t g_shaderCacheVariantEntryCount = {};", variantCount);
+    }
+}
+
+static void printBlobArrayBegin(StringBuffer& f, const char* name)
+{
+    f.print("const uint8_t g_compressed{}Cache[] = {{", name);
+}
+
+static void printBlobArrayData(StringBuffer& f, const uint8_t* data, size_t dataSize)
+{
+    for (size_t i = 0; i < dataSize; i++)
+        f.print("{},", data[i]);
+}
+
+static void printBlobArrayEnd(StringBuffer& f, const char* prefix, size_t compressedSize, size_t decompressedSize)
+{
+    f.println("}};");
+    f.println("const size_t g_{}CacheCompressedSize = {};", prefix, compressedSize);
+    f.println("const size_t g_{}CacheDecompressedSize = {};", prefix, decompressedSize);
+}
+
+static void printBlobArray(StringBuffer& f, const char* name, const char* prefix, const std::vector<uint8_t>& blobs, int compressionLevel)
+{
+    std::vector<uint8_t> compressed(ZSTD_compressBound(blobs.size()));
+    compressed.resize(ZSTD_compress(compressed.data(), compressed.size(), blobs.data(), blobs.size(), compressionLevel));
+
+    printBlobArrayBegin(f, name);
+    printBlobArrayData(f, compressed.data(), compressed.size());
+    printBlobArrayEnd(f, prefix, compressed.size(), blobs.size());
+}
+
+std::string createShaderCache(const std::map<XXH64_hash_t, RecompiledShader>& shaders, const std::string& profile, bool hasVariants, uint64_t optionsFingerprint, int compressionLevel)
+{
+    ShaderCacheTables tables;
+
+    std::vector<uint8_t> dxil;
+    std::vector<uint8_t> spirv;
+    std::vector<uint8_t> air;
+
+    auto appendBlobs = [&](const CompiledShader& shader)
+        {
+            dxil.insert(dxil.end(), shader.dxil.begin(), shader.dxil.end());
+
+#ifdef XENOS_RECOMP_AIR
+            air.insert(air.end(), shader.air.begin(), shader.air.end());
+#endif
+
+            spirv.insert(spirv.end(), shader.spirv.begin(), shader.spirv.end());
+        };
+
+    for (auto& [hash, shader] : shaders)
+    {
+        tables.add(hash, shader);
+
+        appendBlobs(shader);
+        for (auto& variant : shader.variants)
+            appendBlobs(variant);
+    }
+
+    StringBuffer f;
+    tables.print(f, profile, hasVariants, optionsFingerprint);
+
+    fmt::println("Compressing DXIL cache...");
+
+#ifdef XENOS_RECOMP_DXIL
+    printBlobArray(f, "Dxil", "dxil", dxil, compressionLevel);
+#endif
+
+#ifdef XENOS_RECOMP_AIR
+    fmt::println("Compressing AIR cache...");
+
+    printBlobArray(f, "Air", "air", air, compressionLevel);
+#endif
+
+    fmt::println("Compressing SPIRV cache...");
+
+    printBlobArray(f, "Spirv", "spirv", spirv, compressionLevel);
+
+    f.println("const size_t g_shaderCacheEntryCount = {};", tables.entryCount);
+
+    return std::move(f.out);
+}
+
+// Bounds the memory of each compressor at the cost of not finding matches further apart than this.
+static constexpr int STREAM_WINDOW_LOG = 23;
+
+ShaderCacheStream::~ShaderCacheStream()
+{
+    for (auto& blobStream : blobStreams)
+    {
+        ZSTD_freeCCtx(blobStream.context);
+
+        if (blobStream.file != nullptr)
+        {
+            fclose(blobStream.file);
+            std::filesystem::remove(blobStream.filePath);
+        }
+    }
+}
+
+bool ShaderCacheStream::writeBlob(BlobStream& blobStream, const void* data, size_t dataSize, bool end)
+{
+    ZSTD_inBuffer input = { data, dataSize, 0 };
+    uint8_t buffer[65536];
+
+    while (true)
+    {
+        ZSTD_outBuffer output = { buffer, sizeof(buffer), 0 };
+        size_t remaining = ZSTD_compressStream2(blobStream.context, &output, &input, end ? ZSTD_e_end : ZSTD_e_continue);
+
+        if (ZSTD_isError(remaining) || fwrite(buffer, 1, output.pos, blobStream.file) != output.pos)
+            return false;
+
+        blobStream.compressedSize += output.pos;
+
+        if (end ? remaining == 0 : input.pos == input.size)
+            break;
+    }
+
+    blobStream.decompressedSize += dataSize;
+    return true;
+}
+
+bool ShaderCacheStream::open(const char* filePath, const std::string& profile, bool hasVariants, uint64_t optionsFingerprint, int compressionLevel)
+{
+    this->filePath = filePath;
+    this->profile = profile;
+    this->hasVariants = hasVariants;
+    this->optionsFingerprint = optionsFingerprint;
+
+    for (size_t i = 0; i < std::size(blobStreams); i++)
+    {
+        auto& blobStream = blobStreams[i];
+        blobStream.filePath = fmt::format("{}.{}.zst", filePath, BLOB_PREFIXES[i]);
+        blobStream.file = fopen(blobStream.filePath.c_str(), "w+b");
+        blobStream.context = ZSTD_createCCtx();
+
+        if (blobStream.file == nullptr || blobStream.context == nullptr)
+            return false;
+
+        ZSTD_CCtx_setParameter(blobStream.context, ZSTD_c_compressionLevel, compressionLevel);
+        ZSTD_CCtx_setParameter(blobStream.context, ZSTD_c_windowLog, STREAM_WINDOW_LOG);
+        ZSTD_CCtx_setParameter(blobStream.context, ZSTD_c_hashLog, STREAM_WINDOW_LOG);
+        ZSTD_CCtx_setParameter(blobStream.context, ZSTD_c_chainLog, STREAM_WINDOW_LOG);
+    }
+
+    return true;
+}
+
+void ShaderCacheStream::add(XXH64_hash_t hash, RecompiledShader& shader)
+{
+    tables.add(hash, shader);
+
+    auto writeBlobs = [&](CompiledShader& compiledShader)
+        {
+            failed |= !writeBlob(blobStreams[BLOB_DXIL], compiledShader.dxil.data(), compiledShader.dxil.size(), false);
+            failed |= !writeBlob(blobStreams[BLOB_SPIRV], compiledShader.spirv.data(), compiledShader.spirv.size(), false);
+            failed |= !writeBlob(blobStreams[BLOB_AIR], compiledShader.air.data(), compiledShader.air.size(), false);
+
+            compiledShader = {};
+        };
+
+    writeBlobs(shader);
+    for (auto& variant : shader.variants)
+        writeBlobs(variant);
+
+    shader.variants = {};
+    shader.inputElements = {};
+}
+
+bool ShaderCacheStream::close()
+{
+    FILE* file = fopen(filePath.c_str(), "wb");
+    if (file == nullptr || failed)
+    {
+        if (file != nullptr)
+            fclose(file);
+
+        return false;
+    }
+
+    StringBuffer f;
+    tables.print(f, profile, hasVariants, optionsFingerprint);
+
+    // The compressed blobs are turned into text in chunks straight from their temporary files.
+    auto printBlobStream = [&](size_t index, const char* name)
+        {
+            auto& blobStream = blobStreams[index];
+            failed |= !writeBlob(blobStream, nullptr, 0, true);
+            fseek(blobStream.file, 0, SEEK_SET);
+
+            printBlobArrayBegin(f, name);
+
+            uint8_t buffer[65536];
+            size_t bufferSize;
+            while ((bufferSize = fread(buffer, 1, sizeof(buffer), blobStream.file)) != 0)
+            {
+                printBlobArrayData(f, buffer, bufferSize);
+                failed |= fwrite(f.out.data(), 1, f.out.size(), file) != f.out.size();
+                f.out.clear();
+            }
+
+            printBlobArrayEnd(f, BLOB_PREFIXES[index], blobStream.compressedSize, blobStream.decompressedSize);
+        };
+
+#ifdef XENOS_RECOMP_DXIL
+    printBlobStream(BLOB_DXIL, "Dxil");
+#endif
+
+#ifdef XENOS_RECOMP_AIR
+    printBlobStream(BLOB_AIR, "Air");
+#endif
+
+    printBlobStream(BLOB_SPIRV, "Spirv");
+
+    f.println("const size_t g_shaderCacheEntryCount = {};", tables.entryCount);
+    failed |= fwrite(f.out.data(), 1, f.out.size(), file) != f.out.size();
+    failed |= fclose(file) != 0;
+
+    return !failed;
+}
+
+// "XRSC", followed by the format version. Shards are only meant to be merged by the same build that created them.
+static constexpr uint32_t SHARD_MAGIC = 0x43535258;
+static constexpr uint32_t SHARD_VERSION = 4;
+
+// "XRCP", followed by the format version.
+static constexpr uint32_t CHECKPOINT_MAGIC = 0x50435258;
+static constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+// Input elements point to semantic names with static storage, so names read back are kept alive here.
+static const char* internSemanticName(const std::string& semanticName)
+{
+    static std::mutex semanticNameMutex;
+    static std::unordered_set<std::string> semanticNames;
+
+    std::lock_guard lock(semanticNameMutex);
+    return semanticNames.insert(semanticName).first->c_str();
+}
+
+struct BinaryWriter
+{
+    std::vector<uint8_t> data;
+
+    template<typename T>
+    void write(T value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto bytes = reinterpret_cast<const uint8_t*>(&value);
+        data.insert(data.end(), bytes, bytes + sizeof(T));
+    }
+
+    void write(const std::vector<uint8_t>& bytes)
+    {
+        write(uint64_t(bytes.size()));
+        data.insert(data.end(), bytes.begin(), bytes.end());
+    }
+
+    void write(const std::string& string)
+    {
+        write(uint64_t(string.size()));
+        data.insert(data.end(), string.begin(), string.end());
+    }
+
+    void write(const CompiledShader& shader)
+    {
+        write(shader.dxil);
+        write(shader.spirv);
+        write(shader.air);
+        write(shader.airSource);
+    }
+
+    void write(const RecompiledShader& shader)
+    {
+        write(shader.specConstantsMask);
+        write(shader.clampsRemoved);
+        write(static_cast<const CompiledShader&>(shader));
+
+        write(uint64_t(shader.inputElements.size()));
+        for (auto& inputElement : shader.inputElements)
+        {
+            write(std::string(inputElement.semanticName));
+            write(uint32_t(inputElement.usage));
+            write(inputElement.usageIndex);
+            write(inputElement.location);
+            write(inputElement.componentType);
+        }
+
+        write(uint64_t(shader.variants.size()));
+        for (auto& variant : shader.variants)
+        {
+            write(variant.kind);
+            write(variant.key);
+            write(static_cast<const CompiledShader&>(variant));
+        }
+    }
+};
+
+struct BinaryReader
+{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    bool failed = false;
+
+    const uint8_t* readBytes(size_t count)
+    {
+        if (failed || count > size - offset)
+        {
+            failed = true;
+            return nullptr;
+        }
+
+        const uint8_t* bytes = data + offset;
+        offset += count;
+        return bytes;
+    }
+
+    template<typename T>
+    T read()
+    {
+        T value{};
+        if (auto bytes = readBytes(sizeof(T)))
+            memcpy(&value, bytes, sizeof(T));
+
+        return value;
+    }
+
+    void read(std::vector<uint8_t>& bytes)
+    {
+        size_t count = read<uint64_t>();
+        if (auto source = readBytes(count))
+            bytes.assign(source, source + count);
+    }
+
+    void read(std::string& string)
+    {
+        size_t count = read<uint64_t>();
+        if (auto source = readBytes(count))
+            string.assign(reinterpret_cast<const char*>(source), count);
+    }
+
+    void read(CompiledShader& shader)
+    {
+        read(shader.dxil);
+        read(shader.spirv);
+        read(shader.air);
+        read(shader.airSource);
+    }
+
+    void read(RecompiledShader& shader)
+    {
+        shader.specConstantsMask = read<uint32_t>();
+        shader.clampsRemoved = read<uint32_t>();
+        read(static_cast<CompiledShader&>(shader));
+
+        size_t inputElementCount = read<uint64_t>();
+        for (size_t i = 0; i < inputElementCount && !failed; i++)
+        {
+            std::string semanticName;
+            read(semanticName);
+
+            auto& inputElement = shader.inputElements.emplace_back();
+            inputElement.semanticName = internSemanticName(semanticName);
+            inputElement.usage = DeclUsage(read<uint32_t>());
+            inputElement.usageIndex = read<uint32_t>();
+            inputElement.location = read<uint32_t>();
+            inputElement.componentType = read<uint32_t>();
+        }
+
+        size_t variantCount = read<uint64_t>();
+        for (size_t i = 0; i < variantCount && !failed; i++)
+        {
+            auto& variant = shader.variants.emplace_back();
+            variant.kind = read<uint32_t>();
+            variant.key = read<uint64_t>();
+            read(static_cast<CompiledShader&>(variant));
+        }
+    }
+};
+
+std::vector<uint8_t> serializeShader(const RecompiledShader& shader)
+{
+    BinaryWriter writer;
+    writer.write(shader);
+    return std::move(writer.data);
+}
+
+bool deserializeShader(const uint8_t* data, size_t dataSize, RecompiledShader& shader)
+{
+    RecompiledShader deserializedShader;
+
+    BinaryReader reader;
+    reader.data = data;
+    reader.size = dataSize;
+    reader.read(deserializedShader);
+
+    if (reader.failed || reader.offset != reader.size)
+        return false;
+
+    deserializedShader.data = shader.data;
+    deserializedShader.filename = std::move(shader.filename);
+    shader = std::move(deserializedShader);
+
+    return true;
+}
+
+bool writeShaderCacheShard(const char* filePath, const ShaderCacheShard& shard)
+{
+    BinaryWriter writer;
+    writer.write(SHARD_MAGIC);
+    writer.write(SHARD_VERSION);
+    writer.write(shard.index);
+    writer.write(shard.count);
+    writer.write(shard.profile);
+    writer.write(uint8_t(shard.hasVariants));
+    writer.write(shard.optionsFingerprint);
+    writer.write(shard.variantListsFingerprint);
+    writer.write(uint64_t(shard.shaders.size()));
+
+    for (auto& [hash, shader] : shard.shaders)
+    {
+        writer.write(uint64_t(hash));
+        writer.write(shader.filename);
+        writer.write(shader);
+    }
+
+    std::ofstream stream(filePath, std::ios::binary);
+    stream.write(reinterpret_cast<const char*>(writer.data.data()), writer.data.size());
+    return stream.good();
+}
+
+bool readShaderCacheShard(const char* filePath, ShaderCacheShard& shard)
+{
+    std::ifstream stream(filePath, std::ios::binary);
+    if (!stream.is_open())
+        return false;
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    BinaryReader reader;
+    reader.data = data.data();
+    reader.size = data.size();
+
+    if (reader.read<uint32_t>() != SHARD_MAGIC || reader.read<uint32_t>() != SHARD_VERSION)
+        return false;
+
+    shard.index = reader.read<uint32_t>();
+    shard.count = reader.read<uint32_t>();
+    reader.read(shard.profile);
+    shard.hasVariants = reader.read<uint8_t>() != 0;
+    shard.optionsFingerprint = reader.read<uint64_t>();
+    shard.variantListsFingerprint = reader.read<uint64_t>();
+
+    size_t shaderCount = reader.read<uint64_t>();
+    for (size_t i = 0; i < shaderCount && !reader.failed; i++)
+    {
+        auto& shader = shard.shaders[reader.read<uint64_t>()];
+        reader.read(shader.filename);
+        reader.read(shader);
+    }
+
+    return !reader.failed && reader.offset == reader.size;
+}
+
+// Parses the integers of a table row written by ShaderCacheTables, stopping at the first string.
+static std::vector<uint64_t> parseTableRow(const char* row)
+{
+    std::vector<uint64_t> values;
+    while (*row != '\0' && *row != '"')
+    {
+        if (isdigit(uint8_t(*row)))
+        {
+            char* end;
+            values.push_back(strtoull(row, &end, 0));
+            row = end;
+        }
+        else
+        {
+            ++row;
+        }
+    }
+
+    return values;
+}
+
+static bool startsWith(const std::string& line, const std::string_view& prefix)
+{
+    return line.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool readShaderCache(const char* filePath, ShaderCacheShard& cache)
+{
+    std::ifstream stream(filePath);
+    if (!stream.is_open())
+        return false;
+
+    enum
+    {
+        TABLE_NONE,
+        TABLE_ENTRIES,
+        TABLE_INPUT_SIGNATURES,
+        TABLE_INPUT_ELEMENTS,
+        TABLE_VARIANT_ENTRIES
+    };
+
+    // Same order as the offsets in the table rows.
+    static constexpr const char* BLOB_NAMES[] = { "Dxil", "Spirv", "Air" };
+    static constexpr const char* BLOB_PREFIXES[] = { "dxil", "spirv", "air" };
+
+    std::vector<std::vector<uint64_t>> entries;
+    std::vector<std::string> filenames;
+    std::vector<std::vector<uint64_t>> inputSignatures;
+    std::vector<InputElement> inputElements;
+    std::vector<std::vector<uint64_t>> variantEntries;
+    std::vector<uint8_t> compressedBlobs[std::size(BLOB_NAMES)];
+    std::vector<uint8_t> blobs[std::size(BLOB_NAMES)];
+    size_t decompressedSizes[std::size(BLOB_NAMES)]{};
+
+    uint32_t table = TABLE_NONE;
+    std::string line;
+
+    while (std::getline(stream, line))
+    {
+        if (table != TABLE_NONE)
+        {
+            if (line == "};")
+            {
+                table = TABLE_NONE;
+                continue;
+            }
+
+            // Placeholders of empty arrays.
+            if (startsWith(line, "\t{}"))
+                continue;
+
+            size_t stringBegin = line.find('"');
+            size_t stringEnd = line.rfind('"');
+
+            switch (table)
+            {
+            case TABLE_ENTRIES:
+                entries.push_back(parseTableRow(line.c_str()));
+                if (entries.back().size() != 8 || stringBegin == std::string::npos || stringBegin == stringEnd)
+                    return false;
+
+                filenames.push_back(line.substr(stringBegin + 1, stringEnd - stringBegin - 1));
+                break;
+
+            case TABLE_INPUT_SIGNATURES:
+                inputSignatures.push_back(parseTableRow(line.c_str()));
+                if (inputSignatures.back().size() != 2)
+                    return false;
+
+                break;
+
+            case TABLE_INPUT_ELEMENTS:
+            {
+                if (stringBegin == std::string::npos || stringBegin == stringEnd)
+                    return false;
+
+                auto values = parseTableRow(line.c_str() + stringEnd + 1);
+                if (values.size() != 4)
+                    return false;
+
+                auto& inputElement = inputElements.emplace_back();
+                inputElement.semanticName = internSemanticName(line.substr(stringBegin + 1, stringEnd - stringBegin - 1));
+                inputElement.usage = DeclUsage(values[0]);
+                inputElement.usageIndex = uint32_t(values[1]);
+                inputElement.location = uint32_t(values[2]);
+                inputElement.componentType = uint32_t(values[3]);
+                break;
+            }
+
+            case TABLE_VARIANT_ENTRIES:
+                variantEntries.push_back(parseTableRow(line.c_str()));
+                if (variantEntries.back().size() != 9)
+                    return false;
+
+                break;
+            }
+
+            continue;
+        }
+
+        if (startsWith(line, "const char* g_shaderCacheProfile = \""))
+        {
+            size_t begin = line.find('"');
+            cache.profile = line.substr(begin + 1, line.rfind('"') - begin - 1);
+        }
+        else if (startsWith(line, "const uint64_t g_shaderCacheOptionsFingerprint = "))
+        {
+            cache.optionsFingerprint = strtoull(line.c_str() + line.find('=') + 1, nullptr, 16);
+        }
+        else if (startsWith(line, "ShaderCacheEntry g_shaderCacheEntries[]"))
+        {
+            table = TABLE_ENTRIES;
+        }
+        else if (startsWith(line, "ShaderCacheInputSignature g_shaderCacheInputSignatures[]"))
+        {
+            table = TABLE_INPUT_SIGNATURES;
+        }
+        else if (startsWith(line, "ShaderCacheInputElement g_shaderCacheInputElements[]"))
+        {
+            table = TABLE_INPUT_ELEMENTS;
+        }
+        else if (startsWith(line, "ShaderCacheVariantEntry g_shaderCacheVariantEntries[]"))
+        {
+            table = TABLE_VARIANT_ENTRIES;
+            cache.hasVariants = true;
+        }
+        else
+        {
+            for (size_t i = 0; i < std::size(BLOB_NAMES); i++)
+            {
+                // Blob arrays are written on a single line.
+                if (startsWith(line, fmt::format("const uint8_t g_compressed{}Cache[] = {{", BLOB_NAMES[i])))
+                {
+                    size_t begin = line.find('{') + 1;
+                    size_t end = line.rfind('}');
+                    if (end == std::string::npos || end < begin)
+                        return false;
+
+                    const char* data = line.c_str() + begin;
+                    const char* dataEnd = line.c_str() + end;
+                    uint32_t value = 0;
+
+                    for (; data < dataEnd; data++)
+                    {
+                        if (*data == ',')
+                        {
+                            compressedBlobs[i].push_back(uint8_t(value));
+                            value = 0;
+                        }
+                        else
+                        {
+                            value = value * 10 + (*data - '0');
+                        }
+                    }
+                }
+                else if (startsWith(line, fmt::format("const size_t g_{}CacheDecompressedSize = ", BLOB_PREFIXES[i])))
+                {
+                    decompressedSizes[i] = strtoull(line.c_str() + line.find('=') + 1, nullptr, 10);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < std::size(BLOB_NAMES); i++)
+    {
+        if (compressedBlobs[i].empty())
+            continue;
+
+        blobs[i].resize(decompressedSizes[i]);
+        if (ZSTD_decompress(blobs[i].data(), blobs[i].size(), compressedBlobs[i].data(), compressedBlobs[i].size()) != blobs[i].size())
+            return false;
+    }
+
+    // Blobs of targets the cache wasn't built for are empty.
+    auto readBlobs = [&](const std::vector<uint64_t>& row, size_t offset, CompiledShader& shader)
+        {
+            std::vector<uint8_t>* shaderBlobs[] = { &shader.dxil, &shader.spirv, &shader.air };
+            for (size_t i = 0; i < std::size(shaderBlobs); i++)
+            {
+                uint64_t blobOffset = row[offset + i * 2];
+                uint64_t blobSize = row[offset + i * 2 + 1];
+                if (blobSize == 0)
+                    continue;
+
+                if (blobOffset > blobs[i].size() || blobSize > blobs[i].size() - blobOffset)
+                    return false;
+
+                shaderBlobs[i]->assign(blobs[i].begin() + blobOffset, blobs[i].begin() + blobOffset + blobSize);
+            }
+
+            return true;
+        };
+
+    if (!inputSignatures.empty() && inputSignatures.size() != entries.size())
+        return false;
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        auto& shader = cache.shaders[entries[i][0]];
+        shader.filename = std::move(filenames[i]);
+        shader.specConstantsMask = uint32_t(entries[i][7]);
+
+        if (!readBlobs(entries[i], 1, shader))
+            return false;
+
+        if (!inputSignatures.empty())
+        {
+            uint64_t begin = inputSignatures[i][0];
+            uint64_t count = inputSignatures[i][1];
+            if (begin > inputElements.size() || count > inputElements.size() - begin)
+                return false;
+
+            shader.inputElements.assign(inputElements.begin() + begin, inputElements.begin() + begin + count);
+        }
+    }
+
+    for (auto& row : variantEntries)
+    {
+        auto findResult = cache.shaders.find(row[0]);
+        if (findResult == cache.shaders.end())
+            return false;
+
+        auto& variant = findResult->second.variants.emplace_back();
+        variant.kind = uint32_t(row[1]);
+        variant.key = row[2];
+
+        if (!readBlobs(row, 3, variant))
+            return false;
+    }
+
+    return !entries.empty();
+}
+
+ShaderCheckpoint::~ShaderCheckpoint()
+{
+    if (file != nullptr)
+        fclose(file);
+}
+
+bool ShaderCheckpoint::open(const char* filePath, uint64_t fingerprint)
+{
+    std::vector<uint8_t> data;
+    {
+        std::ifstream stream(filePath, std::ios::binary);
+        if (stream.is_open())
+            data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    }
+
+    BinaryReader reader;
+    reader.data = data.data();
+    reader.size = data.size();
+
+    // Records are only appended, so a build killed while saving leaves at most one incomplete record at the end.
+    size_t validSize = 0;
+    if (reader.read<uint32_t>() == CHECKPOINT_MAGIC && reader.read<uint32_t>() == CHECKPOINT_VERSION && reader.read<uint64_t>() == fingerprint)
+    {
+        validSize = reader.offset;
+
+        while (reader.offset < reader.size)
+        {
+            XXH64_hash_t hash = reader.read<uint64_t>();
+            std::vector<uint8_t> record;
+            reader.read(record);
+
+            if (reader.failed)
+                break;
+
+            records[hash] = std::move(record);
+            validSize = reader.offset;
+        }
+    }
+
+    if (validSize != 0)
+    {
+        std::error_code ec;
+        std::filesystem::resize_file(filePath, validSize, ec);
+        file = ec ? nullptr : fopen(filePath, "ab");
+    }
+    else
+    {
+        file = fopen(filePath, "wb");
+        if (file != nullptr)
+        {
+            BinaryWriter writer;
+            writer.write(CHECKPOINT_MAGIC);
+            writer.write(CHECKPOINT_VERSION);
+            writer.write(uint64_t(fingerprint));
+            fwrite(writer.data.data(), 1, writer.data.size(), file);
+            fflush(file);
+        }
+    }
+
+    return file != nullptr;
+}
+
+bool ShaderCheckpoint::restore(XXH64_hash_t hash, RecompiledShader& shader)
+{
+    std::vector<uint8_t> record;
+    {
+        std::lock_guard lock(mutex);
+        auto findResult = records.find(hash);
+        if (findResult == records.end())
+            return false;
+
+        record = std::move(findResult->second);
+        records.erase(findResult);
+    }
+
+    return deserializeShader(record.data(), record.size(), shader);
+}
+
+void ShaderCheckpoint::save(XXH64_hash_t hash, const RecompiledShader& shader)
+{
+    BinaryWriter writer;
+    writer.write(uint64_t(hash));
+    writer.write(serializeShader(shader));
+
+    // Flushed after every record, so everything saved so far survives the process being killed.
+    std::lock_guard lock(mutex);
+    fwrite(writer.data.data(), 1, writer.data.size(), file);
+    fflush(file);
+}
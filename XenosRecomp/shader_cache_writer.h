@@ -0,0 +1,165 @@
+#pragma once
+
+#include "shader_recompiler.h"
+
+#include <mutex>
+
+struct CompiledShader
+{
+    std::vector<uint8_t> dxil;
+    std::vector<uint8_t> spirv;
+    std::vector<uint8_t> air;
+    std::string airSource; // Compiled to AIR in batches once every shader is recompiled.
+};
+
+struct RecompiledShaderVariant : CompiledShader
+{
+    uint32_t kind = 0;
+    uint64_t key = 0;
+};
+
+struct RecompiledShader : CompiledShader
+{
+    uint8_t* data = nullptr;
+    std::string filename;
+    uint32_t specConstantsMask = 0;
+    std::vector<RecompiledShaderVariant> variants;
+    std::vector<InputElement> inputElements;
+    uint32_t clampsRemoved = 0;
+};
+
+// Tables of the shader cache, referencing the blobs of each shader by their offsets in the decompressed caches.
+struct ShaderCacheTables
+{
+    StringBuffer entries;
+    StringBuffer inputSignatures;
+    StringBuffer inputElements;
+    StringBuffer variantEntries;
+    size_t entryCount = 0;
+    size_t inputElementCount = 0;
+    size_t variantCount = 0;
+    size_t dxilSize = 0;
+    size_t spirvSize = 0;
+    size_t airSize = 0;
+
+    // Hashes of the entries, indexed by the minimal perfect hash printed with the tables.
+    std::vector<XXH64_hash_t> hashes;
+
+    // Shaders must be added in ascending hash order, and their blobs appended to the caches in the same order.
+    void add(XXH64_hash_t hash, const RecompiledShader& shader);
+    void print(StringBuffer& f, const std::string& profile, bool hasVariants, uint64_t optionsFingerprint) const;
+};
+
+// Minimal perfect hash of the entry hashes, looked up with findShaderCacheIndex.
+struct ShaderCacheIndex
+{
+    uint32_t seed = 0;
+    std::vector<uint32_t> displacements;
+    std::vector<uint32_t> slots;
+};
+
+ShaderCacheIndex createShaderCacheIndex(const std::vector<XXH64_hash_t>& hashes);
+
+// Creates the source file embedding the compressed shader cache and its tables.
+std::string createShaderCache(const std::map<XXH64_hash_t, RecompiledShader>& shaders, const std::string& profile, bool hasVariants, uint64_t optionsFingerprint, int compressionLevel);
+
+// Writes the same source file as createShaderCache, but compresses the blobs of each shader into temporary files
+// as soon as it is added, so the whole cache never has to be held in memory.
+class ShaderCacheStream
+{
+public:
+    ShaderCacheStream() = default;
+    ShaderCacheStream(const ShaderCacheStream&) = delete;
+    ShaderCacheStream& operator=(const ShaderCacheStream&) = delete;
+    ~ShaderCacheStream();
+
+    bool open(const char* filePath, const std::string& profile, bool hasVariants, uint64_t optionsFingerprint, int compressionLevel);
+
+    // Shaders must be added in ascending hash order. Their blobs are released once compressed.
+    void add(XXH64_hash_t hash, RecompiledShader& shader);
+
+    bool close();
+
+private:
+    enum
+    {
+        BLOB_DXIL,
+        BLOB_SPIRV,
+        BLOB_AIR,
+        BLOB_COUNT
+    };
+
+    static constexpr const char* BLOB_PREFIXES[] = { "dxil", "spirv", "air" };
+
+    struct BlobStream
+    {
+        ZSTD_CCtx* context = nullptr;
+        FILE* file = nullptr;
+        std::string filePath;
+        size_t compressedSize = 0;
+        size_t decompressedSize = 0;
+    };
+
+    std::string filePath;
+    std::string profile;
+    bool hasVariants = false;
+    uint64_t optionsFingerprint = 0;
+    bool failed = false;
+    ShaderCacheTables tables;
+    BlobStream blobStreams[BLOB_COUNT];
+
+    static bool writeBlob(BlobStream& blobStream, const void* data, size_t dataSize, bool end);
+};
+
+// Partial result of a sharded build, containing the shaders whose hash modulo the shard count
+// equals the shard index. Merging every shard creates the same cache a single build would.
+struct ShaderCacheShard
+{
+    uint32_t index = 0;
+    uint32_t count = 1;
+    std::string profile;
+    bool hasVariants = false;
+    uint64_t optionsFingerprint = 0; // Options the shaders were recompiled with, excluding the variant lists.
+    uint64_t variantListsFingerprint = 0; // Shards can only be merged if built with the same options and variant lists.
+    std::map<XXH64_hash_t, RecompiledShader> shaders;
+};
+
+bool writeShaderCacheShard(const char* filePath, const ShaderCacheShard& shard);
+bool readShaderCacheShard(const char* filePath, ShaderCacheShard& shard);
+
+// Reads a cache source file written by createShaderCache or ShaderCacheStream back into a single shard, with the blobs
+// of every shader and variant decompressed byte for byte. Shaders read back have no data.
+bool readShaderCache(const char* filePath, ShaderCacheShard& cache);
+
+// Serializes the compiled state of a shader, without its data and filename.
+std::vector<uint8_t> serializeShader(const RecompiledShader& shader);
+
+// Replaces the compiled state of the shader, leaving it untouched if the data is malformed.
+bool deserializeShader(const uint8_t* data, size_t dataSize, RecompiledShader& shader);
+
+// Append-only file of recompiled shaders, allowing an interrupted build to resume without recompiling them.
+// Shaders saved by a build with a different fingerprint are discarded.
+class ShaderCheckpoint
+{
+public:
+    ShaderCheckpoint() = default;
+    ShaderCheckpoint(const ShaderCheckpoint&) = delete;
+    ShaderCheckpoint& operator=(const ShaderCheckpoint&) = delete;
+    ~ShaderCheckpoint();
+
+    bool open(const char* filePath, uint64_t fingerprint);
+
+    size_t getRestorableCount() const
+    {
+        return records.size();
+    }
+
+    // Both are safe to call from multiple threads.
+    bool restore(XXH64_hash_t hash, RecompiledShader& shader);
+    void save(XXH64_hash_t hash, const RecompiledShader& shader);
+
+private:
+    std::mutex mutex;
+    FILE* file = nullptr;
+    std::unordered_map<XXH64_hash_t, std::vector<uint8_t>> records;
+};
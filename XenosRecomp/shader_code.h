@@ -455,4 +455,12 @@ struct AluInstruction
         uint32_t src2Select : 1;
         uint32_t src1Select : 1;
     };
+};
+
+union Instruction
+{
+    VertexFetchInstruction vertexFetch;
+    TextureFetchInstruction textureFetch;
+    AluInstruction alu;
+    uint32_t code[3];
 };
\ No newline at end of file
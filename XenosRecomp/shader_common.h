@@ -15,6 +15,21 @@
     #define SPEC_CONSTANT_CONDITIONAL_RENDERING (1 << 6)
 #endif
 
+#define SPEC_CONSTANT_SWAPPED_TEXCOORDS     (1 << 7)
+#define SPEC_CONSTANT_SWAPPED_NORMALS       (1 << 8)
+#define SPEC_CONSTANT_SWAPPED_BINORMALS     (1 << 9)
+#define SPEC_CONSTANT_SWAPPED_TANGENTS      (1 << 10)
+#define SPEC_CONSTANT_SWAPPED_BLEND_WEIGHTS (1 << 11)
+#define SPEC_CONSTANT_CLIP_PLANE            (1 << 12)
+
+#define SHADER_VARIANT_SPEC_CONSTANTS 0
+#define SHADER_VARIANT_PACKED_INTERPOLATORS 1
+#define SHADER_VARIANT_LINKED_PAIR 2
+#define SHADER_VARIANT_BOOLEANS 3
+
+#define SHADER_INPUT_COMPONENT_TYPE_FLOAT 0
+#define SHADER_INPUT_COMPONENT_TYPE_UINT  1
+
 #if defined(__air__) || !defined(__cplusplus) || defined(__INTELLISENSE__)
 
 #ifndef __air__
@@ -46,9 +61,13 @@ struct PushConstants
 #define g_conditionalSurveyIndex    vk::RawBufferLoad<uint>(g_PushConstants.SharedConstants + 312)
 #define g_conditionalRenderingIndex vk::RawBufferLoad<uint>(g_PushConstants.SharedConstants + 316)
 
+#ifdef SPEC_CONSTANTS_VALUE
+#define g_SpecConstants() (SPEC_CONSTANTS_VALUE)
+#else
 [[vk::constant_id(0)]] const uint g_SpecConstants = 0;
 
 #define g_SpecConstants() g_SpecConstants
+#endif
 
 #elif defined(__air__)
 
@@ -56,6 +75,9 @@ struct PushConstants
 
 using namespace metal;
 
+#ifdef SPEC_CONSTANTS_VALUE
+#define g_SpecConstants() (SPEC_CONSTANTS_VALUE)
+#else
 constant uint G_SPEC_CONSTANTS [[function_constant(0)]];
 constant uint G_SPEC_CONSTANTS_VAL = is_function_constant_defined(G_SPEC_CONSTANTS) ? G_SPEC_CONSTANTS : 0;
 
@@ -63,6 +85,7 @@ uint g_SpecConstants()
 {
     return G_SPEC_CONSTANTS_VAL;
 }
+#endif
 
 struct PushConstants
 {
@@ -100,7 +123,11 @@ struct PushConstants
     uint g_conditionalSurveyIndex : packoffset(c19.z); \
     uint g_conditionalRenderingIndex : packoffset(c19.w);
 
+#ifdef SPEC_CONSTANTS_VALUE
+#define g_SpecConstants() (SPEC_CONSTANTS_VALUE)
+#else
 uint g_SpecConstants();
+#endif
 
 #endif
 
@@ -363,11 +390,19 @@ float4x4 mul(T a, T b)
 }
 #endif
 
+// Metal doesn't convert between float and half vectors implicitly, so reduced precision
+// registers are kept at full precision there.
+#ifdef __air__
+#define min16float4 float4
+#endif
+
 #ifdef __air__
 #define UNROLL
+#define UNROLL_COUNT(COUNT)
 #define BRANCH
 #else
 #define UNROLL [unroll]
+#define UNROLL_COUNT(COUNT) [unroll(COUNT)]
 #define BRANCH [branch]
 #endif
 
@@ -0,0 +1,287 @@
+#include "shader_cost.h"
+
+#include <unordered_set>
+
+static constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+
+enum SpirvOp : uint32_t
+{
+    SpirvOpExtInst = 12,
+    SpirvOpFunction = 54,
+    SpirvOpFunctionParameter = 55,
+    SpirvOpFunctionEnd = 56,
+    SpirvOpVariable = 59,
+    SpirvOpLoad = 61,
+    SpirvOpImageSampleImplicitLod = 87,
+    SpirvOpImageRead = 98,
+    SpirvOpConvertFToU = 109,
+    SpirvOpBitcast = 124,
+    SpirvOpSNegate = 126,
+    SpirvOpBitCount = 205,
+    SpirvOpDPdx = 207,
+    SpirvOpFwidthCoarse = 215,
+    SpirvOpLoopMerge = 246,
+    SpirvOpLabel = 248,
+    SpirvOpBranchConditional = 250,
+    SpirvOpSwitch = 251,
+    SpirvOpImageSparseSampleImplicitLod = 305,
+    SpirvOpImageSparseRead = 320
+};
+
+static constexpr uint32_t SPIRV_STORAGE_CLASS_FUNCTION = 7;
+
+bool getSpirvCost(const uint32_t* words, size_t wordCount, ShaderCost& cost)
+{
+    if (wordCount < 5 || words[0] != SPIRV_MAGIC)
+        return false;
+
+    bool insideFunction = false;
+
+    // Each instruction stores its word count in the upper half of its first word, and its opcode in the lower half.
+    for (size_t i = 5; i < wordCount;)
+    {
+        uint32_t op = words[i] & 0xFFFF;
+        uint32_t count = words[i] >> 16;
+
+        if (count == 0 || (i + count) > wordCount)
+            return false;
+
+        if (op == SpirvOpFunction)
+        {
+            insideFunction = true;
+        }
+        else if (op == SpirvOpFunctionEnd)
+        {
+            insideFunction = false;
+        }
+        else if (insideFunction && op != SpirvOpFunctionParameter && op != SpirvOpLabel)
+        {
+            ++cost.instructionCount;
+
+            if (op == SpirvOpExtInst || (op >= SpirvOpConvertFToU && op <= SpirvOpBitcast) ||
+                (op >= SpirvOpSNegate && op <= SpirvOpBitCount) || (op >= SpirvOpDPdx && op <= SpirvOpFwidthCoarse))
+            {
+                ++cost.aluCount;
+            }
+            else if ((op >= SpirvOpImageSampleImplicitLod && op <= SpirvOpImageRead) ||
+                (op >= SpirvOpImageSparseSampleImplicitLod && op <= SpirvOpImageSparseRead))
+            {
+                ++cost.sampleCount;
+            }
+            else if (op == SpirvOpLoad)
+            {
+                ++cost.loadCount;
+            }
+            else if (op == SpirvOpBranchConditional || op == SpirvOpSwitch)
+            {
+                ++cost.branchCount;
+            }
+            else if (op == SpirvOpLoopMerge)
+            {
+                ++cost.loopCount;
+            }
+            else if (op == SpirvOpVariable && count >= 4 && words[i + 3] == SPIRV_STORAGE_CLASS_FUNCTION)
+            {
+                ++cost.variableCount;
+            }
+        }
+
+        i += count;
+    }
+
+    return true;
+}
+
+static const char* const DXIL_ALU_INSTRUCTIONS[] =
+{
+    "fneg", "fadd", "fsub", "fmul", "fdiv", "frem", "add", "sub", "mul", "udiv", "sdiv", "urem", "srem",
+    "shl", "lshr", "ashr", "and", "or", "xor", "fcmp", "icmp", "select",
+    "trunc", "zext", "sext", "fptrunc", "fpext", "fptoui", "fptosi", "uitofp", "sitofp", "bitcast"
+};
+
+// DXIL operations are calls to functions named after their overload class, with the operation itself as the first argument.
+static const char* const DXIL_ALU_OPERATIONS[] =
+{
+    "unary", "unaryBits", "binary", "binaryWithCarryOrBorrow", "binaryWithTwoOuts", "tertiary", "quaternary",
+    "dot2", "dot3", "dot4", "isSpecialFloat", "legacyF32ToF16", "legacyF16ToF32", "makeDouble", "splitDouble"
+};
+
+static bool startsWith(const std::string_view& value, const std::string_view& prefix)
+{
+    return value.size() >= prefix.size() && value.compare(0, prefix.size(), prefix) == 0;
+}
+
+static bool endsWith(const std::string_view& value, const std::string_view& suffix)
+{
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+ShaderCost getDxilCost(const std::string_view& disassembly)
+{
+    ShaderCost cost;
+
+    // Branches back to a block that was already defined close a loop.
+    std::unordered_set<std::string_view> labels;
+    std::unordered_set<std::string_view> loopHeaders;
+    bool insideFunction = false;
+
+    size_t lineStart = 0;
+    while (lineStart < disassembly.size())
+    {
+        size_t lineEnd = disassembly.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos)
+            lineEnd = disassembly.size();
+
+        std::string_view line = disassembly.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+
+        if (startsWith(line, "define "))
+        {
+            insideFunction = true;
+            labels.clear();
+            labels.emplace("0");
+            continue;
+        }
+
+        if (!insideFunction)
+            continue;
+
+        // Each function has its own block numbering.
+        if (startsWith(line, "}"))
+        {
+            cost.loopCount += loopHeaders.size();
+            loopHeaders.clear();
+            insideFunction = false;
+            continue;
+        }
+
+        if (startsWith(line, "; <label>:"))
+        {
+            std::string_view label = line.substr(10);
+            labels.emplace(label.substr(0, label.find_first_of(" \t")));
+            continue;
+        }
+
+        if (!startsWith(line, "  ") || line.size() <= 2 || line[2] == ' ' || line[2] == ';')
+        {
+            // Named blocks are only present in disassemblies that kept their names.
+            size_t colon = line.find(':');
+            if (!line.empty() && line[0] != ' ' && line[0] != ';' && colon != std::string_view::npos)
+                labels.emplace(line.substr(0, colon));
+
+            continue;
+        }
+
+        ++cost.instructionCount;
+
+        std::string_view instruction = line.substr(2);
+        size_t assignment = instruction.find(" = ");
+        if (instruction[0] == '%' && assignment != std::string_view::npos)
+            instruction = instruction.substr(assignment + 3);
+
+        std::string_view opcode = instruction.substr(0, instruction.find(' '));
+        if (opcode == "tail" || opcode == "call")
+        {
+            size_t operation = instruction.find("@dx.op.");
+            if (operation == std::string_view::npos)
+                continue;
+
+            std::string_view name = instruction.substr(operation + 7);
+            name = name.substr(0, name.find_first_of(".("));
+
+            if (startsWith(name, "sample") || startsWith(name, "texture"))
+            {
+                ++cost.sampleCount;
+            }
+            else if (endsWith(name, "Load") || endsWith(name, "LoadLegacy"))
+            {
+                ++cost.loadCount;
+            }
+            else
+            {
+                for (auto aluOperation : DXIL_ALU_OPERATIONS)
+                {
+                    if (name == aluOperation)
+                    {
+                        ++cost.aluCount;
+                        break;
+                    }
+                }
+            }
+        }
+        else if (opcode == "load")
+        {
+            ++cost.loadCount;
+        }
+        else if (opcode == "alloca")
+        {
+            ++cost.variableCount;
+        }
+        else if (opcode == "switch" || (opcode == "br" && startsWith(instruction, "br i1 ")))
+        {
+            ++cost.branchCount;
+        }
+        else
+        {
+            for (auto aluInstruction : DXIL_ALU_INSTRUCTIONS)
+            {
+                if (opcode == aluInstruction)
+                {
+                    ++cost.aluCount;
+                    break;
+                }
+            }
+        }
+
+        if (opcode == "br")
+        {
+            size_t target = 0;
+            while ((target = instruction.find("label %", target)) != std::string_view::npos)
+            {
+                target += 7;
+
+                std::string_view label = instruction.substr(target);
+                label = label.substr(0, label.find_first_of(", "));
+
+                if (labels.find(label) != labels.end())
+                    loopHeaders.emplace(label);
+            }
+        }
+    }
+
+    return cost;
+}
+
+std::string createShaderCostReport(const std::vector<ShaderCostReportRow>& rows, bool json)
+{
+    std::string report;
+
+    if (json)
+    {
+        report += "[\n";
+
+        for (size_t i = 0; i < rows.size(); i++)
+        {
+            auto& row = rows[i];
+            report += fmt::format("  {{ \"hash\": \"{:016x}\", \"variant\": \"{}\", \"key\": \"{:x}\", \"target\": \"{}\", "
+                "\"instructions\": {}, \"alu\": {}, \"samples\": {}, \"loads\": {}, \"branches\": {}, \"loops\": {}, \"variables\": {} }}{}\n",
+                row.hash, row.variant, row.key, row.target, row.cost.instructionCount, row.cost.aluCount, row.cost.sampleCount,
+                row.cost.loadCount, row.cost.branchCount, row.cost.loopCount, row.cost.variableCount, (i + 1) < rows.size() ? "," : "");
+        }
+
+        report += "]\n";
+    }
+    else
+    {
+        report += "hash,variant,key,target,instructions,alu,samples,loads,branches,loops,variables\n";
+
+        for (auto& row : rows)
+        {
+            report += fmt::format("{:016x},{},{:x},{},{},{},{},{},{},{},{}\n", row.hash, row.variant, row.key, row.target,
+                row.cost.instructionCount, row.cost.aluCount, row.cost.sampleCount, row.cost.loadCount,
+                row.cost.branchCount, row.cost.loopCount, row.cost.variableCount);
+        }
+    }
+
+    return report;
+}
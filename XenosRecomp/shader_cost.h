@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+
+// Static instruction counts of a compiled shader, comparable between builds without running it.
+struct ShaderCost
+{
+    size_t instructionCount = 0;
+    size_t aluCount = 0;
+    size_t sampleCount = 0; // Texture samples, gathers and loads.
+    size_t loadCount = 0; // Memory and constant buffer loads.
+    size_t branchCount = 0; // Conditional branches and switches.
+    size_t loopCount = 0;
+    size_t variableCount = 0; // Function scope variables.
+};
+
+// Counts the instructions in the functions of a SPIR-V module. Returns false if the module is malformed.
+bool getSpirvCost(const uint32_t* words, size_t wordCount, ShaderCost& cost);
+
+// Counts the instructions in the functions of a DXIL disassembly.
+ShaderCost getDxilCost(const std::string_view& disassembly);
+
+struct ShaderCostReportRow
+{
+    XXH64_hash_t hash = 0;
+    const char* variant = nullptr;
+    uint64_t key = 0;
+    const char* target = nullptr;
+    ShaderCost cost;
+};
+
+// Formats the rows as CSV, or as a JSON array of objects.
+std::string createShaderCostReport(const std::vector<ShaderCostReportRow>& rows, bool json);
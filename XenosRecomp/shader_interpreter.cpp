@@ -0,0 +1,1196 @@
+#include "shader_interpreter.h"
+#include "constant_table.h"
+
+static constexpr size_t LANE_COUNT = INTERPRETER_LANE_COUNT;
+
+// Shaders whose control flow doesn't terminate are stopped after this many control flow instructions.
+static constexpr size_t MAX_CONTROL_FLOW_STEPS = 1 << 20;
+
+struct ShaderInterpreter::State
+{
+    const ShaderInterpreterInputs* inputs = nullptr;
+    ShaderInterpreterOutputs* outputs = nullptr;
+    float registers[64][4][LANE_COUNT]{};
+    int32_t a0[LANE_COUNT]{};
+    int32_t aL[LANE_COUNT]{};
+    bool p0[LANE_COUNT]{};
+    float ps[LANE_COUNT]{};
+};
+
+enum
+{
+    COMPARE_EQ,
+    COMPARE_GT,
+    COMPARE_GE,
+    COMPARE_NE
+};
+
+static bool compare(uint32_t comparison, float a, float b)
+{
+    switch (comparison)
+    {
+    case COMPARE_EQ:
+        return a == b;
+    case COMPARE_GT:
+        return a > b;
+    case COMPARE_GE:
+        return a >= b;
+    default:
+        return a != b;
+    }
+}
+
+static bool isLaneActive(LaneMask mask, size_t lane)
+{
+    return ((mask >> lane) & 0x1) != 0;
+}
+
+static void writeLanes(float (&dst)[LANE_COUNT], const float (&src)[LANE_COUNT], LaneMask mask)
+{
+    for (size_t i = 0; i < LANE_COUNT; i++)
+        dst[i] = isLaneActive(mask, i) ? src[i] : dst[i];
+}
+
+static void fillLanes(float (&dst)[LANE_COUNT], float value, LaneMask mask)
+{
+    for (size_t i = 0; i < LANE_COUNT; i++)
+        dst[i] = isLaneActive(mask, i) ? value : dst[i];
+}
+
+static LaneMask getPredicatedLanes(const bool (&p0)[LANE_COUNT], LaneMask mask, bool isPredicated, bool condition)
+{
+    if (!isPredicated)
+        return mask;
+
+    LaneMask predicatedMask = 0;
+    for (size_t i = 0; i < LANE_COUNT; i++)
+    {
+        if (p0[i] == condition)
+            predicatedMask |= LaneMask(1) << i;
+    }
+
+    return mask & predicatedMask;
+}
+
+static float saturate(float value)
+{
+    return std::fmin(std::fmax(value, 0.0f), 1.0f);
+}
+
+static int32_t toAddress(float value)
+{
+    return int32_t(std::fmin(std::fmax(value, -256.0f), 255.0f));
+}
+
+// Writes the fetched components the swizzle selects, and the components it sets to zero or one.
+static void writeFetchResult(float (&dst)[4][LANE_COUNT], uint32_t dstSwizzle, const LaneVector& value, LaneMask mask)
+{
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        auto swizzle = FetchDestinationSwizzle((dstSwizzle >> (i * 3)) & 0x7);
+        switch (swizzle)
+        {
+        case FetchDestinationSwizzle::Zero:
+            fillLanes(dst[i], 0.0f, mask);
+            break;
+        case FetchDestinationSwizzle::One:
+            fillLanes(dst[i], 1.0f, mask);
+            break;
+        case FetchDestinationSwizzle::Keep:
+            break;
+        default:
+            if (swizzle <= FetchDestinationSwizzle::W)
+                writeLanes(dst[i], value.values[uint32_t(swizzle)], mask);
+            break;
+        }
+    }
+}
+
+void ShaderInterpreter::load(const uint8_t* shaderData)
+{
+    const auto shaderContainer = reinterpret_cast<const ShaderContainer*>(shaderData);
+    pixelShader = (shaderContainer->flags & 0x1) == 0;
+
+    const auto constantTableContainer = reinterpret_cast<const ConstantTableContainer*>(shaderData + shaderContainer->constantTableOffset);
+    const auto constantTableData = reinterpret_cast<const uint8_t*>(&constantTableContainer->constantTable);
+
+    for (uint32_t i = 0; i < constantTableContainer->constantTable.constants; i++)
+    {
+        const auto constantInfo = reinterpret_cast<const ConstantInfo*>(
+            constantTableData + constantTableContainer->constantTable.constantInfo + i * sizeof(ConstantInfo));
+
+        if (constantInfo->registerSet == RegisterSet::Float4)
+        {
+            for (uint32_t j = 0; j < constantInfo->registerCount && (constantInfo->registerIndex + j) < std::size(constants); j++)
+            {
+                auto& constant = constants[constantInfo->registerIndex + j];
+                constant.declared = true;
+                constant.registerIndex = constantInfo->registerIndex;
+                constant.registerCount = constantInfo->registerCount;
+            }
+        }
+        else if (constantInfo->registerSet == RegisterSet::Bool)
+        {
+            boolConstants.emplace(constantInfo->registerIndex);
+        }
+    }
+
+    const auto shader = reinterpret_cast<const Shader*>(shaderData + shaderContainer->shaderOffset);
+    const be<uint32_t>* code = reinterpret_cast<const be<uint32_t>*>(shaderData + shaderContainer->virtualSize + shader->physicalOffset);
+
+    if (shaderContainer->definitionTableOffset != NULL)
+    {
+        auto definitionTable = reinterpret_cast<const DefinitionTable*>(shaderData + shaderContainer->definitionTableOffset);
+        auto definitions = definitionTable->definitions;
+        while (*definitions != 0)
+        {
+            auto definition = reinterpret_cast<const Float4Definition*>(definitions);
+            auto value = reinterpret_cast<const be<uint32_t>*>(shaderData + shaderContainer->virtualSize + definition->physicalOffset);
+            for (uint16_t i = 0; i < (definition->count + 3) / 4; i++)
+            {
+                uint32_t reg = definition->registerIndex + i - (pixelShader ? 256 : 0);
+                for (uint32_t j = 0; j < 4 && reg < std::size(constants); j++)
+                {
+                    uint32_t bits = value[j];
+                    memcpy(&constants[reg].literal[j], &bits, sizeof(float));
+                }
+
+                value += 4;
+            }
+            definitions += 2;
+        }
+        ++definitions;
+        while (*definitions != 0)
+        {
+            auto definition = reinterpret_cast<const Int4Definition*>(definitions);
+            for (uint16_t i = 0; i < definition->count; i++)
+                loopCounts[(definition->registerIndex - 8992) / 4 + i] = int8_t(definition->values[i].get() & 0xFF);
+
+            definitions += 2;
+            definitions += definition->count;
+        }
+    }
+
+    uint32_t interpolatorCount = (shader->interpolatorInfo >> 5) & 0x1F;
+
+    if (pixelShader)
+    {
+        positionRegister = (shader->fieldC >> 8) & 0xFF;
+
+        for (uint32_t i = 0; i < interpolatorCount; i++)
+        {
+            union
+            {
+                Interpolator interpolator;
+                uint32_t value;
+            };
+
+            value = reinterpret_cast<const PixelShader*>(shader)->interpolators[i];
+            interpolators.push_back(interpolator);
+        }
+    }
+    else
+    {
+        auto vertexShader = reinterpret_cast<const VertexShader*>(shader);
+
+        for (uint32_t i = 0; i < vertexShader->vertexElementCount; i++)
+        {
+            union
+            {
+                VertexElement vertexElement;
+                uint32_t value;
+            };
+
+            value = vertexShader->vertexElementsAndInterpolators[vertexShader->field18 + i];
+            vertexElements.emplace(uint32_t(vertexElement.address), vertexElement);
+        }
+    }
+
+    controlFlow = decodeControlFlow(code, shader->size);
+
+    for (auto& cfInstr : controlFlow)
+    {
+        ExecBlock execBlock = getExecBlock(cfInstr);
+        auto instructionCode = code + execBlock.address * 3;
+
+        for (uint32_t i = 0; i < execBlock.count; i++)
+        {
+            uint32_t address = execBlock.address + i;
+
+            auto findResult = instructionOverrides.find(address);
+            if (findResult != instructionOverrides.end())
+            {
+                instructions.emplace(address, findResult->second);
+            }
+            else
+            {
+                Instruction instr;
+                instr.code[0] = instructionCode[0];
+                instr.code[1] = instructionCode[1];
+                instr.code[2] = instructionCode[2];
+                instructions.emplace(address, instr);
+            }
+
+            instructionCode += 3;
+        }
+    }
+}
+
+void ShaderInterpreter::run(const ShaderInterpreterInputs& inputs, ShaderInterpreterOutputs& outputs) const
+{
+    outputs = {};
+
+    auto state = std::make_unique<State>();
+    state->inputs = &inputs;
+    state->outputs = &outputs;
+
+    if (pixelShader)
+    {
+        // Interpolators take precedence over the position if they share a register.
+        if (positionRegister < std::size(state->registers) && inputs.fetchPixelPosition)
+        {
+            LaneVector value;
+            inputs.fetchPixelPosition(value);
+            memcpy(state->registers[positionRegister], value.values, sizeof(value.values));
+        }
+
+        for (auto& interpolator : interpolators)
+        {
+            if (inputs.fetchInterpolator)
+            {
+                LaneVector value;
+                inputs.fetchInterpolator(interpolator.usage, interpolator.usageIndex, value);
+                memcpy(state->registers[interpolator.reg], value.values, sizeof(value.values));
+            }
+        }
+    }
+
+    auto getLoopCount = [&](uint32_t loopId)
+        {
+            auto findResult = loopCounts.find(loopId);
+            return findResult != loopCounts.end() ? findResult->second : inputs.loopCounts[loopId];
+        };
+
+    uint32_t pcs[LANE_COUNT]{};
+    LaneMask runningLanes = ALL_LANES;
+
+    for (size_t step = 0; runningLanes != 0 && step < MAX_CONTROL_FLOW_STEPS; step++)
+    {
+        // Lanes that diverged resume from the earliest instruction any of them is at, so they converge
+        // again as soon as they reach the same one.
+        uint32_t pc = ~0u;
+        for (size_t i = 0; i < LANE_COUNT; i++)
+        {
+            if (isLaneActive(runningLanes, i))
+                pc = std::min(pc, pcs[i]);
+        }
+
+        if (pc >= controlFlow.size())
+            break;
+
+        LaneMask mask = 0;
+        for (size_t i = 0; i < LANE_COUNT; i++)
+        {
+            if (isLaneActive(runningLanes, i) && pcs[i] == pc)
+                mask |= LaneMask(1) << i;
+        }
+
+        auto& cfInstr = controlFlow[pc];
+
+        switch (cfInstr.opcode)
+        {
+        case ControlFlowOpcode::LoopStart:
+        {
+            int32_t loopCount = getLoopCount(cfInstr.loopStart.loopId);
+
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                if (isLaneActive(mask, i))
+                {
+                    state->aL[i] = 0;
+                    pcs[i] = loopCount > 0 ? pc + 1 : uint32_t(cfInstr.loopStart.address);
+                }
+            }
+
+            break;
+        }
+
+        case ControlFlowOpcode::LoopEnd:
+        {
+            int32_t loopCount = getLoopCount(cfInstr.loopEnd.loopId);
+
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                if (isLaneActive(mask, i))
+                {
+                    ++state->aL[i];
+                    pcs[i] = state->aL[i] < loopCount ? uint32_t(cfInstr.loopEnd.address) : pc + 1;
+                }
+            }
+
+            break;
+        }
+
+        case ControlFlowOpcode::CondJmp:
+        {
+            // Booleans the shader doesn't declare are false.
+            bool boolValue = boolConstants.find(cfInstr.condJmp.boolAddress) != boolConstants.end() &&
+                ((inputs.booleans >> (cfInstr.condJmp.boolAddress + (pixelShader ? 16 : 0))) & 0x1) != 0;
+
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                if (isLaneActive(mask, i))
+                {
+                    bool taken = cfInstr.condJmp.isUnconditional ||
+                        (cfInstr.condJmp.isPredicated ? state->p0[i] : boolValue) == bool(cfInstr.condJmp.condition);
+
+                    pcs[i] = taken ? uint32_t(cfInstr.condJmp.address) : pc + 1;
+                }
+            }
+
+            break;
+        }
+
+        default:
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                if (isLaneActive(mask, i))
+                    pcs[i] = pc + 1;
+            }
+
+            break;
+        }
+
+        ExecBlock execBlock = getExecBlock(cfInstr);
+        uint32_t sequence = execBlock.sequence;
+
+        for (uint32_t i = 0; i < execBlock.count; i++)
+        {
+            uint32_t address = execBlock.address + i;
+            auto& instr = instructions.at(address);
+
+            if ((sequence & 0x1) != 0)
+            {
+                if (instr.vertexFetch.opcode == FetchOpcode::VertexFetch)
+                    execute(*state, instr.vertexFetch, address, mask);
+                else
+                    execute(*state, instr.textureFetch, mask);
+            }
+            else
+            {
+                execute(*state, instr.alu, address, mask);
+            }
+
+            sequence >>= 2;
+        }
+
+        if (execBlock.shouldReturn)
+            runningLanes &= ~mask;
+    }
+}
+
+void ShaderInterpreter::execute(State& state, const VertexFetchInstruction& instr, uint32_t address, LaneMask mask) const
+{
+    mask = getPredicatedLanes(state.p0, mask, instr.isPredicated, instr.predicateCondition);
+    if (mask == 0)
+        return;
+
+    LaneVector value;
+
+    auto findResult = vertexElements.find(address);
+    if (findResult != vertexElements.end() && state.inputs->fetchVertex)
+        state.inputs->fetchVertex(findResult->second, value);
+
+    writeFetchResult(state.registers[instr.dstRegister], instr.dstSwizzle, value, mask);
+}
+
+void ShaderInterpreter::execute(State& state, const TextureFetchInstruction& instr, LaneMask mask) const
+{
+    if (instr.opcode != FetchOpcode::TextureFetch && instr.opcode != FetchOpcode::GetTextureWeights)
+        return;
+
+    mask = getPredicatedLanes(state.p0, mask, instr.isPredicated, instr.predCondition);
+    if (mask == 0)
+        return;
+
+    uint32_t componentCount = (instr.dimension == TextureDimension::Texture1D) ? 1 : (instr.dimension == TextureDimension::Texture2D) ? 2 : 3;
+
+    LaneVector texCoord;
+    for (uint32_t i = 0; i < componentCount; i++)
+        memcpy(texCoord.values[i], state.registers[instr.srcRegister][(instr.srcSwizzle >> (i * 2)) & 0x3], sizeof(texCoord.values[i]));
+
+    float offset[3]{};
+    if (instr.dimension == TextureDimension::Texture2D || instr.dimension == TextureDimension::Texture3D)
+    {
+        offset[0] = instr.offsetX * 0.5f;
+        offset[1] = instr.offsetY * 0.5f;
+
+        if (instr.dimension == TextureDimension::Texture3D)
+            offset[2] = instr.offsetZ * 0.5f;
+    }
+
+    LaneVector value;
+    if (state.inputs->fetchTexture)
+        state.inputs->fetchTexture(instr.constIndex, instr.dimension, instr.opcode == FetchOpcode::GetTextureWeights, texCoord, offset, value);
+
+    writeFetchResult(state.registers[instr.dstRegister], instr.dstSwizzle, value, mask);
+}
+
+void ShaderInterpreter::readOperand(State& state, uint32_t address, uint32_t reg, bool select, bool relative, bool addressRelative,
+    uint32_t component, LaneMask mask, float (&value)[LANE_COUNT]) const
+{
+    if (select)
+    {
+        memcpy(value, state.registers[reg & 0x3F][component], sizeof(value));
+        return;
+    }
+
+    auto& constant = constants[reg];
+    auto& float4Constants = state.inputs->float4Constants;
+
+    if (!constant.declared)
+    {
+        std::fill(std::begin(value), std::end(value), constant.literal[component]);
+    }
+    else if (relative && constant.registerCount > 1)
+    {
+        const int32_t* indices = addressRelative ? state.a0 : state.aL;
+        bool unchecked = uncheckedConstantAccesses.find(address) != uncheckedConstantAccesses.end();
+        int32_t offset = int32_t(reg - constant.registerIndex);
+        int32_t tailCount = int32_t(pixelShader ? 224 : 256) - int32_t(constant.registerIndex);
+
+        for (size_t i = 0; i < LANE_COUNT; i++)
+        {
+            int32_t index = offset + indices[i];
+            int32_t constantReg = -1;
+
+            if (unchecked)
+            {
+                // Accesses the recompiler proved to be in range are emitted without the checks below.
+                if (index >= 0 && index < int32_t(constant.registerCount))
+                    constantReg = int32_t(constant.registerIndex) + index;
+                else if (isLaneActive(mask, i))
+                    state.outputs->rangeViolations |= LaneMask(1) << i;
+            }
+            else if (index < tailCount)
+            {
+                constantReg = int32_t(constant.registerIndex) + std::min(index, tailCount - 1);
+            }
+
+            value[i] = (constantReg >= 0 && constantReg < int32_t(std::size(constants))) ? float4Constants[constantReg][component] : 0.0f;
+        }
+    }
+    else
+    {
+        std::fill(std::begin(value), std::end(value), float4Constants[reg][component]);
+    }
+}
+
+void ShaderInterpreter::execute(State& state, const AluInstruction& instr, uint32_t address, LaneMask mask) const
+{
+    mask = getPredicatedLanes(state.p0, mask, instr.isPredicated, instr.predicateCondition);
+    if (mask == 0)
+        return;
+
+    auto& outputs = *state.outputs;
+
+    enum
+    {
+        VECTOR_0,
+        VECTOR_1,
+        VECTOR_2,
+        SCALAR_0,
+        SCALAR_1,
+        SCALAR_CONSTANT_0,
+        SCALAR_CONSTANT_1
+    };
+
+    // Reads a single component of an operand, decoded the same way as in the recompiler.
+    auto readComponent = [&](uint32_t operand, uint32_t component, float (&value)[LANE_COUNT])
+        {
+            uint32_t reg = 0;
+            uint32_t swizzle = 0;
+            bool select = true;
+            bool negate = false;
+            bool abs = false;
+
+            switch (operand)
+            {
+            case VECTOR_0:
+                reg = instr.src1Register;
+                swizzle = instr.src1Swizzle;
+                select = instr.src1Select;
+                negate = instr.src1Negate;
+                break;
+            case VECTOR_1:
+                reg = instr.src2Register;
+                swizzle = instr.src2Swizzle;
+                select = instr.src2Select;
+                negate = instr.src2Negate;
+                break;
+            case VECTOR_2:
+            case SCALAR_0:
+            case SCALAR_1:
+                reg = instr.src3Register;
+                swizzle = instr.src3Swizzle;
+                select = instr.src3Select;
+                negate = instr.src3Negate;
+                break;
+            case SCALAR_CONSTANT_0:
+                reg = instr.src3Register;
+                swizzle = instr.src3Swizzle;
+                select = false;
+                negate = instr.src3Negate;
+                break;
+            case SCALAR_CONSTANT_1:
+                reg = (uint32_t(instr.scalarOpcode) & 1) | (instr.src3Select << 1) | (instr.src3Swizzle & 0x3C);
+                swizzle = instr.src3Swizzle;
+                negate = instr.src3Negate;
+                break;
+            }
+
+            if (select && operand != SCALAR_CONSTANT_1)
+            {
+                abs = (reg & 0x80) != 0;
+                reg &= 0x3F;
+            }
+            else
+            {
+                abs = instr.absConstants;
+            }
+
+            switch (operand)
+            {
+            case VECTOR_0:
+            case VECTOR_1:
+            case VECTOR_2:
+                component = ((swizzle >> (component * 2)) + component) & 0x3;
+                break;
+            case SCALAR_0:
+            case SCALAR_CONSTANT_0:
+                component = ((swizzle >> 6) + 3) & 0x3;
+                break;
+            case SCALAR_1:
+            case SCALAR_CONSTANT_1:
+                component = swizzle & 0x3;
+                break;
+            }
+
+            readOperand(state, address, reg, select, instr.const0Relative, instr.constAddressRegisterRelative, component, mask, value);
+
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                float operandValue = abs ? std::fabs(value[i]) : value[i];
+                value[i] = negate ? -operandValue : operandValue;
+            }
+        };
+
+    struct VectorOperand
+    {
+        float values[4][LANE_COUNT]{};
+        uint32_t componentCount = 0;
+    };
+
+    // Reads the components of a vector operand packed together, like the swizzles emitted by the recompiler.
+    auto readVector = [&](uint32_t operand, VectorOperand& value)
+        {
+            uint32_t componentMask;
+
+            switch (instr.vectorOpcode)
+            {
+            case AluVectorOpcode::Dp2Add:
+                componentMask = (operand == VECTOR_2) ? 0b1 : 0b11;
+                break;
+            case AluVectorOpcode::Dp3:
+                componentMask = 0b111;
+                break;
+            case AluVectorOpcode::Dp4:
+            case AluVectorOpcode::Max4:
+                componentMask = 0b1111;
+                break;
+            default:
+                componentMask = instr.vectorWriteMask != 0 ? instr.vectorWriteMask : 0b1;
+                break;
+            }
+
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                if ((componentMask >> i) & 0x1)
+                    readComponent(operand, i, value.values[value.componentCount++]);
+            }
+        };
+
+    if (instr.vectorOpcode >= AluVectorOpcode::KillEq && instr.vectorOpcode <= AluVectorOpcode::KillNe)
+    {
+        VectorOperand v0, v1;
+        readVector(VECTOR_0, v0);
+        readVector(VECTOR_1, v1);
+
+        uint32_t comparison = uint32_t(instr.vectorOpcode) - uint32_t(AluVectorOpcode::KillEq);
+
+        for (size_t i = 0; i < LANE_COUNT; i++)
+        {
+            bool kill = false;
+            for (uint32_t j = 0; j < v0.componentCount; j++)
+                kill |= compare(comparison, v0.values[j][i], v1.values[j][i]);
+
+            if (kill && isLaneActive(mask, i))
+                outputs.killedLanes |= LaneMask(1) << i;
+        }
+    }
+
+    // Export registers the recompiler doesn't know about are written to temporary registers instead.
+    bool isExport = false;
+    bool isDepthExport = false;
+
+    if (instr.exportData)
+    {
+        if (pixelShader)
+        {
+            switch (ExportRegister(instr.vectorDest))
+            {
+            case ExportRegister::PSColor0:
+            case ExportRegister::PSColor1:
+            case ExportRegister::PSColor2:
+            case ExportRegister::PSColor3:
+                isExport = true;
+                break;
+            case ExportRegister::PSDepth:
+                isExport = true;
+                isDepthExport = true;
+                break;
+            }
+        }
+        else
+        {
+            isExport = true;
+        }
+    }
+
+    if (instr.vectorOpcode >= AluVectorOpcode::SetpEqPush && instr.vectorOpcode <= AluVectorOpcode::SetpGePush)
+    {
+        VectorOperand v0, v1;
+        readVector(VECTOR_0, v0);
+        readVector(VECTOR_1, v1);
+
+        static constexpr uint32_t COMPARISONS[] = { COMPARE_EQ, COMPARE_NE, COMPARE_GT, COMPARE_GE };
+        uint32_t comparison = COMPARISONS[uint32_t(instr.vectorOpcode) - uint32_t(AluVectorOpcode::SetpEqPush)];
+
+        for (size_t i = 0; i < LANE_COUNT; i++)
+        {
+            if (isLaneActive(mask, i))
+                state.p0[i] = v0.values[0][i] == 0.0f && compare(comparison, v1.values[0][i], 0.0f);
+        }
+    }
+    else if (instr.vectorOpcode >= AluVectorOpcode::MaxA)
+    {
+        float w[LANE_COUNT];
+        readComponent(VECTOR_0, 3, w);
+
+        for (size_t i = 0; i < LANE_COUNT; i++)
+        {
+            if (isLaneActive(mask, i))
+                state.a0[i] = toAddress(std::floor(w[i] + 0.5f));
+        }
+    }
+
+    uint32_t vectorWriteMask = instr.vectorWriteMask;
+    if (instr.exportData)
+        vectorWriteMask &= ~instr.scalarWriteMask;
+
+    auto& vectorDest = isExport ? outputs.exports[instr.vectorDest].values : state.registers[instr.vectorDest];
+
+    if (vectorWriteMask != 0)
+    {
+        VectorOperand v0, v1, v2;
+        float result[4][LANE_COUNT]{};
+        uint32_t resultCount = 0;
+
+        auto forEachResult = [&](uint32_t count, const auto& function)
+            {
+                resultCount = count;
+
+                for (uint32_t j = 0; j < count; j++)
+                {
+                    for (size_t i = 0; i < LANE_COUNT; i++)
+                        result[j][i] = function(j, i);
+                }
+            };
+
+        switch (instr.vectorOpcode)
+        {
+        case AluVectorOpcode::Frc:
+        case AluVectorOpcode::Trunc:
+        case AluVectorOpcode::Floor:
+        case AluVectorOpcode::Cube:
+        case AluVectorOpcode::Max4:
+        case AluVectorOpcode::SetpEqPush:
+        case AluVectorOpcode::SetpNePush:
+        case AluVectorOpcode::SetpGtPush:
+        case AluVectorOpcode::SetpGePush:
+            readVector(VECTOR_0, v0);
+            break;
+
+        case AluVectorOpcode::Mad:
+        case AluVectorOpcode::CndEq:
+        case AluVectorOpcode::CndGe:
+        case AluVectorOpcode::CndGt:
+        case AluVectorOpcode::Dp2Add:
+            readVector(VECTOR_0, v0);
+            readVector(VECTOR_1, v1);
+            readVector(VECTOR_2, v2);
+            break;
+
+        default:
+            readVector(VECTOR_0, v0);
+            readVector(VECTOR_1, v1);
+            break;
+        }
+
+        switch (instr.vectorOpcode)
+        {
+        case AluVectorOpcode::Add:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return v0.values[j][i] + v1.values[j][i]; });
+            break;
+
+        case AluVectorOpcode::Mul:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return v0.values[j][i] * v1.values[j][i]; });
+            break;
+
+        case AluVectorOpcode::Max:
+        case AluVectorOpcode::MaxA:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return std::fmax(v0.values[j][i], v1.values[j][i]); });
+            break;
+
+        case AluVectorOpcode::Min:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return std::fmin(v0.values[j][i], v1.values[j][i]); });
+            break;
+
+        case AluVectorOpcode::Seq:
+        case AluVectorOpcode::Sgt:
+        case AluVectorOpcode::Sge:
+        case AluVectorOpcode::Sne:
+        {
+            uint32_t comparison = uint32_t(instr.vectorOpcode) - uint32_t(AluVectorOpcode::Seq);
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return compare(comparison, v0.values[j][i], v1.values[j][i]) ? 1.0f : 0.0f; });
+            break;
+        }
+
+        case AluVectorOpcode::Frc:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return v0.values[j][i] - std::floor(v0.values[j][i]); });
+            break;
+
+        case AluVectorOpcode::Trunc:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return std::trunc(v0.values[j][i]); });
+            break;
+
+        case AluVectorOpcode::Floor:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return std::floor(v0.values[j][i]); });
+            break;
+
+        case AluVectorOpcode::Mad:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return v0.values[j][i] * v1.values[j][i] + v2.values[j][i]; });
+            break;
+
+        case AluVectorOpcode::CndEq:
+            forEachResult(v1.componentCount, [&](uint32_t j, size_t i) { return v0.values[j][i] == 0.0f ? v1.values[j][i] : v2.values[j][i]; });
+            break;
+
+        case AluVectorOpcode::CndGe:
+            forEachResult(v1.componentCount, [&](uint32_t j, size_t i) { return v0.values[j][i] >= 0.0f ? v1.values[j][i] : v2.values[j][i]; });
+            break;
+
+        case AluVectorOpcode::CndGt:
+            forEachResult(v1.componentCount, [&](uint32_t j, size_t i) { return v0.values[j][i] > 0.0f ? v1.values[j][i] : v2.values[j][i]; });
+            break;
+
+        case AluVectorOpcode::Dp4:
+        case AluVectorOpcode::Dp3:
+            forEachResult(1, [&](uint32_t, size_t i)
+                {
+                    float sum = 0.0f;
+                    for (uint32_t j = 0; j < v0.componentCount; j++)
+                        sum += v0.values[j][i] * v1.values[j][i];
+
+                    return sum;
+                });
+            break;
+
+        case AluVectorOpcode::Dp2Add:
+            forEachResult(1, [&](uint32_t, size_t i) { return v0.values[0][i] * v1.values[0][i] + v0.values[1][i] * v1.values[1][i] + v2.values[0][i]; });
+            break;
+
+        case AluVectorOpcode::Cube:
+            resultCount = 4;
+
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                float x = v0.values[2][i];
+                float y = v0.values[3][i];
+                float z = v0.values[0][i];
+                float tc, sc, ma, id;
+
+                if (std::fabs(z) >= std::fabs(x) && std::fabs(z) >= std::fabs(y))
+                {
+                    tc = -y;
+                    sc = z < 0.0f ? -x : x;
+                    ma = 2.0f * z;
+                    id = z < 0.0f ? 5.0f : 4.0f;
+                }
+                else if (std::fabs(y) >= std::fabs(x))
+                {
+                    tc = y < 0.0f ? -z : z;
+                    sc = x;
+                    ma = 2.0f * y;
+                    id = y < 0.0f ? 3.0f : 2.0f;
+                }
+                else
+                {
+                    tc = -y;
+                    sc = x < 0.0f ? z : -z;
+                    ma = 2.0f * x;
+                    id = x < 0.0f ? 1.0f : 0.0f;
+                }
+
+                result[0][i] = tc;
+                result[1][i] = sc;
+                result[2][i] = ma;
+                result[3][i] = id;
+            }
+
+            break;
+
+        case AluVectorOpcode::Max4:
+            forEachResult(4, [&](uint32_t, size_t i)
+                {
+                    return std::fmax(std::fmax(v0.values[0][i], v0.values[1][i]), std::fmax(v0.values[2][i], v0.values[3][i]));
+                });
+            break;
+
+        case AluVectorOpcode::SetpEqPush:
+        case AluVectorOpcode::SetpNePush:
+        case AluVectorOpcode::SetpGtPush:
+        case AluVectorOpcode::SetpGePush:
+            forEachResult(v0.componentCount, [&](uint32_t j, size_t i) { return state.p0[i] ? 0.0f : v0.values[j][i] + 1.0f; });
+            break;
+
+        case AluVectorOpcode::KillEq:
+        case AluVectorOpcode::KillGt:
+        case AluVectorOpcode::KillGe:
+        case AluVectorOpcode::KillNe:
+        {
+            uint32_t comparison = uint32_t(instr.vectorOpcode) - uint32_t(AluVectorOpcode::KillEq);
+            forEachResult(1, [&](uint32_t, size_t i)
+                {
+                    bool any = false;
+                    for (uint32_t j = 0; j < v0.componentCount; j++)
+                        any |= compare(comparison, v0.values[j][i], v1.values[j][i]);
+
+                    return any ? 1.0f : 0.0f;
+                });
+            break;
+        }
+
+        case AluVectorOpcode::Dst:
+            forEachResult(4, [&](uint32_t j, size_t i)
+                {
+                    switch (j)
+                    {
+                    case 0:
+                        return 1.0f;
+                    case 1:
+                        return v0.values[1][i] * v1.values[1][i];
+                    case 2:
+                        return v0.values[2][i];
+                    default:
+                        return v1.values[3][i];
+                    }
+                });
+            break;
+        }
+
+        if (instr.vectorSaturate)
+        {
+            for (uint32_t j = 0; j < resultCount; j++)
+            {
+                for (size_t i = 0; i < LANE_COUNT; i++)
+                    result[j][i] = saturate(result[j][i]);
+            }
+        }
+
+        // Single component results are broadcast, and the rest are truncated to the written components.
+        uint32_t resultIndex = 0;
+
+        for (uint32_t j = 0; j < 4; j++)
+        {
+            if ((vectorWriteMask >> j) & 0x1)
+            {
+                writeLanes(vectorDest[isDepthExport ? 0 : j], result[resultCount == 1 ? 0 : resultIndex], mask);
+                ++resultIndex;
+            }
+        }
+    }
+
+    if (instr.scalarOpcode != AluScalarOpcode::RetainPrev)
+    {
+        float s0[LANE_COUNT]{};
+        float s1[LANE_COUNT]{};
+
+        switch (instr.scalarOpcode)
+        {
+        case AluScalarOpcode::Adds:
+        case AluScalarOpcode::Muls:
+        case AluScalarOpcode::Maxs:
+        case AluScalarOpcode::MaxAs:
+        case AluScalarOpcode::MaxAsf:
+        case AluScalarOpcode::Mins:
+        case AluScalarOpcode::Subs:
+            readComponent(SCALAR_0, 0, s0);
+            readComponent(SCALAR_1, 0, s1);
+            break;
+
+        case AluScalarOpcode::Mulsc0:
+        case AluScalarOpcode::Mulsc1:
+        case AluScalarOpcode::Addsc0:
+        case AluScalarOpcode::Addsc1:
+        case AluScalarOpcode::Subsc0:
+        case AluScalarOpcode::Subsc1:
+            readComponent(SCALAR_CONSTANT_0, 0, s0);
+            readComponent(SCALAR_CONSTANT_1, 0, s1);
+            break;
+
+        case AluScalarOpcode::SetpClr:
+            break;
+
+        default:
+            readComponent(SCALAR_0, 0, s0);
+            break;
+        }
+
+        if (instr.scalarOpcode >= AluScalarOpcode::SetpEq && instr.scalarOpcode <= AluScalarOpcode::SetpRstr)
+        {
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                bool p0;
+
+                switch (instr.scalarOpcode)
+                {
+                case AluScalarOpcode::SetpEq:
+                case AluScalarOpcode::SetpRstr:
+                    p0 = s0[i] == 0.0f;
+                    break;
+                case AluScalarOpcode::SetpNe:
+                    p0 = s0[i] != 0.0f;
+                    break;
+                case AluScalarOpcode::SetpGt:
+                    p0 = s0[i] > 0.0f;
+                    break;
+                case AluScalarOpcode::SetpGe:
+                    p0 = s0[i] >= 0.0f;
+                    break;
+                case AluScalarOpcode::SetpInv:
+                    p0 = s0[i] == 1.0f;
+                    break;
+                case AluScalarOpcode::SetpPop:
+                    p0 = s0[i] - 1.0f <= 0.0f;
+                    break;
+                default:
+                    p0 = false;
+                    break;
+                }
+
+                if (isLaneActive(mask, i))
+                    state.p0[i] = p0;
+            }
+        }
+
+        // Operands of clamps the recompiler removed must stay in the range it proved.
+        auto clampRange = clampRanges.find(address);
+        if (clampRange != clampRanges.end())
+        {
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                if (isLaneActive(mask, i) && !(s0[i] >= clampRange->second.min && s0[i] <= clampRange->second.max))
+                    outputs.rangeViolations |= LaneMask(1) << i;
+            }
+        }
+
+        auto clampToFinite = [](float value)
+            {
+                return std::fmin(std::fmax(value, -std::numeric_limits<float>::max()), std::numeric_limits<float>::max());
+            };
+
+        float result[LANE_COUNT];
+
+        for (size_t i = 0; i < LANE_COUNT; i++)
+        {
+            float a = s0[i];
+            float b = s1[i];
+            float ps = state.ps[i];
+            bool p0 = state.p0[i];
+
+            switch (instr.scalarOpcode)
+            {
+            case AluScalarOpcode::Adds:
+            case AluScalarOpcode::Addsc0:
+            case AluScalarOpcode::Addsc1:
+                result[i] = a + b;
+                break;
+            case AluScalarOpcode::AddsPrev:
+                result[i] = a + ps;
+                break;
+            case AluScalarOpcode::Muls:
+            case AluScalarOpcode::Mulsc0:
+            case AluScalarOpcode::Mulsc1:
+                result[i] = a * b;
+                break;
+            case AluScalarOpcode::MulsPrev:
+            case AluScalarOpcode::MulsPrev2:
+                result[i] = a * ps;
+                break;
+            case AluScalarOpcode::Maxs:
+            case AluScalarOpcode::MaxAs:
+            case AluScalarOpcode::MaxAsf:
+                result[i] = std::fmax(a, b);
+                break;
+            case AluScalarOpcode::Mins:
+                result[i] = std::fmin(a, b);
+                break;
+            case AluScalarOpcode::Seqs:
+            case AluScalarOpcode::KillsEq:
+                result[i] = a == 0.0f ? 1.0f : 0.0f;
+                break;
+            case AluScalarOpcode::Sgts:
+            case AluScalarOpcode::KillsGt:
+                result[i] = a > 0.0f ? 1.0f : 0.0f;
+                break;
+            case AluScalarOpcode::Sges:
+            case AluScalarOpcode::KillsGe:
+                result[i] = a >= 0.0f ? 1.0f : 0.0f;
+                break;
+            case AluScalarOpcode::Snes:
+            case AluScalarOpcode::KillsNe:
+                result[i] = a != 0.0f ? 1.0f : 0.0f;
+                break;
+            case AluScalarOpcode::KillsOne:
+                result[i] = a == 1.0f ? 1.0f : 0.0f;
+                break;
+            case AluScalarOpcode::Frcs:
+                result[i] = a - std::floor(a);
+                break;
+            case AluScalarOpcode::Truncs:
+                result[i] = std::trunc(a);
+                break;
+            case AluScalarOpcode::Floors:
+                result[i] = std::floor(a);
+                break;
+            case AluScalarOpcode::Exp:
+                result[i] = std::exp2(a);
+                break;
+            case AluScalarOpcode::Logc:
+            case AluScalarOpcode::Log:
+                result[i] = clampToFinite(std::log2(a));
+                break;
+            case AluScalarOpcode::Rcpc:
+            case AluScalarOpcode::Rcpf:
+            case AluScalarOpcode::Rcp:
+                result[i] = clampToFinite(1.0f / a);
+                break;
+            case AluScalarOpcode::Rsqc:
+            case AluScalarOpcode::Rsqf:
+            case AluScalarOpcode::Rsq:
+                result[i] = clampToFinite(1.0f / std::sqrt(a));
+                break;
+            case AluScalarOpcode::Subs:
+            case AluScalarOpcode::Subsc0:
+            case AluScalarOpcode::Subsc1:
+                result[i] = a - b;
+                break;
+            case AluScalarOpcode::SubsPrev:
+                result[i] = a - ps;
+                break;
+            case AluScalarOpcode::SetpEq:
+            case AluScalarOpcode::SetpNe:
+            case AluScalarOpcode::SetpGt:
+            case AluScalarOpcode::SetpGe:
+                result[i] = p0 ? 0.0f : 1.0f;
+                break;
+            case AluScalarOpcode::SetpInv:
+                result[i] = p0 ? 0.0f : a == 0.0f ? 1.0f : a;
+                break;
+            case AluScalarOpcode::SetpPop:
+                result[i] = p0 ? 0.0f : a - 1.0f;
+                break;
+            case AluScalarOpcode::SetpClr:
+                result[i] = std::numeric_limits<float>::max();
+                break;
+            case AluScalarOpcode::SetpRstr:
+                result[i] = p0 ? 0.0f : a;
+                break;
+            case AluScalarOpcode::Sqrt:
+                result[i] = std::sqrt(a);
+                break;
+            case AluScalarOpcode::Sin:
+                result[i] = std::sin(a);
+                break;
+            case AluScalarOpcode::Cos:
+                result[i] = std::cos(a);
+                break;
+            default:
+                result[i] = ps;
+                break;
+            }
+
+            if (instr.scalarSaturate)
+                result[i] = saturate(result[i]);
+        }
+
+        writeLanes(state.ps, result, mask);
+
+        if (instr.scalarOpcode == AluScalarOpcode::MaxAs || instr.scalarOpcode == AluScalarOpcode::MaxAsf)
+        {
+            float rounding = (instr.scalarOpcode == AluScalarOpcode::MaxAs) ? 0.5f : 0.0f;
+
+            for (size_t i = 0; i < LANE_COUNT; i++)
+            {
+                if (isLaneActive(mask, i))
+                    state.a0[i] = toAddress(std::floor(s0[i] + rounding));
+            }
+        }
+    }
+
+    uint32_t scalarWriteMask = instr.scalarWriteMask;
+    if (instr.exportData)
+        scalarWriteMask &= ~instr.vectorWriteMask;
+
+    auto& scalarDest = isExport ? outputs.exports[instr.vectorDest].values : state.registers[instr.scalarDest];
+
+    for (uint32_t j = 0; j < 4; j++)
+    {
+        if ((scalarWriteMask >> j) & 0x1)
+            writeLanes(scalarDest[isDepthExport ? 0 : j], state.ps, mask);
+    }
+
+    if (isExport)
+    {
+        uint32_t zeroMask = instr.scalarDestRelative ? (0b1111 & ~(instr.vectorWriteMask | instr.scalarWriteMask)) : 0;
+        uint32_t oneMask = instr.vectorWriteMask & instr.scalarWriteMask;
+
+        for (uint32_t j = 0; j < 4; j++)
+        {
+            if ((zeroMask >> j) & 0x1)
+                fillLanes(vectorDest[j], 0.0f, mask);
+            else if ((oneMask >> j) & 0x1)
+                fillLanes(vectorDest[j], 1.0f, mask);
+        }
+    }
+
+    if (instr.scalarOpcode >= AluScalarOpcode::KillsEq && instr.scalarOpcode <= AluScalarOpcode::KillsOne)
+    {
+        for (size_t i = 0; i < LANE_COUNT; i++)
+        {
+            if (isLaneActive(mask, i) && state.ps[i] != 0.0f)
+                outputs.killedLanes |= LaneMask(1) << i;
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "shader_recompiler.h"
+
+#include <functional>
+#include <unordered_set>
+
+// Number of vertices or pixels evaluated together. Registers are stored one component of every lane
+// after another, so each operation is a loop over the lanes the compiler can vectorize.
+static constexpr size_t INTERPRETER_LANE_COUNT = 16;
+
+using LaneMask = uint32_t;
+static_assert(INTERPRETER_LANE_COUNT <= sizeof(LaneMask) * 8);
+
+static constexpr LaneMask ALL_LANES = LaneMask((1ull << INTERPRETER_LANE_COUNT) - 1);
+
+struct LaneVector
+{
+    float values[4][INTERPRETER_LANE_COUNT]{};
+};
+
+struct ShaderInterpreterInputs
+{
+    // Float4 constant registers shared by every lane. Registers the shader defines literals for without declaring them use the literals instead.
+    float float4Constants[256][4]{};
+
+    // g_Booleans, the bits of pixel shaders starting at 16.
+    uint32_t booleans = 0;
+
+    // Trip counts of loops using integer constants the shader doesn't define.
+    int32_t loopCounts[32]{};
+
+    // Vertex shaders: the vertex element fetched for every lane, with any component swapping already applied.
+    std::function<void(const VertexElement& element, LaneVector& value)> fetchVertex;
+
+    // Pixel shaders: the interpolated value of every lane.
+    std::function<void(DeclUsage usage, uint32_t usageIndex, LaneVector& value)> fetchInterpolator;
+
+    // Pixel shaders: the position register of every lane, (position - 0.5) with x negated for back faces.
+    std::function<void(LaneVector& value)> fetchPixelPosition;
+
+    // The texture sample of every lane, or the filtering weights when requested by GetTextureWeights.
+    std::function<void(uint32_t samplerIndex, TextureDimension dimension, bool weights, const LaneVector& texCoord,
+        const float (&offset)[3], LaneVector& value)> fetchTexture;
+};
+
+struct ShaderInterpreterOutputs
+{
+    // Indexed by export register, interpolators and position for vertex shaders, colors and depth for pixel shaders.
+    LaneVector exports[64];
+
+    // Lanes discarded by kill instructions.
+    LaneMask killedLanes = 0;
+
+    // Lanes where a clamp or bounds check the recompiler removed would have been needed.
+    LaneMask rangeViolations = 0;
+};
+
+// Evaluates Xenos microcode on the CPU the way the recompiled shader does, serving as a reference
+// the output of recompiler transformations can be compared against without a GPU.
+class ShaderInterpreter
+{
+public:
+    // Instructions replacing the ones in the shader by address, such as the ones recompiled for a linked shader pair.
+    std::unordered_map<uint32_t, Instruction> instructionOverrides;
+
+    // Ranges the recompiler proved for the operands of the clamps it removed, by instruction address.
+    std::unordered_map<uint32_t, ValueRange> clampRanges;
+
+    // Addresses of instructions the recompiler emitted relative constant accesses without bounds checks for.
+    std::unordered_set<uint32_t> uncheckedConstantAccesses;
+
+    // Decodes the shader. Overrides must be set before this.
+    void load(const uint8_t* shaderData);
+
+    bool isPixelShader() const
+    {
+        return pixelShader;
+    }
+
+    void run(const ShaderInterpreterInputs& inputs, ShaderInterpreterOutputs& outputs) const;
+
+private:
+    struct ConstantRegister
+    {
+        bool declared = false;
+        uint32_t registerIndex = 0;
+        uint32_t registerCount = 0;
+        float literal[4]{};
+    };
+
+    bool pixelShader = false;
+    uint32_t positionRegister = ~0u;
+    std::vector<ControlFlowInstruction> controlFlow;
+    std::unordered_map<uint32_t, Instruction> instructions;
+    std::unordered_map<uint32_t, VertexElement> vertexElements;
+    std::vector<Interpolator> interpolators;
+    ConstantRegister constants[256];
+    std::unordered_set<uint32_t> boolConstants;
+    std::unordered_map<uint32_t, int32_t> loopCounts;
+
+    struct State;
+
+    void readOperand(State& state, uint32_t address, uint32_t reg, bool select, bool relative, bool addressRelative,
+        uint32_t component, LaneMask mask, float (&value)[INTERPRETER_LANE_COUNT]) const;
+    void execute(State& state, const VertexFetchInstruction& instr, uint32_t address, LaneMask mask) const;
+    void execute(State& state, const TextureFetchInstruction& instr, LaneMask mask) const;
+    void execute(State& state, const AluInstruction& instr, uint32_t address, LaneMask mask) const;
+};
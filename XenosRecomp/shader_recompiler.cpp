@@ -128,9 +128,1223 @@ static constexpr std::string_view TEXTURE_DIMENSIONS[] =
     "Cube" 
 };
 
+// Vertex fetch format of four 8-bit components.
+static constexpr uint32_t VERTEX_FORMAT_8_8_8_8 = 6;
+
 static FetchDestinationSwizzle getDestSwizzle(uint32_t dstSwizzle, uint32_t index)
 {
-    return FetchDestinationSwizzle((dstSwizzle >> (index * 3)) & 0x7);
+    return FetchDestinationSwizzle((dstSwizzle >> (index * 3)) & 0x7);
+}
+
+ExecBlock getExecBlock(const ControlFlowInstruction& cfInstr)
+{
+    ExecBlock execBlock;
+
+    switch (cfInstr.opcode)
+    {
+    case ControlFlowOpcode::Exec:
+    case ControlFlowOpcode::ExecEnd:
+        execBlock.address = cfInstr.exec.address;
+        execBlock.count = cfInstr.exec.count;
+        execBlock.sequence = cfInstr.exec.sequence;
+        execBlock.shouldReturn = (cfInstr.opcode == ControlFlowOpcode::ExecEnd);
+        break;
+
+    case ControlFlowOpcode::CondExec:
+    case ControlFlowOpcode::CondExecEnd:
+    case ControlFlowOpcode::CondExecPredClean:
+    case ControlFlowOpcode::CondExecPredCleanEnd:
+        execBlock.address = cfInstr.condExec.address;
+        execBlock.count = cfInstr.condExec.count;
+        execBlock.sequence = cfInstr.condExec.sequence;
+        execBlock.shouldReturn = (cfInstr.opcode == ControlFlowOpcode::CondExecEnd || cfInstr.opcode == ControlFlowOpcode::CondExecEnd);
+        break;
+
+    case ControlFlowOpcode::CondExecPred:
+    case ControlFlowOpcode::CondExecPredEnd:
+        execBlock.address = cfInstr.condExecPred.address;
+        execBlock.count = cfInstr.condExecPred.count;
+        execBlock.sequence = cfInstr.condExecPred.sequence;
+        execBlock.shouldReturn = (cfInstr.opcode == ControlFlowOpcode::CondExecPredEnd);
+        break;
+    }
+
+    return execBlock;
+}
+
+std::vector<ControlFlowInstruction> decodeControlFlow(const be<uint32_t>* code, uint32_t size)
+{
+    std::vector<ControlFlowInstruction> controlFlow;
+
+    auto controlFlowCode = code;
+    uint32_t instrAddress = 0;
+
+    while (instrAddress < size)
+    {
+        const uint32_t words[] =
+        {
+            controlFlowCode[0],
+            controlFlowCode[1] & 0xFFFF,
+            (controlFlowCode[1] >> 16) | (controlFlowCode[2] << 16),
+            controlFlowCode[2] >> 16
+        };
+
+        ControlFlowInstruction pair[2];
+        static_assert(sizeof(pair) == sizeof(words));
+        memcpy(pair, words, sizeof(pair));
+
+        for (auto& cfInstr : pair)
+        {
+            uint32_t address = getExecBlock(cfInstr).address;
+            if (address != 0)
+                size = std::min<uint32_t>(size, address * 12);
+
+            controlFlow.push_back(cfInstr);
+        }
+
+        controlFlowCode += 3;
+        instrAddress += 12;
+    }
+
+    return controlFlow;
+}
+
+template<typename T>
+static void forEachInstruction(const be<uint32_t>* code, const std::vector<ControlFlowInstruction>& controlFlow, const T& function)
+{
+    for (auto& cfInstr : controlFlow)
+    {
+        ExecBlock execBlock = getExecBlock(cfInstr);
+        auto instructionCode = code + execBlock.address * 3;
+
+        for (uint32_t i = 0; i < execBlock.count; i++)
+        {
+            Instruction instr;
+            instr.code[0] = instructionCode[0];
+            instr.code[1] = instructionCode[1];
+            instr.code[2] = instructionCode[2];
+
+            function(instr, ((execBlock.sequence >> (i * 2)) & 0x1) != 0, execBlock.address + i);
+
+            instructionCode += 3;
+        }
+    }
+}
+
+static uint32_t getVectorOperandCount(AluVectorOpcode opcode)
+{
+    switch (opcode)
+    {
+    case AluVectorOpcode::Frc:
+    case AluVectorOpcode::Trunc:
+    case AluVectorOpcode::Floor:
+    case AluVectorOpcode::Cube:
+    case AluVectorOpcode::Max4:
+        return 1;
+
+    case AluVectorOpcode::Mad:
+    case AluVectorOpcode::CndEq:
+    case AluVectorOpcode::CndGe:
+    case AluVectorOpcode::CndGt:
+    case AluVectorOpcode::Dp2Add:
+        return 3;
+
+    default:
+        return 2;
+    }
+}
+
+static bool usesScalarOperand1(AluScalarOpcode opcode)
+{
+    switch (opcode)
+    {
+    case AluScalarOpcode::Adds:
+    case AluScalarOpcode::Muls:
+    case AluScalarOpcode::Maxs:
+    case AluScalarOpcode::MaxAs:
+    case AluScalarOpcode::MaxAsf:
+    case AluScalarOpcode::Mins:
+    case AluScalarOpcode::Subs:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Calls the function with every temporary register the vector operation reads and the mask of components read from it.
+template<typename T>
+static void forEachVectorSourceRegister(const AluInstruction& instr, const T& function)
+{
+    const uint32_t registers[] = { instr.src1Register, instr.src2Register, instr.src3Register };
+    const uint32_t swizzles[] = { instr.src1Swizzle, instr.src2Swizzle, instr.src3Swizzle };
+    const bool selects[] = { bool(instr.src1Select), bool(instr.src2Select), bool(instr.src3Select) };
+
+    for (uint32_t i = 0; i < getVectorOperandCount(instr.vectorOpcode); i++)
+    {
+        if (!selects[i])
+            continue;
+
+        uint32_t mask;
+
+        switch (instr.vectorOpcode)
+        {
+        case AluVectorOpcode::Dp2Add:
+            mask = (i == 2) ? 0b1 : 0b11;
+            break;
+
+        case AluVectorOpcode::Dp3:
+            mask = 0b111;
+            break;
+
+        case AluVectorOpcode::Dp4:
+        case AluVectorOpcode::Max4:
+            mask = 0b1111;
+            break;
+
+        default:
+            mask = instr.vectorWriteMask != 0 ? instr.vectorWriteMask : 0b1;
+            break;
+        }
+
+        uint32_t componentMask = 0;
+        for (uint32_t j = 0; j < 4; j++)
+        {
+            if ((mask >> j) & 0x1)
+                componentMask |= 1 << (((swizzles[i] >> (j * 2)) + j) & 0x3);
+        }
+
+        function(registers[i] & 0x3F, componentMask);
+    }
+}
+
+template<typename T>
+static void forEachScalarSourceRegister(const AluInstruction& instr, const T& function)
+{
+    switch (instr.scalarOpcode)
+    {
+    case AluScalarOpcode::RetainPrev:
+    case AluScalarOpcode::SetpClr:
+        break;
+
+    case AluScalarOpcode::Mulsc0:
+    case AluScalarOpcode::Mulsc1:
+    case AluScalarOpcode::Addsc0:
+    case AluScalarOpcode::Addsc1:
+    case AluScalarOpcode::Subsc0:
+    case AluScalarOpcode::Subsc1:
+        function((uint32_t(instr.scalarOpcode) & 1) | (instr.src3Select << 1) | (instr.src3Swizzle & 0x3C), 1u << (instr.src3Swizzle & 0x3));
+        break;
+
+    default:
+        if (instr.src3Select)
+        {
+            uint32_t componentMask = 1 << (((instr.src3Swizzle >> 6) + 3) & 0x3);
+            if (usesScalarOperand1(instr.scalarOpcode))
+                componentMask |= 1 << (instr.src3Swizzle & 0x3);
+
+            function(instr.src3Register & 0x3F, componentMask);
+        }
+        break;
+    }
+}
+
+template<typename T>
+static void forEachSourceRegister(const AluInstruction& instr, const T& function)
+{
+    forEachVectorSourceRegister(instr, function);
+    forEachScalarSourceRegister(instr, function);
+}
+
+static uint32_t getSourceComponentMask(const TextureFetchInstruction& instr)
+{
+    uint32_t componentCount = (instr.dimension == TextureDimension::Texture1D) ? 1 : (instr.dimension == TextureDimension::Texture2D ? 2 : 3);
+    uint32_t componentMask = 0;
+
+    for (uint32_t i = 0; i < componentCount; i++)
+        componentMask |= 1 << ((instr.srcSwizzle >> (i * 2)) & 0x3);
+
+    return componentMask;
+}
+
+static size_t findInterpolator(DeclUsage usage, uint32_t usageIndex)
+{
+    for (size_t i = 0; i < std::size(INTERPOLATORS); i++)
+    {
+        if (INTERPOLATORS[i].first == usage && INTERPOLATORS[i].second == usageIndex)
+            return i;
+    }
+
+    return std::size(INTERPOLATORS);
+}
+
+// Maps pixel shader registers or vertex shader export registers to INTERPOLATORS indices.
+static void getInterpolatorIndices(const Shader* shader, bool isPixelShader, size_t (&interpolatorIndices)[32])
+{
+    std::fill(std::begin(interpolatorIndices), std::end(interpolatorIndices), std::size(INTERPOLATORS));
+
+    uint32_t interpolatorCount = (shader->interpolatorInfo >> 5) & 0x1F;
+
+    for (uint32_t i = 0; i < interpolatorCount; i++)
+    {
+        union
+        {
+            Interpolator interpolator;
+            uint32_t value;
+        };
+
+        if (isPixelShader)
+        {
+            value = reinterpret_cast<const PixelShader*>(shader)->interpolators[i];
+            interpolatorIndices[interpolator.reg] = findInterpolator(interpolator.usage, interpolator.usageIndex);
+        }
+        else
+        {
+            auto vertexShader = reinterpret_cast<const VertexShader*>(shader);
+            value = vertexShader->vertexElementsAndInterpolators[vertexShader->field18 + vertexShader->vertexElementCount + i];
+            interpolatorIndices[i] = findInterpolator(interpolator.usage, interpolator.usageIndex);
+        }
+    }
+}
+
+// Finds the interpolator components a vertex shader exports or a pixel shader reads. Reads are
+// tracked per register over the whole shader, so a register that gets overwritten before it's read
+// still keeps its interpolator components alive.
+static void getInterpolatorMasks(const Shader* shader, bool isPixelShader, const be<uint32_t>* code, uint32_t (&interpolatorMasks)[std::size(INTERPOLATORS)])
+{
+    size_t interpolatorIndices[32];
+    getInterpolatorIndices(shader, isPixelShader, interpolatorIndices);
+
+    auto markInterpolator = [&](uint32_t index, uint32_t componentMask)
+        {
+            if (index < std::size(interpolatorIndices) && interpolatorIndices[index] != std::size(INTERPOLATORS))
+                interpolatorMasks[interpolatorIndices[index]] |= componentMask;
+        };
+
+    forEachInstruction(code, decodeControlFlow(code, shader->size), [&](const Instruction& instr, bool isFetch, uint32_t)
+        {
+            if (isPixelShader)
+            {
+                if (!isFetch)
+                    forEachSourceRegister(instr.alu, markInterpolator);
+                else if (instr.vertexFetch.opcode != FetchOpcode::VertexFetch)
+                    markInterpolator(instr.textureFetch.srcRegister, getSourceComponentMask(instr.textureFetch));
+            }
+            else if (!isFetch && instr.alu.exportData && instr.alu.vectorDest <= uint32_t(ExportRegister::VSInterpolator15))
+            {
+                uint32_t writeMask = instr.alu.vectorWriteMask | instr.alu.scalarWriteMask;
+                if (instr.alu.scalarDestRelative)
+                    writeMask = 0b1111;
+
+                markInterpolator(instr.alu.vectorDest, writeMask);
+            }
+        });
+}
+
+// Loops with a literal trip count up to this are unrolled by the recompiler.
+static constexpr int32_t MAX_UNROLLED_LOOP_ITERATIONS = 16;
+
+// Returns the index of the LoopEnd matching the LoopStart at the given index, or 0 if the loop
+// body can't be emitted on its own because a conditional jump crosses its boundaries.
+static size_t findLoopEnd(const std::vector<ControlFlowInstruction>& controlFlow, size_t loopStart)
+{
+    size_t loopEnd = 0;
+    uint32_t depth = 0;
+
+    for (size_t i = loopStart + 1; i < controlFlow.size(); i++)
+    {
+        if (controlFlow[i].opcode == ControlFlowOpcode::LoopStart)
+        {
+            ++depth;
+        }
+        else if (controlFlow[i].opcode == ControlFlowOpcode::LoopEnd)
+        {
+            if (depth == 0)
+            {
+                loopEnd = i;
+                break;
+            }
+
+            --depth;
+        }
+    }
+
+    if (loopEnd == 0)
+        return 0;
+
+    for (size_t i = 0; i < controlFlow.size(); i++)
+    {
+        if (controlFlow[i].opcode == ControlFlowOpcode::CondJmp)
+        {
+            bool sourceInside = i > loopStart && i < loopEnd;
+            bool targetInside = controlFlow[i].condJmp.address > loopStart && controlFlow[i].condJmp.address <= loopEnd;
+            if (sourceInside != targetInside)
+                return 0;
+        }
+    }
+
+    return loopEnd;
+}
+
+std::vector<uint32_t> getInterpolatorMasks(const uint8_t* shaderData)
+{
+    const auto shaderContainer = reinterpret_cast<const ShaderContainer*>(shaderData);
+    const auto shader = reinterpret_cast<const Shader*>(shaderData + shaderContainer->shaderOffset);
+    const auto code = reinterpret_cast<const be<uint32_t>*>(shaderData + shaderContainer->virtualSize + shader->physicalOffset);
+
+    uint32_t interpolatorMasks[std::size(INTERPOLATORS)]{};
+    getInterpolatorMasks(shader, (shaderContainer->flags & 0x1) == 0, code, interpolatorMasks);
+
+    return std::vector<uint32_t>(std::begin(interpolatorMasks), std::end(interpolatorMasks));
+}
+
+enum
+{
+    LIVE_VECTOR = 1 << 0, // Fetch or the vector operation of an ALU instruction.
+    LIVE_SCALAR_RESULT = 1 << 1, // Scalar operation computing ps.
+    LIVE_SCALAR_WRITE = 1 << 2 // Write of ps to a register or export.
+};
+
+static bool hasSideEffects(AluVectorOpcode opcode)
+{
+    return (opcode >= AluVectorOpcode::SetpEqPush && opcode <= AluVectorOpcode::KillNe) || opcode == AluVectorOpcode::MaxA;
+}
+
+static bool hasSideEffects(AluScalarOpcode opcode)
+{
+    return (opcode >= AluScalarOpcode::SetpEq && opcode <= AluScalarOpcode::KillsOne) ||
+        opcode == AluScalarOpcode::MaxAs || opcode == AluScalarOpcode::MaxAsf;
+}
+
+static bool readsPreviousScalar(AluScalarOpcode opcode)
+{
+    switch (opcode)
+    {
+    case AluScalarOpcode::AddsPrev:
+    case AluScalarOpcode::MulsPrev:
+    case AluScalarOpcode::MulsPrev2:
+    case AluScalarOpcode::SubsPrev:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static uint32_t getExportMask(const AluInstruction& instr)
+{
+    uint32_t exportMask = instr.vectorWriteMask | instr.scalarWriteMask;
+    if (instr.scalarDestRelative)
+        exportMask = 0b1111;
+
+    return exportMask;
+}
+
+static uint32_t getFetchWriteMask(uint32_t dstSwizzle)
+{
+    uint32_t writeMask = 0;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        if (getDestSwizzle(dstSwizzle, i) != FetchDestinationSwizzle::Keep)
+            writeMask |= 1 << i;
+    }
+
+    return writeMask;
+}
+
+// Finds which parts of each instruction contribute to exports or side effects. The analysis is flow
+// insensitive, a register component is live if any live instruction reads it anywhere in the shader.
+// This keeps it correct for loops and jumps without tracking control flow. The ps register is treated
+// the same way: if any live instruction reads the ps value of a previous instruction, every scalar
+// operation is kept, as removing one would change what the reader sees.
+template<typename T>
+static std::unordered_map<uint32_t, uint32_t> getInstructionLiveness(const be<uint32_t>* code,
+    const std::vector<ControlFlowInstruction>& controlFlow, bool isPixelShader, const T& linkInstruction)
+{
+    struct LivenessInstruction
+    {
+        Instruction instr;
+        bool isFetch;
+        uint32_t address;
+    };
+
+    std::vector<LivenessInstruction> instructions;
+    forEachInstruction(code, controlFlow, [&](const Instruction& instr, bool isFetch, uint32_t address)
+        {
+            auto& livenessInstr = instructions.emplace_back(LivenessInstruction{ instr, isFetch, address });
+            if (!isFetch)
+                linkInstruction(livenessInstr.instr.alu);
+        });
+
+    uint32_t liveMasks[64]{};
+    bool previousScalarLive = false;
+    bool changed = true;
+
+    std::unordered_map<uint32_t, uint32_t> liveness;
+
+    auto markLive = [&](uint32_t reg, uint32_t componentMask)
+        {
+            if ((liveMasks[reg] & componentMask) != componentMask)
+            {
+                liveMasks[reg] |= componentMask;
+                changed = true;
+            }
+        };
+
+    while (changed)
+    {
+        changed = false;
+
+        for (auto& [instr, isFetch, address] : instructions)
+        {
+            uint32_t live = 0;
+
+            if (isFetch)
+            {
+                if (instr.vertexFetch.opcode == FetchOpcode::VertexFetch)
+                {
+                    if (liveMasks[instr.vertexFetch.dstRegister] & getFetchWriteMask(instr.vertexFetch.dstSwizzle))
+                        live |= LIVE_VECTOR;
+                }
+                else if (isPixelShader || (liveMasks[instr.textureFetch.dstRegister] & getFetchWriteMask(instr.textureFetch.dstSwizzle)))
+                {
+                    live |= LIVE_VECTOR;
+                    markLive(instr.textureFetch.srcRegister, getSourceComponentMask(instr.textureFetch));
+                }
+            }
+            else
+            {
+                auto& alu = instr.alu;
+
+                if (alu.exportData)
+                {
+                    if (getExportMask(alu) != 0)
+                        live |= LIVE_VECTOR | LIVE_SCALAR_WRITE;
+                }
+                else
+                {
+                    if (hasSideEffects(alu.vectorOpcode) || (liveMasks[alu.vectorDest] & alu.vectorWriteMask))
+                        live |= LIVE_VECTOR;
+
+                    if (liveMasks[alu.scalarDest] & alu.scalarWriteMask)
+                        live |= LIVE_SCALAR_WRITE;
+                }
+
+                if (alu.scalarOpcode == AluScalarOpcode::RetainPrev)
+                {
+                    if ((live & LIVE_SCALAR_WRITE) && !previousScalarLive)
+                    {
+                        previousScalarLive = true;
+                        changed = true;
+                    }
+                }
+                else if (hasSideEffects(alu.scalarOpcode) || previousScalarLive || (live & LIVE_SCALAR_WRITE))
+                {
+                    live |= LIVE_SCALAR_RESULT;
+
+                    if (readsPreviousScalar(alu.scalarOpcode) && !previousScalarLive)
+                    {
+                        previousScalarLive = true;
+                        changed = true;
+                    }
+                }
+
+                if (live & LIVE_VECTOR)
+                    forEachVectorSourceRegister(alu, markLive);
+
+                if (live & LIVE_SCALAR_RESULT)
+                    forEachScalarSourceRegister(alu, markLive);
+            }
+
+            uint32_t& instrLiveness = liveness[address];
+            if ((instrLiveness | live) != instrLiveness)
+            {
+                instrLiveness |= live;
+                changed = true;
+            }
+        }
+    }
+
+    return liveness;
+}
+
+// Finds the pixel shader registers that only carry color values: they never reach anything but the
+// oC0-oC3 exports, and never hold anything derived from the pixel position or from interpolators other
+// than colors. Texture fetch results are colors, while their coordinates, LODs and gradients are not.
+// Like the liveness analysis, this is flow insensitive and tracks the ps register alongside the others.
+static uint64_t getColorRegisters(const Shader* shader, const be<uint32_t>* code, const std::vector<ControlFlowInstruction>& controlFlow)
+{
+    std::vector<std::pair<Instruction, bool>> instructions;
+    bool relativeDestination = false;
+
+    forEachInstruction(code, controlFlow, [&](const Instruction& instr, bool isFetch, uint32_t)
+        {
+            instructions.emplace_back(instr, isFetch);
+            if (!isFetch && (instr.alu.vectorDestRelative || instr.alu.scalarDestRelative))
+                relativeDestination = true;
+        });
+
+    if (relativeDestination)
+        return 0;
+
+    // Registers that may hold values derived from something other than colors.
+    uint64_t nonColorSources = 0;
+
+    // Registers that may be read by something other than a color export.
+    uint64_t nonColorDestinations = 0;
+
+    bool previousScalarNonColorSource = false;
+    bool previousScalarNonColorDestination = false;
+
+    uint32_t positionRegister = (shader->fieldC >> 8) & 0xFF;
+    if (positionRegister < 64)
+        nonColorSources |= 1ull << positionRegister;
+
+    uint32_t interpolatorCount = (shader->interpolatorInfo >> 5) & 0x1F;
+
+    for (uint32_t i = 0; i < interpolatorCount; i++)
+    {
+        union
+        {
+            Interpolator interpolator;
+            uint32_t value;
+        };
+
+        value = reinterpret_cast<const PixelShader*>(shader)->interpolators[i];
+        if (interpolator.usage != DeclUsage::Color)
+            nonColorSources |= 1ull << interpolator.reg;
+    }
+
+    bool changed = true;
+
+    auto mark = [&](uint64_t& registers, uint32_t reg)
+        {
+            if ((registers & (1ull << reg)) == 0)
+            {
+                registers |= 1ull << reg;
+                changed = true;
+            }
+        };
+
+    auto markPreviousScalar = [&](bool& previousScalar)
+        {
+            if (!previousScalar)
+            {
+                previousScalar = true;
+                changed = true;
+            }
+        };
+
+    while (changed)
+    {
+        changed = false;
+
+        for (auto& [instr, isFetch] : instructions)
+        {
+            if (isFetch)
+            {
+                mark(nonColorDestinations, instr.textureFetch.srcRegister);
+
+                if (instr.textureFetch.opcode != FetchOpcode::TextureFetch)
+                    mark(nonColorSources, instr.textureFetch.dstRegister);
+
+                continue;
+            }
+
+            auto& alu = instr.alu;
+
+            bool vectorColorDestination;
+            bool scalarColorDestination;
+
+            if (alu.exportData)
+            {
+                bool colorExport = alu.vectorDest <= uint32_t(ExportRegister::PSColor3);
+                vectorColorDestination = colorExport;
+                scalarColorDestination = colorExport;
+            }
+            else
+            {
+                vectorColorDestination = (alu.vectorWriteMask == 0) || (nonColorDestinations & (1ull << alu.vectorDest)) == 0;
+                scalarColorDestination = (alu.scalarWriteMask == 0) || (nonColorDestinations & (1ull << alu.scalarDest)) == 0;
+            }
+
+            vectorColorDestination &= !hasSideEffects(alu.vectorOpcode);
+
+            if (alu.scalarOpcode == AluScalarOpcode::RetainPrev)
+            {
+                if (!scalarColorDestination)
+                    markPreviousScalar(previousScalarNonColorDestination);
+            }
+            else
+            {
+                scalarColorDestination &= !hasSideEffects(alu.scalarOpcode) && !previousScalarNonColorDestination;
+
+                if (!scalarColorDestination && readsPreviousScalar(alu.scalarOpcode))
+                    markPreviousScalar(previousScalarNonColorDestination);
+            }
+
+            bool vectorNonColorSource = false;
+            forEachVectorSourceRegister(alu, [&](uint32_t reg, uint32_t)
+                {
+                    if (!vectorColorDestination)
+                        mark(nonColorDestinations, reg);
+
+                    vectorNonColorSource |= (nonColorSources & (1ull << reg)) != 0;
+                });
+
+            bool scalarNonColorSource = false;
+            forEachScalarSourceRegister(alu, [&](uint32_t reg, uint32_t)
+                {
+                    if (!scalarColorDestination)
+                        mark(nonColorDestinations, reg);
+
+                    scalarNonColorSource |= (nonColorSources & (1ull << reg)) != 0;
+                });
+
+            if (alu.scalarOpcode == AluScalarOpcode::RetainPrev || readsPreviousScalar(alu.scalarOpcode))
+                scalarNonColorSource |= previousScalarNonColorSource;
+
+            if (!alu.exportData)
+            {
+                if (vectorNonColorSource && alu.vectorWriteMask != 0)
+                    mark(nonColorSources, alu.vectorDest);
+
+                if (scalarNonColorSource && alu.scalarWriteMask != 0)
+                    mark(nonColorSources, alu.scalarDest);
+            }
+
+            if (scalarNonColorSource)
+                markPreviousScalar(previousScalarNonColorSource);
+        }
+    }
+
+    return ~(nonColorSources | nonColorDestinations);
+}
+
+#ifdef UNLEASHED_RECOMP
+
+enum ProjectionState : uint8_t
+{
+    PROJECTION_INDEPENDENT, // Doesn't depend on g_MtxProjection.
+    PROJECTION_LINEAR, // Flipping the depth of every g_MtxProjection row flips the depth of this value.
+    PROJECTION_OTHER
+};
+
+static uint8_t joinProjectionStates(uint8_t lhs, uint8_t rhs)
+{
+    return lhs == rhs ? lhs : PROJECTION_OTHER;
+}
+
+static uint8_t writeProjectionState(uint8_t state, uint32_t writeMask, uint8_t value)
+{
+    bool writesZ = (writeMask & 0b0100) != 0;
+    bool writesW = (writeMask & 0b1000) != 0;
+
+    if (writeMask == 0)
+        return state;
+
+    // Depth is computed from z and w together, so they can't come from different values.
+    if (writeMask == 0b1111 || (value == state && (value != PROJECTION_LINEAR || writesZ == writesW)))
+        return value;
+
+    // x and y are left alone by the depth flip, so they may hold anything not depending on the matrix.
+    if (state == PROJECTION_LINEAR && value == PROJECTION_INDEPENDENT && !writesZ && !writesW)
+        return PROJECTION_LINEAR;
+
+    return PROJECTION_OTHER;
+}
+
+// Checks whether the exported position only depends on g_MtxProjection through sums of its rows multiplied by values
+// that don't depend on it. Reverse-Z replaces each row with (x, y, w - z, w), and with the position being a linear
+// combination of the rows, it can instead be applied once to the final position. The matrix must not reach branches,
+// predicates, the address register or texture coordinates. Like the value range tracking, this relies on simple
+// control flow, with the body of a loop repeated until the states stop changing.
+template<typename T>
+static bool isPositionProjected(const be<uint32_t>* code, const std::vector<ControlFlowInstruction>& controlFlow, const T& isProjectionConstant)
+{
+    uint8_t registers[64]{};
+    uint8_t previousScalar = PROJECTION_INDEPENDENT;
+
+    // The position starts as zero, which is left unchanged by the depth flip.
+    uint8_t position = PROJECTION_LINEAR;
+
+    auto getSwizzleComponent = [](uint32_t swizzle, uint32_t component)
+        {
+            return ((swizzle >> (component * 2)) + component) & 0x3;
+        };
+
+    auto processInstruction = [&](const Instruction& instr, bool isFetch, bool conditional)
+        {
+            auto write = [&](uint8_t& state, uint32_t writeMask, uint8_t value, bool isPredicated)
+                {
+                    uint8_t written = writeProjectionState(state, writeMask, value);
+                    state = (conditional || isPredicated) ? joinProjectionStates(state, written) : written;
+                };
+
+            if (isFetch)
+            {
+                // Relative destinations, at the same bit for vertex fetches.
+                if (instr.textureFetch.dstRegisterAm)
+                    return false;
+
+                if (instr.vertexFetch.opcode == FetchOpcode::VertexFetch)
+                {
+                    write(registers[instr.vertexFetch.dstRegister], getFetchWriteMask(instr.vertexFetch.dstSwizzle),
+                        PROJECTION_INDEPENDENT, instr.vertexFetch.isPredicated);
+
+                    return true;
+                }
+
+                auto& textureFetch = instr.textureFetch;
+                if (registers[textureFetch.srcRegister] != PROJECTION_INDEPENDENT)
+                    return false;
+
+                if (textureFetch.opcode < FetchOpcode::SetTextureLod)
+                    write(registers[textureFetch.dstRegister], getFetchWriteMask(textureFetch.dstSwizzle), PROJECTION_INDEPENDENT, textureFetch.isPredicated);
+
+                return true;
+            }
+
+            auto& alu = instr.alu;
+
+            if ((!alu.exportData && alu.vectorDestRelative) || alu.scalarDestRelative)
+                return false;
+
+            auto getOperand = [&](uint32_t reg, bool select, uint32_t swizzle, bool relative) -> uint8_t
+                {
+                    if (select)
+                    {
+                        uint8_t state = registers[reg & 0x3F];
+                        return (state == PROJECTION_LINEAR && ((reg & 0x80) != 0 || swizzle != 0)) ? PROJECTION_OTHER : state;
+                    }
+
+                    if (!isProjectionConstant(reg))
+                        return PROJECTION_INDEPENDENT;
+
+                    return (relative || alu.absConstants || swizzle != 0) ? PROJECTION_OTHER : PROJECTION_LINEAR;
+                };
+
+            bool relative = alu.const0Relative || alu.const1Relative;
+            const uint32_t swizzles[] = { alu.src1Swizzle, alu.src2Swizzle, alu.src3Swizzle };
+            const uint8_t operands[] =
+            {
+                getOperand(alu.src1Register, alu.src1Select, alu.src1Swizzle, relative),
+                getOperand(alu.src2Register, alu.src2Select, alu.src2Swizzle, relative),
+                getOperand(alu.src3Register, alu.src3Select, alu.src3Swizzle, relative)
+            };
+
+            uint32_t operandCount = getVectorOperandCount(alu.vectorOpcode);
+            bool independent = std::all_of(operands, operands + operandCount, [](uint8_t state) { return state == PROJECTION_INDEPENDENT; });
+
+            // Scaling a row keeps it linear if z and w are scaled by the same value.
+            auto multiply = [&](uint32_t lhs, uint32_t rhs) -> uint8_t
+                {
+                    if (operands[lhs] == PROJECTION_INDEPENDENT && operands[rhs] == PROJECTION_INDEPENDENT)
+                        return PROJECTION_INDEPENDENT;
+
+                    for (uint32_t i = 0; i < 2; i++)
+                    {
+                        uint32_t row = i == 0 ? lhs : rhs;
+                        uint32_t scale = i == 0 ? rhs : lhs;
+
+                        if (operands[row] == PROJECTION_LINEAR && operands[scale] == PROJECTION_INDEPENDENT &&
+                            getSwizzleComponent(swizzles[scale], 2) == getSwizzleComponent(swizzles[scale], 3))
+                        {
+                            return PROJECTION_LINEAR;
+                        }
+                    }
+
+                    return PROJECTION_OTHER;
+                };
+
+            uint8_t vector;
+
+            switch (alu.vectorOpcode)
+            {
+            case AluVectorOpcode::Add:
+                vector = joinProjectionStates(operands[0], operands[1]);
+                break;
+
+            case AluVectorOpcode::Mul:
+                vector = multiply(0, 1);
+                break;
+
+            case AluVectorOpcode::Mad:
+                vector = joinProjectionStates(multiply(0, 1), operands[2]);
+                break;
+
+            case AluVectorOpcode::Max:
+            case AluVectorOpcode::Min:
+                // Moves are emitted as the maximum of a value with itself.
+                if (alu.src1Register == alu.src2Register && alu.src1Select == alu.src2Select && alu.src1Swizzle == alu.src2Swizzle && alu.src1Negate == alu.src2Negate)
+                    vector = operands[0];
+                else
+                    vector = independent ? PROJECTION_INDEPENDENT : PROJECTION_OTHER;
+                break;
+
+            default:
+                vector = independent ? PROJECTION_INDEPENDENT : PROJECTION_OTHER;
+                break;
+            }
+
+            if (vector == PROJECTION_LINEAR && alu.vectorSaturate)
+                vector = PROJECTION_OTHER;
+
+            if (vector != PROJECTION_INDEPENDENT && hasSideEffects(alu.vectorOpcode))
+                return false;
+
+            uint8_t scalar = PROJECTION_INDEPENDENT;
+
+            switch (alu.scalarOpcode)
+            {
+            case AluScalarOpcode::RetainPrev:
+                scalar = previousScalar;
+                break;
+
+            case AluScalarOpcode::SetpClr:
+                break;
+
+            case AluScalarOpcode::Mulsc0:
+            case AluScalarOpcode::Mulsc1:
+            case AluScalarOpcode::Addsc0:
+            case AluScalarOpcode::Addsc1:
+            case AluScalarOpcode::Subsc0:
+            case AluScalarOpcode::Subsc1:
+                if (isProjectionConstant(alu.src3Register))
+                    scalar = PROJECTION_OTHER;
+                else
+                    scalar = registers[(uint32_t(alu.scalarOpcode) & 1) | (alu.src3Select << 1) | (alu.src3Swizzle & 0x3C)];
+                break;
+
+            default:
+                scalar = operands[2];
+                if (readsPreviousScalar(alu.scalarOpcode))
+                    scalar = joinProjectionStates(scalar, previousScalar);
+                break;
+            }
+
+            // A single value replicated over z and w is never flipped with them.
+            if (scalar != PROJECTION_INDEPENDENT)
+                scalar = PROJECTION_OTHER;
+
+            if (scalar != PROJECTION_INDEPENDENT && hasSideEffects(alu.scalarOpcode))
+                return false;
+
+            if (alu.scalarOpcode != AluScalarOpcode::RetainPrev)
+                write(previousScalar, 0b1111, scalar, alu.isPredicated);
+
+            if (alu.exportData)
+            {
+                if (alu.vectorDest == uint32_t(ExportRegister::VSPosition))
+                {
+                    write(position, alu.vectorWriteMask, vector, alu.isPredicated);
+                    write(position, alu.scalarWriteMask, scalar, alu.isPredicated);
+                }
+            }
+            else
+            {
+                write(registers[alu.vectorDest], alu.vectorWriteMask, vector, alu.isPredicated);
+                write(registers[alu.scalarDest], alu.scalarWriteMask, scalar, alu.isPredicated);
+            }
+
+            return true;
+        };
+
+    auto processControlFlow = [&](auto& self, size_t begin, size_t end, bool conditional) -> bool
+        {
+            // Ends of the forward jumps taken so far, skipping everything before them.
+            std::vector<size_t> jumpTargets;
+
+            for (size_t i = begin; i < end; i++)
+            {
+                jumpTargets.erase(std::remove_if(jumpTargets.begin(), jumpTargets.end(), [&](size_t target) { return target <= i; }), jumpTargets.end());
+
+                auto& cfInstr = controlFlow[i];
+
+                switch (cfInstr.opcode)
+                {
+                case ControlFlowOpcode::CondJmp:
+                    if (cfInstr.condJmp.isUnconditional || cfInstr.condJmp.direction)
+                        return false;
+
+                    jumpTargets.push_back(cfInstr.condJmp.address);
+                    break;
+
+                case ControlFlowOpcode::LoopStart:
+                {
+                    size_t loopEnd = findLoopEnd(controlFlow, i);
+                    if (loopEnd == 0)
+                        return false;
+
+                    while (true)
+                    {
+                        uint8_t previousRegisters[64];
+                        std::copy(std::begin(registers), std::end(registers), previousRegisters);
+                        uint8_t previousPosition = position;
+                        uint8_t previousScalarState = previousScalar;
+
+                        if (!self(self, i + 1, loopEnd, true))
+                            return false;
+
+                        if (std::equal(std::begin(registers), std::end(registers), previousRegisters) &&
+                            position == previousPosition && previousScalar == previousScalarState)
+                        {
+                            break;
+                        }
+                    }
+
+                    i = loopEnd;
+                    break;
+                }
+
+                case ControlFlowOpcode::CondCall:
+                case ControlFlowOpcode::Return:
+                    return false;
+
+                default:
+                {
+                    ExecBlock execBlock = getExecBlock(cfInstr);
+                    bool conditionalBlock = conditional || !jumpTargets.empty() ||
+                        (cfInstr.opcode != ControlFlowOpcode::Exec && cfInstr.opcode != ControlFlowOpcode::ExecEnd);
+
+                    auto instructionCode = code + execBlock.address * 3;
+
+                    for (uint32_t j = 0; j < execBlock.count; j++)
+                    {
+                        Instruction instr;
+                        instr.code[0] = instructionCode[0];
+                        instr.code[1] = instructionCode[1];
+                        instr.code[2] = instructionCode[2];
+
+                        if (!processInstruction(instr, ((execBlock.sequence >> (j * 2)) & 0x1) != 0, conditionalBlock))
+                            return false;
+
+                        instructionCode += 3;
+                    }
+
+                    // Reverse-Z is applied at every return, including conditional ones before the end of the shader.
+                    if (execBlock.shouldReturn && position != PROJECTION_LINEAR)
+                        return false;
+
+                    break;
+                }
+                }
+            }
+
+            return true;
+        };
+
+    return processControlFlow(processControlFlow, 0, controlFlow.size(), false) && position == PROJECTION_LINEAR;
+}
+
+#endif
+
+static bool isBounded(const ValueRange& range)
+{
+    return std::isfinite(range.min) && std::isfinite(range.max);
+}
+
+static ValueRange makeRange(float min, float max)
+{
+    ValueRange range;
+    range.min = min;
+    range.max = max;
+    return range;
+}
+
+static ValueRange unionRanges(const ValueRange& left, const ValueRange& right)
+{
+    return makeRange(std::min(left.min, right.min), std::max(left.max, right.max));
+}
+
+static ValueRange negateRange(const ValueRange& range)
+{
+    return makeRange(-range.max, -range.min);
+}
+
+static ValueRange absRange(const ValueRange& range)
+{
+    if (range.min >= 0.0f)
+        return range;
+
+    if (range.max <= 0.0f)
+        return negateRange(range);
+
+    return makeRange(0.0f, std::max(-range.min, range.max));
+}
+
+static ValueRange addRanges(const ValueRange& left, const ValueRange& right)
+{
+    if (!isBounded(left) || !isBounded(right))
+        return {};
+
+    return makeRange(left.min + right.min, left.max + right.max);
+}
+
+static ValueRange mulRanges(const ValueRange& left, const ValueRange& right)
+{
+    if (!isBounded(left) || !isBounded(right))
+        return {};
+
+    float products[] = { left.min * right.min, left.min * right.max, left.max * right.min, left.max * right.max };
+    return makeRange(*std::min_element(std::begin(products), std::end(products)), *std::max_element(std::begin(products), std::end(products)));
+}
+
+static ValueRange maxRanges(const ValueRange& left, const ValueRange& right)
+{
+    return makeRange(std::max(left.min, right.min), std::max(left.max, right.max));
+}
+
+static ValueRange minRanges(const ValueRange& left, const ValueRange& right)
+{
+    return makeRange(std::min(left.min, right.min), std::min(left.max, right.max));
+}
+
+static ValueRange floorRange(const ValueRange& range)
+{
+    return makeRange(std::floor(range.min), std::floor(range.max));
+}
+
+static ValueRange truncRange(const ValueRange& range)
+{
+    return makeRange(std::trunc(range.min), std::trunc(range.max));
+}
+
+static ValueRange saturateRange(const ValueRange& range)
+{
+    return makeRange(std::clamp(range.min, 0.0f, 1.0f), std::clamp(range.max, 0.0f, 1.0f));
+}
+
+// Results are compared with a margin to stay clear of rounding differences between the interval
+// arithmetic here and the GPU.
+static constexpr float MIN_SAFE_MAGNITUDE = 1e-30f;
+
+static bool isSafeForReciprocal(const ValueRange& range)
+{
+    return range.min >= MIN_SAFE_MAGNITUDE || range.max <= -MIN_SAFE_MAGNITUDE;
+}
+
+static bool isSafeForLogarithm(const ValueRange& range)
+{
+    return range.min >= MIN_SAFE_MAGNITUDE && std::isfinite(range.max);
+}
+
+ValueRange ShaderRecompiler::getRegisterRange(uint32_t reg, uint32_t component) const
+{
+    return trackValueRanges ? registerRanges[reg][component] : ValueRange{};
+}
+
+void ShaderRecompiler::setRegisterRange(uint32_t reg, uint32_t component, ValueRange range)
+{
+    if (conditionalDepth != 0)
+        range = unionRanges(registerRanges[reg][component], range);
+
+    registerRanges[reg][component] = range;
+}
+
+void ShaderRecompiler::setAddressRange(ValueRange range)
+{
+    // a0 is always clamped to the range of constant registers when written.
+    range = makeRange(std::clamp(range.min, -256.0f, 255.0f), std::clamp(range.max, -256.0f, 255.0f));
+
+    if (conditionalDepth != 0)
+        range = unionRanges(addressRange, range);
+
+    addressRange = range;
+}
+
+void ShaderRecompiler::resetRegisterRanges()
+{
+    for (auto& ranges : registerRanges)
+    {
+        for (auto& range : ranges)
+            range = {};
+    }
+
+    previousScalarRange = {};
+    addressRange = makeRange(-256.0f, 255.0f);
+}
+
+bool ShaderRecompiler::isConstantIndexInRange(const ConstantInfo* constantInfo, uint32_t offset, bool addressRegisterRelative) const
+{
+    ValueRange range;
+    if (!trackValueRanges)
+        range = addressRegisterRelative ? makeRange(-256.0f, 255.0f) : ValueRange{};
+    else
+        range = addressRegisterRelative ? addressRange : loopIndexRange;
+
+    return isBounded(range) && (float(offset) + range.min) >= 0.0f && (float(offset) + range.max) < float(constantInfo->registerCount.get());
+}
+
+void ShaderRecompiler::addClampRange(ValueRange range)
+{
+    auto insertResult = clampRanges.emplace(instructionAddress, range);
+    if (!insertResult.second)
+        insertResult.first->second = unionRanges(insertResult.first->second, range);
+
+    ++clampsRemoved;
+}
+
+std::string ShaderRecompiler::getHoistedLoad(const char* type, std::string localName, std::string expression)
+{
+    if (!hoistConstantLoads)
+        return expression;
+
+    hoistedLoads.emplace(localName, std::make_pair(type, std::move(expression)));
+    return localName;
+}
+
+// Replaces the fetch expression emitted since expressionStart with the local holding its result, declaring the local
+// before the statement the first time the expression is fetched. Returns whether an earlier result was reused.
+bool ShaderRecompiler::reuseFetchResult(size_t statementStart, size_t expressionStart, uint32_t srcRegister)
+{
+    std::string expression = out.substr(expressionStart);
+    std::string assignment = out.substr(statementStart, expressionStart - statementStart);
+    out.resize(statementStart);
+
+    auto findResult = fetchResults.find(expression);
+    bool reused = findResult != fetchResults.end();
+
+    if (!reused)
+    {
+        std::string localName = fmt::format("fetchResult{}", fetchResultCount++);
+
+        indent();
+        println("float4 {} = float4({});", localName, expression);
+
+        findResult = fetchResults.emplace(std::move(expression), FetchResult{ std::move(localName), srcRegister, indentation }).first;
+    }
+
+    out += assignment;
+    out += findResult->second.localName;
+
+    return reused;
+}
+
+void ShaderRecompiler::invalidateFetchResults(uint32_t reg)
+{
+    for (auto it = fetchResults.begin(); it != fetchResults.end();)
+    {
+        if (it->second.srcRegister == reg)
+            it = fetchResults.erase(it);
+        else
+            ++it;
+    }
+}
+
+// Drops the results declared in blocks that were closed. pixelCoord may have been last assigned inside
+// one of them, so it is computed again on the next fetch.
+void ShaderRecompiler::closeFetchScopes()
+{
+    pixelCoordFetch.clear();
+
+    for (auto it = fetchResults.begin(); it != fetchResults.end();)
+    {
+        if (it->second.indentation > indentation)
+            it = fetchResults.erase(it);
+        else
+            ++it;
+    }
 }
 
 uint32_t ShaderRecompiler::printDstSwizzle(uint32_t dstSwizzle, bool operand)
@@ -162,8 +1376,29 @@ void ShaderRecompiler::printDstSwizzle01(uint32_t dstRegister, uint32_t dstSwizz
         }
         else if (swizzle == FetchDestinationSwizzle::One)
         {
-            indent();
-            println("r{}.{} = 1.0;", dstRegister, SWIZZLES[i]);
+            indent();
+            println("r{}.{} = 1.0;", dstRegister, SWIZZLES[i]);
+        }
+    }
+}
+
+void ShaderRecompiler::setFetchRanges(uint32_t dstRegister, uint32_t dstSwizzle, ValueRange range)
+{
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        switch (getDestSwizzle(dstSwizzle, i))
+        {
+        case FetchDestinationSwizzle::Zero:
+            setRegisterRange(dstRegister, i, makeRange(0.0f, 0.0f));
+            break;
+        case FetchDestinationSwizzle::One:
+            setRegisterRange(dstRegister, i, makeRange(1.0f, 1.0f));
+            break;
+        case FetchDestinationSwizzle::Keep:
+            break;
+        default:
+            setRegisterRange(dstRegister, i, range);
+            break;
         }
     }
 }
@@ -178,8 +1413,11 @@ void ShaderRecompiler::recompile(const VertexFetchInstruction& instr, uint32_t a
         indent();
         out += "{\n";
         ++indentation;
+        ++conditionalDepth;
     }
 
+    size_t statementStart = out.size();
+
     indent();
     print("r{}.", instr.dstRegister);
     uint32_t size = printDstSwizzle(instr.dstSwizzle, false);
@@ -191,28 +1429,58 @@ void ShaderRecompiler::recompile(const VertexFetchInstruction& instr, uint32_t a
     else
         print("(float{})(", size);
 
+    size_t expressionStart = out.size();
+
     auto findResult = vertexElements.find(address);
     assert(findResult != vertexElements.end());
 
+    const char* swappedFloats = nullptr;
+    const char* swappedFloatsSpecConstant = nullptr;
+    uint32_t swappedFloatsSpecConstantMask = 0;
+
     switch (findResult->second.usage)
     {
     case DeclUsage::Normal:
-        print("swapFloats(g_SwappedNormals, ");
+        swappedFloats = "g_SwappedNormals";
+        swappedFloatsSpecConstant = "SPEC_CONSTANT_SWAPPED_NORMALS";
+        swappedFloatsSpecConstantMask = SPEC_CONSTANT_SWAPPED_NORMALS;
         break;
     case DeclUsage::Tangent:
-        print("swapFloats(g_SwappedTangents, ");
+        swappedFloats = "g_SwappedTangents";
+        swappedFloatsSpecConstant = "SPEC_CONSTANT_SWAPPED_TANGENTS";
+        swappedFloatsSpecConstantMask = SPEC_CONSTANT_SWAPPED_TANGENTS;
         break;
     case DeclUsage::Binormal:
-        print("swapFloats(g_SwappedBinormals, ");
+        swappedFloats = "g_SwappedBinormals";
+        swappedFloatsSpecConstant = "SPEC_CONSTANT_SWAPPED_BINORMALS";
+        swappedFloatsSpecConstantMask = SPEC_CONSTANT_SWAPPED_BINORMALS;
         break;
     case DeclUsage::BlendWeight:
-        print("swapFloats(g_SwappedBlendWeights, ");
+        swappedFloats = "g_SwappedBlendWeights";
+        swappedFloatsSpecConstant = "SPEC_CONSTANT_SWAPPED_BLEND_WEIGHTS";
+        swappedFloatsSpecConstantMask = SPEC_CONSTANT_SWAPPED_BLEND_WEIGHTS;
         break;
     case DeclUsage::TexCoord:
-        print("swapFloats(g_SwappedTexcoords, ");
+        swappedFloats = "g_SwappedTexcoords";
+        swappedFloatsSpecConstant = "SPEC_CONSTANT_SWAPPED_TEXCOORDS";
+        swappedFloatsSpecConstantMask = SPEC_CONSTANT_SWAPPED_TEXCOORDS;
         break;
     }
 
+    if (swappedFloats != nullptr)
+    {
+        if (specializeSharedFlags)
+        {
+            // The mask is only read when an element of this usage is swapped, and folds to no swizzle otherwise.
+            specConstantsMask |= swappedFloatsSpecConstantMask;
+            print("swapFloats((g_SpecConstants() & {}) != 0 ? {} : 0, ", swappedFloatsSpecConstant, swappedFloats);
+        }
+        else
+        {
+            print("swapFloats({}, ", swappedFloats);
+        }
+    }
+
     print("(input.i{}{})", USAGE_VARIABLES[uint32_t(findResult->second.usage)], uint32_t(findResult->second.usageIndex));
 
     switch (findResult->second.usage)
@@ -226,18 +1494,34 @@ void ShaderRecompiler::recompile(const VertexFetchInstruction& instr, uint32_t a
         break;
     }
 
+    // Vertex inputs never change, so only the scope limits reuse.
+    if (reuseFetchResults && !instr.isPredicated)
+        reuseFetchResult(statementStart, expressionStart, ~0u);
+
     out += ").";
     printDstSwizzle(instr.dstSwizzle, true);
 
     out += ";\n";
 
     printDstSwizzle01(instr.dstRegister, instr.dstSwizzle);
+    invalidateFetchResults(instr.dstRegister);
+
+    // Blend indices fetched as unsigned 8-bit integers can't index past 255.
+    ValueRange range;
+    if (findResult->second.usage == DeclUsage::BlendIndices && instr.format == VERTEX_FORMAT_8_8_8_8 &&
+        instr.numFormatAll && !instr.formatCompAll && instr.expAdjust == 0)
+    {
+        range = makeRange(0.0f, 255.0f);
+    }
+
+    setFetchRanges(instr.dstRegister, instr.dstSwizzle, range);
 
     if (instr.isPredicated)
     {
         --indentation;
         indent();
         out += "}\n";
+        --conditionalDepth;
     }
 }
 
@@ -254,6 +1538,7 @@ void ShaderRecompiler::recompile(const TextureFetchInstruction& instr, bool bicu
         indent();
         out += "{\n";
         ++indentation;
+        ++conditionalDepth;
     }
 
     auto printSrcRegister = [&](size_t componentCount)
@@ -285,9 +1570,19 @@ void ShaderRecompiler::recompile(const TextureFetchInstruction& instr, bool bicu
         constNamePtr = constName.c_str();
     }
 
+    bool reuseFetch = reuseFetchResults && !instr.isPredicated;
+    size_t pixelCoordStart = out.size();
+    bool printedPixelCoord = false;
+
 #ifdef UNLEASHED_RECOMP
+    // g_GISampler is fetched in both branches of a spec constant check.
+    if (instr.constIndex == 10)
+        reuseFetch = false;
+
     if (instr.constIndex == 0 && instr.dimension == TextureDimension::Texture2D)
     {
+        printedPixelCoord = true;
+
         indent();
         println("pixelCoord = getPixelCoord(");
         println("#ifdef __air__");
@@ -295,17 +1590,22 @@ void ShaderRecompiler::recompile(const TextureFetchInstruction& instr, bool bicu
         println("g_Texture2DDescriptorHeap,");
         println("#endif");
         indent();
-        print("{}_Texture2DDescriptorIndex, ", constNamePtr);
+        print("{}, ", getHoistedLoad("uint", fmt::format("{}_Texture2DDescriptorIndex_Hoisted", constNamePtr),
+            fmt::format("{}_Texture2DDescriptorIndex", constNamePtr)));
         printSrcRegister(2);
         out += ");\n";
     }
 #endif
 
+    size_t statementStart = out.size();
+
     indent();
     print("r{}.", instr.dstRegister);
     printDstSwizzle(instr.dstSwizzle, false);
 
     out += " = ";
+
+    size_t expressionStart = out.size();
     switch (instr.opcode)
     {
     case FetchOpcode::TextureFetch:
@@ -365,7 +1665,11 @@ void ShaderRecompiler::recompile(const TextureFetchInstruction& instr, bool bicu
     println("#endif");
 
     indent();
-    print("\t{0}_Texture{1}DescriptorIndex, {0}_SamplerDescriptorIndex, ", constNamePtr, dimension);
+    print("\t{}, {}, ",
+        getHoistedLoad("uint", fmt::format("{}_Texture{}DescriptorIndex_Hoisted", constNamePtr, dimension),
+            fmt::format("{}_Texture{}DescriptorIndex", constNamePtr, dimension)),
+        getHoistedLoad("uint", fmt::format("{}_SamplerDescriptorIndex_Hoisted", constNamePtr),
+            fmt::format("{}_SamplerDescriptorIndex", constNamePtr)));
     printSrcRegister(componentCount);
 
     switch (instr.dimension)
@@ -378,19 +1682,40 @@ void ShaderRecompiler::recompile(const TextureFetchInstruction& instr, bool bicu
             break;
     }
 
-    out += ").";
+    out += ')';
+
+    if (reuseFetch)
+    {
+        std::string expression = out.substr(expressionStart);
+
+        // pixelCoord already holds the coordinates of a reused fetch, unless another fetch computed it since.
+        if (reuseFetchResult(statementStart, expressionStart, instr.srcRegister) && printedPixelCoord && pixelCoordFetch == expression)
+            out.erase(pixelCoordStart, statementStart - pixelCoordStart);
+
+        if (printedPixelCoord)
+            pixelCoordFetch = std::move(expression);
+    }
+    else if (printedPixelCoord)
+    {
+        pixelCoordFetch.clear();
+    }
+
+    out += '.';
 
     printDstSwizzle(instr.dstSwizzle, true);
 
     out += ";\n";
 
     printDstSwizzle01(instr.dstRegister, instr.dstSwizzle);
+    invalidateFetchResults(instr.dstRegister);
+    setFetchRanges(instr.dstRegister, instr.dstSwizzle, (instr.opcode == FetchOpcode::GetTextureWeights) ? makeRange(0.0f, 1.0f) : ValueRange{});
 
     if (instr.isPredicated)
     {
         --indentation;
         indent();
         out += "}\n";
+        --conditionalDepth;
     }
 }
 
@@ -404,6 +1729,7 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
         indent(); 
         out += "{\n";
         ++indentation;
+        ++conditionalDepth;
     }
 
     enum
@@ -502,7 +1828,7 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
                     if (findResult->second->registerCount > 1)
                     {
                     #ifdef UNLEASHED_RECOMP
-                        if (hasMtxProjection && strcmp(constantName, "g_MtxProjection") == 0)
+                        if (hasMtxProjection && !reverseZFromPosition && strcmp(constantName, "g_MtxProjection") == 0)
                         {
                             regFormatted = fmt::format("(iterationIndex == 0 ? mtxProjectionReverseZ[{0}] : mtxProjection[{0}])",
                                 reg - findResult->second->registerIndex);
@@ -510,14 +1836,28 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
                         else
                     #endif
                         {
-                            regFormatted = fmt::format("{}({}{})", constantName,
-                                reg - findResult->second->registerIndex, instr.const0Relative ? (instr.constAddressRegisterRelative ? " + a0" : " + aL") : "");
+                            uint32_t offset = reg - findResult->second->registerIndex;
+                            bool inRange = !instr.const0Relative || isConstantIndexInRange(findResult->second, offset, instr.constAddressRegisterRelative);
+
+                            if (instr.const0Relative)
+                            {
+                                if (inRange)
+                                    uncheckedConstantAccesses.insert(instructionAddress);
+
+                                regFormatted = fmt::format("{}{}({} + {})", constantName, inRange ? "_Unchecked" : "",
+                                    offset, instr.constAddressRegisterRelative ? "a0" : loopIndex);
+                            }
+                            else
+                            {
+                                regFormatted = getHoistedLoad("float4", fmt::format("{}_Hoisted{}", constantName, offset),
+                                    fmt::format("{}_Unchecked({})", constantName, offset));
+                            }
                         }
                     }
                     else
                     {
                         assert(!instr.const0Relative && !instr.const1Relative);
-                        regFormatted = constantName;
+                        regFormatted = getHoistedLoad("float4", fmt::format("{}_Hoisted", constantName), constantName);
                     }
                 }
                 else
@@ -596,6 +1936,163 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
             return opResult;
         };
 
+    // Mirrors op() to find the value range of a single operand component. For vector operands,
+    // the component is the destination component the operand is swizzled into.
+    auto opRange = [&](size_t operand, uint32_t component = 0)
+        {
+            uint32_t reg = 0;
+            uint32_t swizzle = 0;
+            bool select = true;
+            bool negate = false;
+            bool abs = false;
+
+            switch (operand)
+            {
+            case VECTOR_0:
+                reg = instr.src1Register;
+                swizzle = instr.src1Swizzle;
+                select = instr.src1Select;
+                negate = instr.src1Negate;
+                break;
+            case VECTOR_1:
+                reg = instr.src2Register;
+                swizzle = instr.src2Swizzle;
+                select = instr.src2Select;
+                negate = instr.src2Negate;
+                break;
+            case VECTOR_2:
+            case SCALAR_0:
+            case SCALAR_1:
+                reg = instr.src3Register;
+                swizzle = instr.src3Swizzle;
+                select = instr.src3Select;
+                negate = instr.src3Negate;
+                break;
+            case SCALAR_CONSTANT_0:
+                reg = instr.src3Register;
+                swizzle = instr.src3Swizzle;
+                select = false;
+                negate = instr.src3Negate;
+                break;
+            case SCALAR_CONSTANT_1:
+                reg = (uint32_t(instr.scalarOpcode) & 1) | (instr.src3Select << 1) | (instr.src3Swizzle & 0x3C);
+                swizzle = instr.src3Swizzle;
+                negate = instr.src3Negate;
+                break;
+            }
+
+            if (select && operand != SCALAR_CONSTANT_1)
+            {
+                abs = (reg & 0x80) != 0;
+                reg &= 0x3F;
+            }
+            else
+            {
+                abs = instr.absConstants;
+            }
+
+            switch (operand)
+            {
+            case VECTOR_0:
+            case VECTOR_1:
+            case VECTOR_2:
+                component = ((swizzle >> (component * 2)) + component) & 0x3;
+                break;
+            case SCALAR_0:
+            case SCALAR_CONSTANT_0:
+                component = ((swizzle >> 6) + 3) & 0x3;
+                break;
+            case SCALAR_1:
+            case SCALAR_CONSTANT_1:
+                component = swizzle & 0x3;
+                break;
+            }
+
+            ValueRange range;
+
+            if (select)
+            {
+                range = getRegisterRange(reg, component);
+            }
+            else if (float4Constants.find(reg) == float4Constants.end())
+            {
+                auto findResult = literalConstants.find(reg * 4 + component);
+                if (findResult != literalConstants.end())
+                    range = makeRange(findResult->second, findResult->second);
+            }
+
+            if (abs)
+                range = absRange(range);
+
+            if (negate)
+                range = negateRange(range);
+
+            return range;
+        };
+
+    // Value ranges of the vector result, computed before anything is written.
+    ValueRange vectorRanges[4];
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        switch (instr.vectorOpcode)
+        {
+        case AluVectorOpcode::Add:
+            vectorRanges[i] = addRanges(opRange(VECTOR_0, i), opRange(VECTOR_1, i));
+            break;
+        case AluVectorOpcode::Mul:
+            vectorRanges[i] = mulRanges(opRange(VECTOR_0, i), opRange(VECTOR_1, i));
+            break;
+        case AluVectorOpcode::Max:
+        case AluVectorOpcode::MaxA:
+            vectorRanges[i] = maxRanges(opRange(VECTOR_0, i), opRange(VECTOR_1, i));
+            break;
+        case AluVectorOpcode::Min:
+            vectorRanges[i] = minRanges(opRange(VECTOR_0, i), opRange(VECTOR_1, i));
+            break;
+        case AluVectorOpcode::Seq:
+        case AluVectorOpcode::Sgt:
+        case AluVectorOpcode::Sge:
+        case AluVectorOpcode::Sne:
+        case AluVectorOpcode::Frc:
+            vectorRanges[i] = makeRange(0.0f, 1.0f);
+            break;
+        case AluVectorOpcode::Trunc:
+            vectorRanges[i] = truncRange(opRange(VECTOR_0, i));
+            break;
+        case AluVectorOpcode::Floor:
+            vectorRanges[i] = floorRange(opRange(VECTOR_0, i));
+            break;
+        case AluVectorOpcode::Mad:
+            vectorRanges[i] = addRanges(mulRanges(opRange(VECTOR_0, i), opRange(VECTOR_1, i)), opRange(VECTOR_2, i));
+            break;
+        case AluVectorOpcode::CndEq:
+        case AluVectorOpcode::CndGe:
+        case AluVectorOpcode::CndGt:
+            vectorRanges[i] = unionRanges(opRange(VECTOR_1, i), opRange(VECTOR_2, i));
+            break;
+        case AluVectorOpcode::Dp4:
+        case AluVectorOpcode::Dp3:
+        {
+            uint32_t componentCount = (instr.vectorOpcode == AluVectorOpcode::Dp4) ? 4 : 3;
+            vectorRanges[i] = mulRanges(opRange(VECTOR_0, 0), opRange(VECTOR_1, 0));
+            for (uint32_t j = 1; j < componentCount; j++)
+                vectorRanges[i] = addRanges(vectorRanges[i], mulRanges(opRange(VECTOR_0, j), opRange(VECTOR_1, j)));
+            break;
+        }
+        case AluVectorOpcode::Dp2Add:
+            vectorRanges[i] = addRanges(addRanges(mulRanges(opRange(VECTOR_0, 0), opRange(VECTOR_1, 0)),
+                mulRanges(opRange(VECTOR_0, 1), opRange(VECTOR_1, 1))), opRange(VECTOR_2, 0));
+            break;
+        default:
+            vectorRanges[i] = {};
+            break;
+        }
+
+        if (instr.vectorSaturate)
+            vectorRanges[i] = saturateRange(vectorRanges[i]);
+    }
+
     switch (instr.vectorOpcode)
     {
     case AluVectorOpcode::KillEq:
@@ -656,7 +2153,7 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
                 exportRegister = "output.oPos";
 
             #ifdef UNLEASHED_RECOMP
-                if (hasMtxProjection)
+                if (hasMtxProjection && !reverseZFromPosition)
                 {
                     indent();
                     out += "if ((g_SpecConstants() & SPEC_CONSTANT_REVERSE_Z) == 0 || iterationIndex == 0)\n";
@@ -708,6 +2205,7 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
     {
         indent();
         println("a0 = (int)clamp(floor(({}).w + 0.5), -256.0, 255.0);", op(VECTOR_0).expression);
+        setAddressRange(floorRange(addRanges(opRange(VECTOR_0, 3), makeRange(0.5f, 0.5f))));
     }
 
     uint32_t vectorWriteMask = instr.vectorWriteMask;
@@ -987,10 +2485,138 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
             out += ')';
 
         out += ";\n";
+
+        if (exportRegister.empty())
+        {
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                if ((vectorWriteMask >> i) & 0x1)
+                    setRegisterRange(instr.vectorDest, i, vectorRanges[i]);
+            }
+
+            invalidateFetchResults(instr.vectorDest);
+        }
     }
 
     if (instr.scalarOpcode != AluScalarOpcode::RetainPrev)
     {
+        ValueRange scalarRange;
+
+        switch (instr.scalarOpcode)
+        {
+        case AluScalarOpcode::Adds:
+            scalarRange = addRanges(opRange(SCALAR_0), opRange(SCALAR_1));
+            break;
+        case AluScalarOpcode::AddsPrev:
+            scalarRange = addRanges(opRange(SCALAR_0), previousScalarRange);
+            break;
+        case AluScalarOpcode::Muls:
+            scalarRange = mulRanges(opRange(SCALAR_0), opRange(SCALAR_1));
+            break;
+        case AluScalarOpcode::MulsPrev:
+        case AluScalarOpcode::MulsPrev2:
+            scalarRange = mulRanges(opRange(SCALAR_0), previousScalarRange);
+            break;
+        case AluScalarOpcode::Maxs:
+        case AluScalarOpcode::MaxAs:
+        case AluScalarOpcode::MaxAsf:
+            scalarRange = maxRanges(opRange(SCALAR_0), opRange(SCALAR_1));
+            break;
+        case AluScalarOpcode::Mins:
+            scalarRange = minRanges(opRange(SCALAR_0), opRange(SCALAR_1));
+            break;
+        case AluScalarOpcode::Seqs:
+        case AluScalarOpcode::Sgts:
+        case AluScalarOpcode::Sges:
+        case AluScalarOpcode::Snes:
+        case AluScalarOpcode::Frcs:
+        case AluScalarOpcode::SetpEq:
+        case AluScalarOpcode::SetpNe:
+        case AluScalarOpcode::SetpGt:
+        case AluScalarOpcode::SetpGe:
+        case AluScalarOpcode::KillsEq:
+        case AluScalarOpcode::KillsGt:
+        case AluScalarOpcode::KillsGe:
+        case AluScalarOpcode::KillsNe:
+        case AluScalarOpcode::KillsOne:
+            scalarRange = makeRange(0.0f, 1.0f);
+            break;
+        case AluScalarOpcode::Truncs:
+            scalarRange = truncRange(opRange(SCALAR_0));
+            break;
+        case AluScalarOpcode::Floors:
+            scalarRange = floorRange(opRange(SCALAR_0));
+            break;
+        case AluScalarOpcode::Exp:
+        {
+            ValueRange range = opRange(SCALAR_0);
+            if (isBounded(range))
+                scalarRange = makeRange(std::exp2(range.min), std::exp2(range.max));
+            break;
+        }
+        case AluScalarOpcode::Logc:
+        case AluScalarOpcode::Log:
+        {
+            ValueRange range = opRange(SCALAR_0);
+            if (isSafeForLogarithm(range))
+                scalarRange = makeRange(std::log2(range.min), std::log2(range.max));
+            break;
+        }
+        case AluScalarOpcode::Rcpc:
+        case AluScalarOpcode::Rcpf:
+        case AluScalarOpcode::Rcp:
+        {
+            ValueRange range = opRange(SCALAR_0);
+            if (isSafeForReciprocal(range))
+                scalarRange = makeRange(1.0f / range.max, 1.0f / range.min);
+            break;
+        }
+        case AluScalarOpcode::Rsqc:
+        case AluScalarOpcode::Rsqf:
+        case AluScalarOpcode::Rsq:
+        {
+            ValueRange range = opRange(SCALAR_0);
+            if (range.min >= MIN_SAFE_MAGNITUDE)
+                scalarRange = makeRange(1.0f / std::sqrt(range.max), 1.0f / std::sqrt(range.min));
+            break;
+        }
+        case AluScalarOpcode::Subs:
+            scalarRange = addRanges(opRange(SCALAR_0), negateRange(opRange(SCALAR_1)));
+            break;
+        case AluScalarOpcode::SubsPrev:
+            scalarRange = addRanges(opRange(SCALAR_0), negateRange(previousScalarRange));
+            break;
+        case AluScalarOpcode::SetpClr:
+            scalarRange = makeRange(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+            break;
+        case AluScalarOpcode::Sqrt:
+        {
+            ValueRange range = opRange(SCALAR_0);
+            if (range.min >= 0.0f)
+                scalarRange = makeRange(std::sqrt(range.min), std::sqrt(range.max));
+            break;
+        }
+        case AluScalarOpcode::Mulsc0:
+        case AluScalarOpcode::Mulsc1:
+            scalarRange = mulRanges(opRange(SCALAR_CONSTANT_0), opRange(SCALAR_CONSTANT_1));
+            break;
+        case AluScalarOpcode::Addsc0:
+        case AluScalarOpcode::Addsc1:
+            scalarRange = addRanges(opRange(SCALAR_CONSTANT_0), opRange(SCALAR_CONSTANT_1));
+            break;
+        case AluScalarOpcode::Subsc0:
+        case AluScalarOpcode::Subsc1:
+            scalarRange = addRanges(opRange(SCALAR_CONSTANT_0), negateRange(opRange(SCALAR_CONSTANT_1)));
+            break;
+        case AluScalarOpcode::Sin:
+        case AluScalarOpcode::Cos:
+            scalarRange = makeRange(-1.0f, 1.0f);
+            break;
+        }
+
+        if (instr.scalarSaturate)
+            scalarRange = saturateRange(scalarRange);
+
         if (instr.scalarOpcode >= AluScalarOpcode::SetpEq && instr.scalarOpcode <= AluScalarOpcode::SetpRstr)
         {
             indent();
@@ -1102,19 +2728,43 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
 
         case AluScalarOpcode::Logc:
         case AluScalarOpcode::Log:
-            print("clamp(log2({}), -FLT_MAX, FLT_MAX)", op(SCALAR_0).expression);
+            if (isSafeForLogarithm(opRange(SCALAR_0)))
+            {
+                print("log2({})", op(SCALAR_0).expression);
+                addClampRange(opRange(SCALAR_0));
+            }
+            else
+            {
+                print("clamp(log2({}), -FLT_MAX, FLT_MAX)", op(SCALAR_0).expression);
+            }
             break;
 
         case AluScalarOpcode::Rcpc:
         case AluScalarOpcode::Rcpf:
         case AluScalarOpcode::Rcp:
-            print("clamp(rcp({}), -FLT_MAX, FLT_MAX)", op(SCALAR_0).expression);
+            if (isSafeForReciprocal(opRange(SCALAR_0)))
+            {
+                print("rcp({})", op(SCALAR_0).expression);
+                addClampRange(opRange(SCALAR_0));
+            }
+            else
+            {
+                print("clamp(rcp({}), -FLT_MAX, FLT_MAX)", op(SCALAR_0).expression);
+            }
             break;
 
         case AluScalarOpcode::Rsqc:
         case AluScalarOpcode::Rsqf:
         case AluScalarOpcode::Rsq:
-            print("clamp(rsqrt({}), -FLT_MAX, FLT_MAX)", op(SCALAR_0).expression);
+            if (opRange(SCALAR_0).min >= MIN_SAFE_MAGNITUDE)
+            {
+                print("rsqrt({})", op(SCALAR_0).expression);
+                addClampRange(opRange(SCALAR_0));
+            }
+            else
+            {
+                print("clamp(rsqrt({}), -FLT_MAX, FLT_MAX)", op(SCALAR_0).expression);
+            }
             break;
 
         case AluScalarOpcode::Subs:
@@ -1201,15 +2851,20 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
 
         out += ";\n";
 
+        if (trackValueRanges)
+            previousScalarRange = (conditionalDepth != 0) ? unionRanges(previousScalarRange, scalarRange) : scalarRange;
+
         switch (instr.scalarOpcode)
         {
         case AluScalarOpcode::MaxAs:
             indent();
             println("a0 = (int)clamp(floor({} + 0.5), -256.0, 255.0);", op(SCALAR_0).expression);
+            setAddressRange(floorRange(addRanges(opRange(SCALAR_0), makeRange(0.5f, 0.5f))));
             break;     
         case AluScalarOpcode::MaxAsf:
             indent();
             println("a0 = (int)clamp(floor({}), -256.0, 255.0);", op(SCALAR_0).expression);
+            setAddressRange(floorRange(opRange(SCALAR_0)));
             break;
         }
     }
@@ -1238,7 +2893,18 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
                 out += SWIZZLES[i];
         }
 
-        out += " = ps;\n";
+        out += " = ps;\n";
+
+        if (exportRegister.empty())
+        {
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                if ((scalarWriteMask >> i) & 0x1)
+                    setRegisterRange(instr.scalarDest, i, previousScalarRange);
+            }
+
+            invalidateFetchResults(instr.scalarDest);
+        }
     }
 
     if (instr.exportData)
@@ -1280,6 +2946,7 @@ void ShaderRecompiler::recompile(const AluInstruction& instr)
         --indentation;
         indent();
         out += "}\n";
+        --conditionalDepth;
     }
 }
 
@@ -1341,6 +3008,8 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
 
                 println("#define {}(INDEX) selectWrapper((INDEX) < {}, vk::RawBufferLoad<float4>(g_PushConstants.{}ShaderConstants + ({} + min(INDEX, {})) * 16, 0x10), 0.0)",
                     constantName, tailCount, shaderName, constantInfo->registerIndex.get(), tailCount - 1);
+                println("#define {}_Unchecked(INDEX) vk::RawBufferLoad<float4>(g_PushConstants.{}ShaderConstants + ({} + (INDEX)) * 16, 0x10)",
+                    constantName, shaderName, constantInfo->registerIndex.get());
             }
             else
             {
@@ -1410,6 +3079,8 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
 
                 println("#define {}(INDEX) selectWrapper((INDEX) < {}, (*(reinterpret_cast<device float4*>(g_PushConstants.{}ShaderConstants + ({} + min(INDEX, {})) * 16))), 0.0)",
                     constantName, tailCount, shaderName, constantInfo->registerIndex.get(), tailCount - 1);
+                println("#define {}_Unchecked(INDEX) (*(reinterpret_cast<device float4*>(g_PushConstants.{}ShaderConstants + ({} + (INDEX)) * 16)))",
+                    constantName, shaderName, constantInfo->registerIndex.get());
             }
             else
             {
@@ -1466,6 +3137,7 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
             {
                 uint32_t tailCount = (isPixelShader ? 224 : 256) - constantInfo->registerIndex;
                 println("#define {0}(INDEX) selectWrapper((INDEX) < {1}, {0}[min(INDEX, {2})], 0.0)", constantName, tailCount, tailCount - 1);
+                println("#define {0}_Unchecked(INDEX) {0}[INDEX]", constantName);
             }
         }
     }
@@ -1516,6 +3188,45 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
     out += '\n';
 
     const auto shader = reinterpret_cast<const Shader*>(shaderData + shaderContainer->shaderOffset);
+    const be<uint32_t>* code = reinterpret_cast<const be<uint32_t>*>(shaderData + shaderContainer->virtualSize + shader->physicalOffset);
+
+    // Packed interpolator components in slot order, as pairs of INTERPOLATORS index and component.
+    std::vector<std::pair<size_t, uint32_t>> packedComponents;
+
+    if (packInterpolators)
+    {
+        uint32_t interpolatorMasks[std::size(INTERPOLATORS)]{};
+        if (!linkedInterpolatorMasks.empty())
+            std::copy(linkedInterpolatorMasks.begin(), linkedInterpolatorMasks.end(), interpolatorMasks);
+        else
+            getInterpolatorMasks(shader, isPixelShader, code, interpolatorMasks);
+
+        std::string signature;
+
+        for (size_t i = 0; i < std::size(INTERPOLATORS); i++)
+        {
+            if (interpolatorMasks[i] == 0)
+                continue;
+
+            auto& [usage, usageIndex] = INTERPOLATORS[i];
+            signature += fmt::format("{}{}.", USAGE_SEMANTICS[uint32_t(usage)], usageIndex);
+
+            for (uint32_t j = 0; j < 4; j++)
+            {
+                if ((interpolatorMasks[i] >> j) & 0x1)
+                {
+                    signature += SWIZZLES[j];
+                    packedComponents.emplace_back(i, j);
+                }
+            }
+
+            signature += ' ';
+        }
+
+        interpolatorSignature = XXH3_64bits(signature.data(), signature.size());
+    }
+
+    const size_t packedSlotCount = (packedComponents.size() + 3) / 4;
 
     println("struct {}", isPixelShader ? "Interpolators" : "VertexShaderInput");
     out += "{\n";
@@ -1526,15 +3237,31 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
 
         out += "\tfloat4 iPos [[position]];\n";
 
-        for (auto& [usage, usageIndex] : INTERPOLATORS)
-            println("\tfloat4 i{0}{1} [[user({2}{1})]];", USAGE_VARIABLES[uint32_t(usage)], usageIndex, USAGE_SEMANTICS[uint32_t(usage)]);
+        if (packInterpolators)
+        {
+            for (size_t i = 0; i < packedSlotCount; i++)
+                println("\tfloat4 iPacked{0} [[user(TEXCOORD{0})]];", i);
+        }
+        else
+        {
+            for (auto& [usage, usageIndex] : INTERPOLATORS)
+                println("\tfloat4 i{0}{1} [[user({2}{1})]];", USAGE_VARIABLES[uint32_t(usage)], usageIndex, USAGE_SEMANTICS[uint32_t(usage)]);
+        }
 
         out += "#else\n";
 
         out += "\tfloat4 iPos : SV_Position;\n";
 
-        for (auto& [usage, usageIndex] : INTERPOLATORS)
-            println("\tfloat4 i{0}{1} : {2}{1};", USAGE_VARIABLES[uint32_t(usage)], usageIndex, USAGE_SEMANTICS[uint32_t(usage)]);
+        if (packInterpolators)
+        {
+            for (size_t i = 0; i < packedSlotCount; i++)
+                println("\tfloat4 iPacked{0} : TEXCOORD{0};", i);
+        }
+        else
+        {
+            for (auto& [usage, usageIndex] : INTERPOLATORS)
+                println("\tfloat4 i{0}{1} : {2}{1};", USAGE_VARIABLES[uint32_t(usage)], usageIndex, USAGE_SEMANTICS[uint32_t(usage)]);
+        }
 
         out += "#endif\n";
     }
@@ -1575,6 +3302,14 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                 if (usageLocation.usage == vertexElement.usage && usageLocation.usageIndex == vertexElement.usageIndex)
                 {
                     println(" [[attribute({})]];", usageLocation.location);
+
+                    auto& inputElement = inputElements.emplace_back();
+                    inputElement.semanticName = USAGE_SEMANTICS[uint32_t(vertexElement.usage)];
+                    inputElement.usage = vertexElement.usage;
+                    inputElement.usageIndex = vertexElement.usageIndex;
+                    inputElement.location = usageLocation.location;
+                    inputElement.componentType = strcmp(usageType, "uint4") == 0 ? SHADER_INPUT_COMPONENT_TYPE_UINT : SHADER_INPUT_COMPONENT_TYPE_FLOAT;
+
                     foundUsage = true;
                     break;
                 }
@@ -1689,6 +3424,64 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
 
     out += "};\n";
 
+    if (!isPixelShader && packInterpolators)
+    {
+        out += "struct PackedInterpolators\n";
+        out += "{\n";
+        out += "#ifdef __air__\n";
+
+        out += "\tfloat4 oPos [[position]] [[invariant]];\n";
+
+        for (size_t i = 0; i < packedSlotCount; i++)
+            println("\tfloat4 oPacked{0} [[user(TEXCOORD{0})]];", i);
+
+        out += "\tfloat clipDistance [[clip_distance]];\n";
+
+        out += "#else\n";
+
+        out += "\tprecise float4 oPos : SV_Position;\n";
+
+        for (size_t i = 0; i < packedSlotCount; i++)
+            println("\tfloat4 oPacked{0} : TEXCOORD{0};", i);
+
+        out += "\tfloat clipDistance : SV_ClipDistance;\n";
+
+        out += "#endif\n";
+        out += "};\n";
+
+        out += "PackedInterpolators packInterpolators(Interpolators output)\n";
+        out += "{\n";
+        out += "\tPackedInterpolators packed;\n";
+        out += "\tpacked.oPos = output.oPos;\n";
+
+        for (size_t i = 0; i < packedSlotCount; i++)
+        {
+            print("\tpacked.oPacked{} = float4(", i);
+
+            for (size_t j = i * 4; j < i * 4 + 4; j++)
+            {
+                if (j != i * 4)
+                    out += ", ";
+
+                if (j < packedComponents.size())
+                {
+                    auto& [usage, usageIndex] = INTERPOLATORS[packedComponents[j].first];
+                    print("output.o{}{}.{}", USAGE_VARIABLES[uint32_t(usage)], usageIndex, SWIZZLES[packedComponents[j].second]);
+                }
+                else
+                {
+                    out += "0.0";
+                }
+            }
+
+            out += ");\n";
+        }
+
+        out += "\tpacked.clipDistance = output.clipDistance;\n";
+        out += "\treturn packed;\n";
+        out += "}\n";
+    }
+
     out += "#ifdef __air__\n";
 
     if (isPixelShader)
@@ -1722,7 +3515,10 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
 
     out += "#endif\n";
 
-    println("{} shaderMain(", isPixelShader ? "PixelShaderOutput" : "Interpolators");
+    if (isPixelShader)
+        out += "PixelShaderOutput shaderMain(\n";
+    else
+        println("{} shaderMain(", packInterpolators ? "PackedInterpolators" : "Interpolators");
 
     if (isPixelShader)
     {
@@ -1780,6 +3576,7 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
     out += "{\n";
 
     std::string outputName = isPixelShader ? "PixelShaderOutput" : "Interpolators";
+    std::string_view returnValue = (!isPixelShader && packInterpolators) ? "packInterpolators(output)" : "output";
 
     out += "#ifdef __air__\n";
     println("\t{0} output = {0}{{}};", outputName);
@@ -1787,6 +3584,9 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
     println("\t{0} output = ({0})0;", outputName);
     out += "#endif\n";
 
+    // Declarations of the hoisted loads are inserted here once the body is emitted.
+    size_t hoistedLoadsPosition = out.size();
+
 #ifdef UNLEASHED_RECOMP
     if (hasMtxProjection)
     {
@@ -1794,14 +3594,30 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
 
         out += "\toutput.oPos = 0.0;\n";
 
-        out += "\tfloat4x4 mtxProjection = float4x4(g_MtxProjection(0), g_MtxProjection(1), g_MtxProjection(2), g_MtxProjection(3));\n";
-        out += "\tfloat4x4 mtxProjectionReverseZ = mul(mtxProjection, float4x4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, -1, 0, 0, 0, 1, 1));\n";
+        auto isProjectionConstant = [&](uint32_t reg)
+            {
+                auto findResult = float4Constants.find(reg);
+                return findResult != float4Constants.end() &&
+                    strcmp(reinterpret_cast<const char*>(constantTableData + findResult->second->name), "g_MtxProjection") == 0;
+            };
 
-        out += "\tUNROLL for (int iterationIndex = 0; iterationIndex < 2; iterationIndex++)\n";
-        out += "\t{\n";
+        reverseZFromPosition = isPositionProjected(code, decodeControlFlow(code, shader->size), isProjectionConstant);
+
+        // Otherwise, the shader runs with the reverse-Z projection first, and again with the regular one for everything but the position.
+        if (!reverseZFromPosition)
+        {
+            out += "\tfloat4x4 mtxProjection = float4x4(g_MtxProjection(0), g_MtxProjection(1), g_MtxProjection(2), g_MtxProjection(3));\n";
+            out += "\tfloat4x4 mtxProjectionReverseZ = mul(mtxProjection, float4x4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, -1, 0, 0, 0, 1, 1));\n";
+
+            out += "\tUNROLL for (int iterationIndex = 0; iterationIndex < 2; iterationIndex++)\n";
+            out += "\t{\n";
+        }
     }
 #endif
 
+    // Trip counts of loops using integer constants from the definition table.
+    std::unordered_map<uint32_t, int32_t> loopCounts;
+
     if (shaderContainer->definitionTableOffset != NULL)
     {
         auto definitionTable = reinterpret_cast<const DefinitionTable*>(shaderData + shaderContainer->definitionTableOffset);
@@ -1812,6 +3628,14 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
             auto value = reinterpret_cast<const be<uint32_t>*>(shaderData + shaderContainer->virtualSize + definition->physicalOffset);
             for (uint16_t i = 0; i < (definition->count + 3) / 4; i++)
             {
+                for (uint32_t j = 0; j < 4; j++)
+                {
+                    uint32_t bits = value[j];
+                    float literal;
+                    memcpy(&literal, &bits, sizeof(literal));
+                    literalConstants[(definition->registerIndex + i - (isPixelShader ? 256 : 0)) * 4 + j] = literal;
+                }
+
                 println("#ifdef __air__");
                 println("\tfloat4 c{} = as_type<float4>(uint4(0x{:X}, 0x{:X}, 0x{:X}, 0x{:X}));",
                     definition->registerIndex + i - (isPixelShader ? 256 : 0), value[0].get(), value[1].get(), value[2].get(), value[3].get());
@@ -1846,6 +3670,8 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
 
                 println("\tint4 i{} = int4({}, {}, {}, {});",
                     (definition->registerIndex - 8992) / 4 + i, x, y, z, w);
+
+                loopCounts[(definition->registerIndex - 8992) / 4 + i] = x;
             }
             definitions += 2;
             definitions += definition->count;
@@ -1854,6 +3680,16 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
         out += "\n";
     }
 
+    // Registers only carrying colors are stored with reduced precision.
+    uint64_t colorRegisters = 0;
+    if (isPixelShader && reducedPrecision)
+        colorRegisters = getColorRegisters(shader, code, decodeControlFlow(code, shader->size));
+
+    auto getRegisterType = [&](uint32_t reg)
+        {
+            return ((colorRegisters >> reg) & 0x1) != 0 ? "min16float4" : "float4";
+        };
+
     bool printedRegisters[32]{};
 
     uint32_t interpolatorCount = (shader->interpolatorInfo >> 5) & 0x1F;
@@ -1869,7 +3705,38 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
         if (isPixelShader)
         {
             value = reinterpret_cast<const PixelShader*>(shader)->interpolators[i];
-            println("\tfloat4 r{} = input.i{}{};", uint32_t(interpolator.reg), USAGE_VARIABLES[uint32_t(interpolator.usage)], uint32_t(interpolator.usageIndex));
+
+            if (packInterpolators)
+            {
+                print("\t{} r{} = float4(", getRegisterType(interpolator.reg), uint32_t(interpolator.reg));
+
+                for (uint32_t j = 0; j < 4; j++)
+                {
+                    if (j != 0)
+                        out += ", ";
+
+                    auto findResult = std::find(packedComponents.begin(), packedComponents.end(),
+                        std::make_pair(findInterpolator(interpolator.usage, interpolator.usageIndex), j));
+
+                    if (findResult != packedComponents.end())
+                    {
+                        size_t slot = findResult - packedComponents.begin();
+                        print("input.iPacked{}.{}", slot / 4, SWIZZLES[slot % 4]);
+                    }
+                    else
+                    {
+                        out += "0.0";
+                    }
+                }
+
+                out += ");\n";
+            }
+            else
+            {
+                println("\t{} r{} = input.i{}{};", getRegisterType(interpolator.reg), uint32_t(interpolator.reg),
+                    USAGE_VARIABLES[uint32_t(interpolator.usage)], uint32_t(interpolator.usageIndex));
+            }
+
             printedRegisters[interpolator.reg] = true;
         }
         else
@@ -1893,11 +3760,16 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
         out += "\n";
     }
 
+    resetRegisterRanges();
+    previousScalarRange = makeRange(0.0f, 0.0f);
+    addressRange = makeRange(0.0f, 0.0f);
+    loopIndexRange = makeRange(0.0f, 0.0f);
+
     for (size_t i = 0; i < 32; i++)
     {
         if (!printedRegisters[i])
         {
-            print("\tfloat4 r{} = ", i);
+            print("\t{} r{} = ", getRegisterType(i), i);
             if (isPixelShader && i == ((shader->fieldC >> 8) & 0xFF))
             {
                 out += "float4((input.iPos.xy - 0.5) * float2(iFace ? 1.0 : -1.0, 1.0), 0.0, 0.0);\n";
@@ -1911,6 +3783,9 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
             else
             {
                 out += "0.0;\n";
+
+                for (auto& range : registerRanges[i])
+                    range = makeRange(0.0f, 0.0f);
             }
         }
     }
@@ -1946,72 +3821,57 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
 #endif
     }
 
-    const be<uint32_t>* code = reinterpret_cast<const be<uint32_t>*>(shaderData + shaderContainer->virtualSize + shader->physicalOffset);
+    const auto controlFlow = decodeControlFlow(code, shader->size);
+    bool simpleControlFlow = true;
 
-    union
+    for (auto& cfInstr : controlFlow)
     {
-        ControlFlowInstruction controlFlow[2];
-        struct
+        if (cfInstr.opcode == ControlFlowOpcode::CondJmp)
         {
-            uint32_t code0;
-            uint32_t code1;
-            uint32_t code2;
-            uint32_t code3;
-        };
-    };
+            if (cfInstr.condJmp.isUnconditional || cfInstr.condJmp.direction)
+                simpleControlFlow = false;
+            else
+                ++ifEndLabels[cfInstr.condJmp.address];
+        }
+    }
 
-    auto controlFlowCode = code;
-    uint32_t instrAddress = 0;
-    uint32_t instrSize = shader->size;
-    bool simpleControlFlow = true;
+    trackValueRanges = simpleControlFlow;
+    reuseFetchResults = reuseFetches && simpleControlFlow;
+    if (!trackValueRanges)
+        resetRegisterRanges();
 
-    while (instrAddress < instrSize)
-    {
-        code0 = controlFlowCode[0];
-        code1 = controlFlowCode[1] & 0xFFFF;
-        code2 = (controlFlowCode[1] >> 16) | (controlFlowCode[2] << 16);
-        code3 = controlFlowCode[2] >> 16;
+    size_t interpolatorIndices[32];
+    getInterpolatorIndices(shader, isPixelShader, interpolatorIndices);
 
-        for (auto& cfInstr : controlFlow)
+    // Drops the interpolator export components the linked pixel shader never reads.
+    auto linkInstruction = [&](AluInstruction& instr)
         {
-            uint32_t address = 0;
-
-            switch (cfInstr.opcode)
+            if (instr.exportData && instr.vectorDest <= uint32_t(ExportRegister::VSInterpolator15) &&
+                interpolatorIndices[instr.vectorDest] != std::size(INTERPOLATORS))
             {
-            case ControlFlowOpcode::Exec:
-            case ControlFlowOpcode::ExecEnd:
-                address = cfInstr.exec.address;
-                break;
+                uint32_t linkedMask = linkedInterpolatorMasks[interpolatorIndices[instr.vectorDest]];
+                uint32_t zeroMask = instr.scalarDestRelative ? (0b1111 & ~(instr.vectorWriteMask | instr.scalarWriteMask)) : 0;
 
-            case ControlFlowOpcode::CondExec:
-            case ControlFlowOpcode::CondExecEnd:
-            case ControlFlowOpcode::CondExecPredClean:
-            case ControlFlowOpcode::CondExecPredCleanEnd:
-                address = cfInstr.condExec.address;
-                break;
+                instr.vectorWriteMask &= linkedMask;
+                instr.scalarWriteMask &= linkedMask;
 
-            case ControlFlowOpcode::CondExecPred:
-            case ControlFlowOpcode::CondExecPredEnd:
-                address = cfInstr.condExecPred.address;
-                break;
+                if ((zeroMask & linkedMask) == 0)
+                    instr.scalarDestRelative = 0;
+            }
+        };
 
-            case ControlFlowOpcode::CondJmp:
-            {
-                if (cfInstr.condJmp.isUnconditional || cfInstr.condJmp.direction)
-                    simpleControlFlow = false;
-                else
-                    ++ifEndLabels[cfInstr.condJmp.address];
+    std::unordered_map<uint32_t, uint32_t> instructionLiveness;
+    bool linkInterpolators = !isPixelShader && !linkedInterpolatorMasks.empty();
 
-                break;
-            }
-            }
+    if (linkInterpolators)
+    {
+        instructionLiveness = getInstructionLiveness(code, controlFlow, isPixelShader, linkInstruction);
 
-            if (address != 0)
-                instrSize = std::min<uint32_t>(instrSize, address * 12);
+        for (size_t i = 0; i < std::size(linkedExportMasks); i++)
+        {
+            if (interpolatorIndices[i] != std::size(INTERPOLATORS))
+                linkedExportMasks[i] = linkedInterpolatorMasks[interpolatorIndices[i]];
         }
-
-        controlFlowCode += 3;
-        instrAddress += 12;
     }
 
     if (simpleControlFlow)
@@ -2028,19 +3888,31 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
         out += "\t\t{\n";
     }
 
-    controlFlowCode = code;
-    instrAddress = 0;
-    uint32_t pc = 0;
+    auto closeIfBlocks = [&](size_t pc)
+        {
+            auto findResult = ifEndLabels.find(pc);
+            if (findResult != ifEndLabels.end())
+            {
+                for (uint32_t i = 0; i < findResult->second; i++)
+                {
+                    --indentation;
+                    --conditionalDepth;
+                    indent();
+                    out += "}\n";
+                }
+
+                closeFetchScopes();
+            }
+        };
 
-    while (instrAddress < instrSize)
-    {
-        code0 = controlFlowCode[0];
-        code1 = controlFlowCode[1] & 0xFFFF;
-        code2 = (controlFlowCode[1] >> 16) | (controlFlowCode[2] << 16);
-        code3 = controlFlowCode[2] >> 16;
+    // Values of aL once each loop being emitted exits.
+    std::vector<ValueRange> loopExitRanges;
 
-        for (auto& cfInstr : controlFlow)
+    // Emits the control flow instruction at the given index and returns the index of the next one.
+    auto emitControlFlow = [&](auto& self, size_t pc) -> size_t
         {
+            auto& cfInstr = controlFlow[pc];
+
             if (!simpleControlFlow)
             {
                 indentation = 3;
@@ -2048,64 +3920,105 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
             }
             else
             {
-                auto findResult = ifEndLabels.find(pc);
-                if (findResult != ifEndLabels.end())
-                {
-                    for (uint32_t i = 0; i < findResult->second; i++)
-                    {
-                        --indentation;
-                        indent();
-                        out += "}\n";
-                    }
-                }
+                closeIfBlocks(pc);
             }
 
-            ++pc;
-
-            uint32_t address = 0;
-            uint32_t count = 0;
-            uint32_t sequence = 0;
-            bool shouldReturn = false;
+            ExecBlock execBlock = getExecBlock(cfInstr);
 
             switch (cfInstr.opcode)
             {
-            case ControlFlowOpcode::Exec:
-            case ControlFlowOpcode::ExecEnd:
-                address = cfInstr.exec.address;
-                count = cfInstr.exec.count;
-                sequence = cfInstr.exec.sequence;
-                shouldReturn = (cfInstr.opcode == ControlFlowOpcode::ExecEnd);
-                break;
-
-            case ControlFlowOpcode::CondExec:
-            case ControlFlowOpcode::CondExecEnd:
-            case ControlFlowOpcode::CondExecPredClean:
-            case ControlFlowOpcode::CondExecPredCleanEnd:
-                address = cfInstr.condExec.address;
-                count = cfInstr.condExec.count;
-                sequence = cfInstr.condExec.sequence;
-                shouldReturn = (cfInstr.opcode == ControlFlowOpcode::CondExecEnd || cfInstr.opcode == ControlFlowOpcode::CondExecEnd);
-                break;
-
-            case ControlFlowOpcode::CondExecPred:
-            case ControlFlowOpcode::CondExecPredEnd:
-                address = cfInstr.condExecPred.address;
-                count = cfInstr.condExecPred.count;
-                sequence = cfInstr.condExecPred.sequence;
-                shouldReturn = (cfInstr.opcode == ControlFlowOpcode::CondExecPredEnd);
-                break;
-
             case ControlFlowOpcode::LoopStart:
                 if (simpleControlFlow)
                 {
+                    auto findResult = loopCounts.find(cfInstr.loopStart.loopId);
+                    if (findResult != loopCounts.end() && findResult->second <= MAX_UNROLLED_LOOP_ITERATIONS)
+                    {
+                        size_t loopEnd = findLoopEnd(controlFlow, pc);
+                        if (loopEnd != 0)
+                        {
+                            // Emit the body once per iteration, with aL folded into a constant.
+                            std::string previousLoopIndex = loopIndex;
+                            ValueRange previousLoopIndexRange = loopIndexRange;
+
+                            for (int32_t i = 0; i < findResult->second; i++)
+                            {
+                                loopIndex = std::to_string(i);
+                                loopIndexRange = makeRange(float(i), float(i));
+
+                                indent();
+                                println("{{ // aL = {}", i);
+                                ++indentation;
+
+                                for (size_t j = pc + 1; j < loopEnd;)
+                                    j = self(self, j);
+
+                                closeIfBlocks(loopEnd);
+
+                                --indentation;
+                                indent();
+                                out += "}\n";
+
+                                closeFetchScopes();
+                            }
+
+                            // aL is left at the trip count once the loop exits, like with the emitted loops.
+                            int32_t tripCount = std::max(findResult->second, 0);
+
+                            indent();
+                            println("aL = {};", tripCount);
+
+                            loopIndex = previousLoopIndex;
+                            loopIndexRange = previousLoopIndexRange;
+
+                            // Nested in another unrolled loop, relative accesses keep using the literal of the outer one.
+                            if (loopIndex == "aL")
+                            {
+                                ValueRange exitRange = makeRange(float(tripCount), float(tripCount));
+                                loopIndexRange = conditionalDepth != 0 ? unionRanges(loopIndexRange, exitRange) : exitRange;
+                            }
+
+                            return loopEnd + 1;
+                        }
+                    }
+
                     indent();
                 #ifdef UNLEASHED_RECOMP
                     print("UNROLL ");
                 #endif
-                    println("for (aL = 0; aL < i{}.x; aL++)", uint32_t(cfInstr.loopStart.loopId));
+                    if (findResult != loopCounts.end())
+                    {
+                    #ifndef UNLEASHED_RECOMP
+                        print("UNROLL_COUNT({}) ", std::max(findResult->second, 1));
+                    #endif
+                        println("for (aL = 0; aL < {}; aL++)", findResult->second);
+                    }
+                    else
+                    {
+                        println("for (aL = 0; aL < i{}.x; aL++)", uint32_t(cfInstr.loopStart.loopId));
+                    }
+
                     indent();
                     out += "{\n";
                     ++indentation;
+
+                    // Ranges can't be tracked across iterations, and later iterations may have written the source of any fetch.
+                    resetRegisterRanges();
+                    fetchResults.clear();
+
+                    // aL is left at the trip count once the loop exits.
+                    ValueRange exitRange;
+                    if (findResult != loopCounts.end())
+                        exitRange = makeRange(float(std::max(findResult->second, 0)), float(std::max(findResult->second, 0)));
+
+                    if (conditionalDepth != 0)
+                        exitRange = unionRanges(loopIndexRange, exitRange);
+
+                    loopExitRanges.push_back(exitRange);
+
+                    if (findResult != loopCounts.end() && findResult->second > 0)
+                        loopIndexRange = makeRange(0.0f, float(findResult->second - 1));
+                    else
+                        loopIndexRange = {};
                 }
                 else 
                 {
@@ -2119,6 +4032,19 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                     --indentation;
                     indent();
                     out += "}\n";
+
+                    resetRegisterRanges();
+                    closeFetchScopes();
+
+                    if (!loopExitRanges.empty())
+                    {
+                        loopIndexRange = loopExitRanges.back();
+                        loopExitRanges.pop_back();
+                    }
+                    else
+                    {
+                        loopIndexRange = {};
+                    }
                 }
                 else
                 {
@@ -2150,7 +4076,15 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                     {
                         auto findResult = boolConstants.find(cfInstr.condJmp.boolAddress);
                         if (findResult != boolConstants.end())
-                            println("if ((g_Booleans & {}) {}= 0)", findResult->second, cfInstr.condJmp.condition ^ simpleControlFlow ? "!" : "=");
+                        {
+                            uint32_t booleanBit = 1u << (findResult->first + (isPixelShader ? 16 : 0));
+                            booleansMask |= booleanBit;
+
+                            if (specializeBooleans)
+                                println("if ({})", ((specializedBooleans & booleanBit) != 0) == (cfInstr.condJmp.condition ^ simpleControlFlow) ? "true" : "false");
+                            else
+                                println("if ((g_Booleans & {}) {}= 0)", findResult->second, cfInstr.condJmp.condition ^ simpleControlFlow ? "!" : "=");
+                        }
                         else
                             println("if ({})", cfInstr.condJmp.condition ^ simpleControlFlow ? "false" : "true"); 
                         // println("if (b{} {}= 0)", uint32_t(cfInstr.condJmp.boolAddress), cfInstr.condJmp.condition ^ simpleControlFlow ? "!" : "=");
@@ -2161,6 +4095,7 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                         indent();
                         out += "{\n";
                         ++indentation;
+                        ++conditionalDepth;
                     }
                     else
                     {
@@ -2174,37 +4109,62 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
             }
             }
 
-            auto instructionCode = code + address * 3;
-            
-            for (uint32_t i = 0; i < count; i++)
+            auto instructionCode = code + execBlock.address * 3;
+            uint32_t sequence = execBlock.sequence;
+
+            for (uint32_t i = 0; i < execBlock.count; i++)
             {
-                union
+                Instruction instr;
+                instr.code[0] = instructionCode[0];
+                instr.code[1] = instructionCode[1];
+                instr.code[2] = instructionCode[2];
+
+                bool isFetch = (sequence & 0x1) != 0;
+                bool isLive = true;
+
+                if (linkInterpolators)
                 {
-                    VertexFetchInstruction vertexFetch;
-                    TextureFetchInstruction textureFetch;
-                    AluInstruction alu;
-                    struct
+                    uint32_t liveness = instructionLiveness[execBlock.address + i];
+
+                    if (isFetch)
                     {
-                        uint32_t code0;
-                        uint32_t code1;
-                        uint32_t code2;
-                    };
-                };
-            
-                code0 = instructionCode[0];
-                code1 = instructionCode[1];
-                code2 = instructionCode[2];
-            
-                if ((sequence & 0x1) != 0)
+                        isLive = (liveness & LIVE_VECTOR) != 0;
+                    }
+                    else
+                    {
+                        isLive = liveness != 0;
+                        linkInstruction(instr.alu);
+
+                        if (!(liveness & LIVE_VECTOR))
+                            instr.alu.vectorWriteMask = 0;
+
+                        if (!(liveness & LIVE_SCALAR_WRITE))
+                            instr.alu.scalarWriteMask = 0;
+
+                        if (!(liveness & LIVE_SCALAR_RESULT))
+                            instr.alu.scalarOpcode = AluScalarOpcode::RetainPrev;
+                    }
+
+                    auto& linkedInstruction = linkedInstructions[execBlock.address + i];
+                    linkedInstruction = instr;
+
+                    if (isFetch && !isLive)
+                        linkedInstruction.vertexFetch.dstSwizzle = 0xFFF;
+                }
+
+                instructionAddress = execBlock.address + i;
+
+                // Instructions only feeding exports the linked pixel shader never reads are not emitted.
+                if (isFetch && isLive)
                 {
-                    if (vertexFetch.opcode == FetchOpcode::VertexFetch)
+                    if (instr.vertexFetch.opcode == FetchOpcode::VertexFetch)
                     {
-                        recompile(vertexFetch, address + i);
+                        recompile(instr.vertexFetch, execBlock.address + i);
                     }
                     else
                     {
                     #ifdef UNLEASHED_RECOMP
-                        if (textureFetch.constIndex == 10) // g_GISampler
+                        if (instr.textureFetch.constIndex == 10) // g_GISampler
                         {
                             specConstantsMask |= SPEC_CONSTANT_BICUBIC_GI_FILTER;
 
@@ -2214,7 +4174,7 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                             out += "{\n";
 
                             ++indentation;
-                            recompile(textureFetch, true);
+                            recompile(instr.textureFetch, true);
                             --indentation;
 
                             indent();
@@ -2225,7 +4185,7 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                             out += "{\n";
 
                             ++indentation;
-                            recompile(textureFetch, false);
+                            recompile(instr.textureFetch, false);
                             --indentation;
 
                             indent();
@@ -2234,20 +4194,20 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                         else
                     #endif
                         {
-                            recompile(textureFetch, false);
+                            recompile(instr.textureFetch, false);
                         }
                     }
                 }
-                else
+                else if (!isFetch && isLive)
                 {
-                    recompile(alu);
+                    recompile(instr.alu);
                 }
-            
+
                 sequence >>= 2;
                 instructionCode += 3;
             }
 
-            if (shouldReturn)
+            if (execBlock.shouldReturn)
             {
                 if (isPixelShader)
                 {
@@ -2298,22 +4258,42 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                 }
                 else
                 {
-                    out += "\tif (g_ClipPlaneEnabled) output.clipDistance = dot(output.oPos, g_ClipPlane);\n";
-                    out += "\toutput.oPos.xy += g_HalfPixelOffset * output.oPos.w;\n";
+                #ifdef UNLEASHED_RECOMP
+                    if (reverseZFromPosition)
+                        out += "\tif (g_SpecConstants() & SPEC_CONSTANT_REVERSE_Z) output.oPos.z = output.oPos.w - output.oPos.z;\n";
+                #endif
+
+                    if (specializeSharedFlags)
+                    {
+                        specConstantsMask |= SPEC_CONSTANT_CLIP_PLANE;
+                        out += "\tif (g_SpecConstants() & SPEC_CONSTANT_CLIP_PLANE) output.clipDistance = dot(output.oPos, g_ClipPlane);\n";
+                    }
+                    else
+                    {
+                        out += "\tif (g_ClipPlaneEnabled) output.clipDistance = dot(output.oPos, g_ClipPlane);\n";
+                    }
+
+                #ifdef UNLEASHED_RECOMP
+                    // The position from the first iteration is kept with reverse-Z, so it is only offset by the last one.
+                    if (hasMtxProjection && !reverseZFromPosition)
+                        out += "\tif (iterationIndex == 1) output.oPos.xy += g_HalfPixelOffset * output.oPos.w;\n";
+                    else
+                #endif
+                        out += "\toutput.oPos.xy += g_HalfPixelOffset * output.oPos.w;\n";
                 }
 
                 if (simpleControlFlow)
                 {
                     indent();
                 #ifdef UNLEASHED_RECOMP
-                    if (hasMtxProjection)
+                    if (hasMtxProjection && !reverseZFromPosition)
                     {
                         out += "continue;\n";
                     }
                     else
                 #endif
                     {
-                        out += "return output;\n";
+                        println("return {};", returnValue);
                     }
                 }
                 else
@@ -2321,11 +4301,12 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
                     out += "\t\t\tbreak;\n";
                 }
             }
-        }
 
-        controlFlowCode += 3;
-        instrAddress += 12;
-    }
+            return pc + 1;
+        };
+
+    for (size_t pc = 0; pc < controlFlow.size();)
+        pc = emitControlFlow(emitControlFlow, pc);
 
     if (!simpleControlFlow)
     {
@@ -2336,16 +4317,29 @@ void ShaderRecompiler::recompile(const uint8_t* shaderData, const std::string_vi
     }
 
 #ifdef UNLEASHED_RECOMP
-    if (hasMtxProjection)
+    if (hasMtxProjection && !reverseZFromPosition)
         out += "\t}\n";
 #endif
 
     if (!simpleControlFlow)
-        out += "\treturn output;\n";
+        println("\treturn {};", returnValue);
 #ifdef UNLEASHED_RECOMP
-    else if (hasMtxProjection)
-        out += "\treturn output;\n";
+    else if (hasMtxProjection && !reverseZFromPosition)
+        println("\treturn {};", returnValue);
 #endif
 
     out += "}";
+
+    if (!hoistedLoads.empty())
+    {
+        std::string declarations;
+        for (auto& [localName, load] : hoistedLoads)
+            declarations += fmt::format("\t{} {} = {};\n", load.first, localName, load.second);
+
+        out.insert(hoistedLoadsPosition, declarations);
+        hoistedLoads.clear();
+    }
+    fetchResults.clear();
+    fetchResultCount = 0;
+    pixelCoordFetch.clear();
 }
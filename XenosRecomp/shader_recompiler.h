@@ -3,6 +3,8 @@
 #include "shader.h"
 #include "shader_code.h"
 
+#include <unordered_set>
+
 struct StringBuffer
 {
     std::string out;
@@ -21,21 +23,119 @@ struct StringBuffer
     }
 };
 
+struct InputElement
+{
+    const char* semanticName = nullptr;
+    DeclUsage usage = DeclUsage::Position;
+    uint32_t usageIndex = 0;
+    uint32_t location = 0;
+    uint32_t componentType = 0;
+};
+
+struct ValueRange
+{
+    float min = -std::numeric_limits<float>::infinity();
+    float max = std::numeric_limits<float>::infinity();
+};
+
 struct ShaderRecompiler : StringBuffer
 {
     uint32_t indentation = 0;
     bool isPixelShader = false;
     const uint8_t* constantTableData = nullptr;
     std::unordered_map<uint32_t, VertexElement> vertexElements;
+    std::vector<InputElement> inputElements;
     std::unordered_map<uint32_t, std::string> interpolators;
     std::unordered_map<uint32_t, const ConstantInfo*> float4Constants;
     std::unordered_map<uint32_t, const char*> boolConstants;
     std::unordered_map<uint32_t, const char*> samplers;
     std::unordered_map<uint32_t, uint32_t> ifEndLabels;
     uint32_t specConstantsMask = 0;
+    bool packInterpolators = false;
+    uint64_t interpolatorSignature = 0;
+
+    // Interpolator components read by the pixel shader a vertex shader is linked with. Exports to
+    // other components and the instructions only feeding them are removed.
+    std::vector<uint32_t> linkedInterpolatorMasks;
+
+    // g_Booleans bits the shader branches on.
+    uint32_t booleansMask = 0;
+
+    // Resolves branches on boolean constants at compile time using the given g_Booleans value.
+    bool specializeBooleans = false;
+    uint32_t specializedBooleans = 0;
+
+    // Reads the g_Swapped* masks and the clip plane flag through specialization constants, so pipelines
+    // without swapped vertex elements or a clip plane compile the work away.
+    bool specializeSharedFlags = false;
+
+    // Stores pixel shader registers that only carry colors as min16float4.
+    bool reducedPrecision = false;
+
+    // Loads each constant register and descriptor index accessed without relative addressing once at
+    // the start of shaderMain, reusing the local at every later reference.
+    bool hoistConstantLoads = false;
+
+    // Locals holding the hoisted loads, mapped to their type and the expression loading them.
+    std::map<std::string, std::pair<const char*, std::string>> hoistedLoads;
+
+    // Stores the result of each texture and vertex fetch in a local, so identical fetches reuse it until their
+    // source register is written or the block declaring the local is closed.
+    bool reuseFetches = false;
+
+    struct FetchResult
+    {
+        std::string localName;
+        uint32_t srcRegister;
+        uint32_t indentation;
+    };
+
+    // Only set with simple control flow, as case labels of the emitted switch could jump past the declaration of a local.
+    bool reuseFetchResults = false;
+
+    // Locals holding fetch results, mapped by the expression fetching them.
+    std::unordered_map<std::string, FetchResult> fetchResults;
+    uint32_t fetchResultCount = 0;
+
+    // Fetch expression pixelCoord was last computed for.
+    std::string pixelCoordFetch;
+
+    // Expression used for aL relative constant indexing, a literal inside unrolled loops.
+    std::string loopIndex = "aL";
+
+    // Value ranges of register components at the current point of emission, used to remove
+    // clamps that can never trigger. Only tracked for shaders with simple control flow.
+    bool trackValueRanges = false;
+    uint32_t conditionalDepth = 0;
+    ValueRange registerRanges[64][4];
+    ValueRange previousScalarRange;
+
+    // Ranges of a0 and aL, used to access constant arrays without bounds checks when the
+    // index is known to stay inside them.
+    ValueRange addressRange;
+    ValueRange loopIndexRange;
+    std::unordered_map<uint32_t, float> literalConstants;
+    uint32_t clampsRemoved = 0;
+
+    // Address of the instruction being emitted.
+    uint32_t instructionAddress = 0;
+
+    // Ranges the operands of removed clamps were proven to stay in, and the instructions accessing constant
+    // arrays without bounds checks, by address. The interpreter checks these against actual values.
+    std::unordered_map<uint32_t, ValueRange> clampRanges;
+    std::unordered_set<uint32_t> uncheckedConstantAccesses;
+
+    // Instructions as emitted for a linked shader pair by address, with the fetches that were removed
+    // keeping every component, and the components of each export register the linked pixel shader reads.
+    std::unordered_map<uint32_t, Instruction> linkedInstructions;
+    uint32_t linkedExportMasks[16]{};
 
 #ifdef UNLEASHED_RECOMP
     bool hasMtxProjection = false;
+
+    // Applies reverse-Z to the final position, instead of running the shader a second time with a reverse-Z
+    // projection, when the position is proven to be a linear combination of the g_MtxProjection rows.
+    bool reverseZFromPosition = false;
     bool hasMtxPrevInvViewProjection = false;
 #endif
 
@@ -48,9 +148,38 @@ struct ShaderRecompiler : StringBuffer
     uint32_t printDstSwizzle(uint32_t dstSwizzle, bool operand);
     void printDstSwizzle01(uint32_t dstRegister, uint32_t dstSwizzle);
 
+    ValueRange getRegisterRange(uint32_t reg, uint32_t component) const;
+    void setRegisterRange(uint32_t reg, uint32_t component, ValueRange range);
+    void setAddressRange(ValueRange range);
+    void resetRegisterRanges();
+    void setFetchRanges(uint32_t dstRegister, uint32_t dstSwizzle, ValueRange range);
+    bool isConstantIndexInRange(const ConstantInfo* constantInfo, uint32_t offset, bool addressRegisterRelative) const;
+    std::string getHoistedLoad(const char* type, std::string localName, std::string expression);
+    void addClampRange(ValueRange range);
+    bool reuseFetchResult(size_t statementStart, size_t expressionStart, uint32_t srcRegister);
+    void invalidateFetchResults(uint32_t reg);
+    void closeFetchScopes();
+
     void recompile(const VertexFetchInstruction& instr, uint32_t address);
     void recompile(const TextureFetchInstruction& instr, bool bicubic);
     void recompile(const AluInstruction& instr);
 
     void recompile(const uint8_t* shaderData, const std::string_view& include);
 };
+
+struct ExecBlock
+{
+    uint32_t address = 0;
+    uint32_t count = 0;
+    uint32_t sequence = 0; // Two bits per instruction, the lower one set for fetches.
+    bool shouldReturn = false;
+};
+
+ExecBlock getExecBlock(const ControlFlowInstruction& cfInstr);
+
+// Control flow instructions are 48 bits each and are stored in pairs at the beginning of the shader code.
+// They end where the instructions of the first exec block begin.
+std::vector<ControlFlowInstruction> decodeControlFlow(const be<uint32_t>* code, uint32_t size);
+
+// Returns the components of each interpolator a vertex shader exports or a pixel shader reads.
+std::vector<uint32_t> getInterpolatorMasks(const uint8_t* shaderData);
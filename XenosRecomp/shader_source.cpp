@@ -0,0 +1,350 @@
+#include "shader_source.h"
+
+#include <cctype>
+#include <vector>
+
+enum class ConditionValue
+{
+    False,
+    True,
+    Unknown
+};
+
+// Evaluates a preprocessor condition, treating every macro except the target macros as unknown.
+struct ConditionEvaluator
+{
+    std::string_view condition;
+    size_t position = 0;
+    ShaderTarget target = ShaderTarget::Dxil;
+    bool failed = false;
+
+    void skipSpaces()
+    {
+        while (position < condition.size() && (condition[position] == ' ' || condition[position] == '\t'))
+            ++position;
+    }
+
+    bool consume(std::string_view token)
+    {
+        skipSpaces();
+        if (condition.substr(position, token.size()) != token)
+            return false;
+
+        position += token.size();
+        return true;
+    }
+
+    std::string_view consumeIdentifier()
+    {
+        skipSpaces();
+        size_t start = position;
+        while (position < condition.size() && (isalnum(uint8_t(condition[position])) || condition[position] == '_'))
+            ++position;
+
+        return condition.substr(start, position - start);
+    }
+
+    ConditionValue evaluateDefined(std::string_view name)
+    {
+        if (name == "__spirv__")
+            return target == ShaderTarget::Spirv ? ConditionValue::True : ConditionValue::False;
+
+        if (name == "__air__")
+            return target == ShaderTarget::Air ? ConditionValue::True : ConditionValue::False;
+
+        return ConditionValue::Unknown;
+    }
+
+    ConditionValue evaluatePrimary()
+    {
+        if (consume("("))
+        {
+            ConditionValue value = evaluateOr();
+            failed |= !consume(")");
+            return value;
+        }
+
+        std::string_view identifier = consumeIdentifier();
+        if (identifier.empty())
+        {
+            failed = true;
+            return ConditionValue::Unknown;
+        }
+
+        if (identifier == "defined")
+        {
+            bool parenthesized = consume("(");
+            ConditionValue value = evaluateDefined(consumeIdentifier());
+            failed |= parenthesized && !consume(")");
+            return value;
+        }
+
+        if (identifier == "0")
+            return ConditionValue::False;
+
+        if (identifier == "1")
+            return ConditionValue::True;
+
+        return ConditionValue::Unknown;
+    }
+
+    ConditionValue evaluateUnary()
+    {
+        // Avoid mistaking != for a negation.
+        skipSpaces();
+        if (condition.substr(position, 2) != "!=" && consume("!"))
+        {
+            ConditionValue value = evaluateUnary();
+            if (value == ConditionValue::Unknown)
+                return value;
+
+            return value == ConditionValue::True ? ConditionValue::False : ConditionValue::True;
+        }
+
+        return evaluatePrimary();
+    }
+
+    ConditionValue evaluateAnd()
+    {
+        ConditionValue value = evaluateUnary();
+        while (consume("&&"))
+        {
+            ConditionValue rhs = evaluateUnary();
+            if (value == ConditionValue::False || rhs == ConditionValue::False)
+                value = ConditionValue::False;
+            else if (value == ConditionValue::Unknown || rhs == ConditionValue::Unknown)
+                value = ConditionValue::Unknown;
+        }
+
+        return value;
+    }
+
+    ConditionValue evaluateOr()
+    {
+        ConditionValue value = evaluateAnd();
+        while (consume("||"))
+        {
+            ConditionValue rhs = evaluateAnd();
+            if (value == ConditionValue::True || rhs == ConditionValue::True)
+                value = ConditionValue::True;
+            else if (value == ConditionValue::Unknown || rhs == ConditionValue::Unknown)
+                value = ConditionValue::Unknown;
+        }
+
+        return value;
+    }
+
+    ConditionValue evaluate()
+    {
+        ConditionValue value = evaluateOr();
+        skipSpaces();
+
+        // Anything not understood, such as comparisons or arithmetic, leaves the condition to the compiler.
+        if (failed || position != condition.size())
+            return ConditionValue::Unknown;
+
+        return value;
+    }
+};
+
+static std::string_view trim(std::string_view line)
+{
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos)
+        return {};
+
+    size_t end = line.find_last_not_of(" \t\r");
+    return line.substr(start, end - start + 1);
+}
+
+// Removes a trailing line comment, unless it's inside a string literal or continued onto the next line.
+static std::string_view stripLineComment(std::string_view line)
+{
+    bool inString = false;
+
+    for (size_t i = 0; i + 1 < line.size(); i++)
+    {
+        if (line[i] == '"' && (i == 0 || line[i - 1] != '\\'))
+            inString = !inString;
+        else if (!inString && line[i] == '/' && line[i + 1] == '/')
+            return line.back() == '\\' ? line : trim(line.substr(0, i));
+    }
+
+    return line;
+}
+
+struct Conditional
+{
+    bool resolved = false; // The directives of the chain are dropped, and only the taken branch is kept.
+    bool parentActive = false;
+    bool active = false;
+    bool taken = false;
+};
+
+std::string specializeShaderSource(const std::string_view source, ShaderTarget target, bool minify)
+{
+    std::string out;
+    out.reserve(source.size());
+
+    std::vector<Conditional> conditionals;
+
+    auto isActive = [&]()
+        {
+            return conditionals.empty() || (conditionals.back().parentActive && conditionals.back().active);
+        };
+
+    auto evaluate = [&](std::string_view condition)
+        {
+            ConditionEvaluator evaluator;
+            evaluator.condition = stripLineComment(condition);
+            evaluator.target = target;
+            return evaluator.evaluate();
+        };
+
+    size_t position = 0;
+    while (position < source.size())
+    {
+        // Lines continued with a backslash are handled together, and never modified.
+        size_t end = position;
+        bool continued = false;
+
+        while (true)
+        {
+            end = source.find('\n', end);
+            if (end == std::string_view::npos)
+            {
+                end = source.size();
+                break;
+            }
+
+            size_t last = end;
+            while (last > position && source[last - 1] == '\r')
+                --last;
+
+            if (last == position || source[last - 1] != '\\')
+                break;
+
+            continued = true;
+            ++end;
+        }
+
+        std::string_view line = source.substr(position, end - position);
+        position = end + 1;
+
+        std::string_view trimmedLine = trim(line);
+        std::string_view directive;
+        std::string_view argument;
+
+        if (!continued && !trimmedLine.empty() && trimmedLine[0] == '#')
+        {
+            std::string_view rest = trim(trimmedLine.substr(1));
+            size_t nameEnd = 0;
+            while (nameEnd < rest.size() && isalpha(uint8_t(rest[nameEnd])))
+                ++nameEnd;
+
+            directive = rest.substr(0, nameEnd);
+            argument = trim(rest.substr(nameEnd));
+        }
+
+        bool emit = false;
+
+        if (directive == "if" || directive == "ifdef" || directive == "ifndef")
+        {
+            Conditional conditional;
+            conditional.parentActive = isActive();
+
+            ConditionValue value;
+            if (directive == "if")
+            {
+                value = evaluate(argument);
+            }
+            else
+            {
+                ConditionEvaluator evaluator;
+                evaluator.target = target;
+                value = evaluator.evaluateDefined(trim(stripLineComment(argument)));
+
+                if (directive == "ifndef" && value != ConditionValue::Unknown)
+                    value = value == ConditionValue::True ? ConditionValue::False : ConditionValue::True;
+            }
+
+            if (!conditional.parentActive || value != ConditionValue::Unknown)
+            {
+                conditional.resolved = true;
+                conditional.active = value == ConditionValue::True;
+                conditional.taken = conditional.active;
+            }
+            else
+            {
+                conditional.active = true;
+                emit = true;
+            }
+
+            conditionals.push_back(conditional);
+        }
+        else if ((directive == "elif" || directive == "else" || directive == "endif") && !conditionals.empty())
+        {
+            auto& conditional = conditionals.back();
+
+            if (!conditional.resolved)
+            {
+                emit = conditional.parentActive;
+            }
+            else if (directive == "elif")
+            {
+                ConditionValue value = conditional.taken ? ConditionValue::False : evaluate(argument);
+
+                if (value == ConditionValue::Unknown)
+                {
+                    // No branch was taken so far, so the rest of the chain starts as a new conditional.
+                    conditional.resolved = false;
+                    conditional.active = true;
+
+                    if (conditional.parentActive)
+                    {
+                        out += "#if ";
+                        out += argument;
+                        out += '\n';
+                    }
+                }
+                else
+                {
+                    conditional.active = value == ConditionValue::True;
+                    conditional.taken |= conditional.active;
+                }
+            }
+            else if (directive == "else")
+            {
+                conditional.active = !conditional.taken;
+                conditional.taken = true;
+            }
+
+            if (directive == "endif")
+                conditionals.pop_back();
+        }
+        else
+        {
+            emit = isActive();
+        }
+
+        if (!emit)
+            continue;
+
+        if (minify && !continued)
+        {
+            trimmedLine = stripLineComment(trimmedLine);
+            if (trimmedLine.empty())
+                continue;
+
+            out += trimmedLine;
+        }
+        else
+        {
+            out += line;
+        }
+
+        out += '\n';
+    }
+
+    return out;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+enum class ShaderTarget
+{
+    Dxil,
+    Spirv,
+    Air
+};
+
+// Specializes the generated source for a single target by resolving the preprocessor conditionals that only depend on
+// __spirv__ and __air__, and dropping the branches the target doesn't take. Conditionals depending on anything else are
+// kept as they are. If minifying, indentation, line comments and empty lines are stripped as well.
+std::string specializeShaderSource(const std::string_view source, ShaderTarget target, bool minify);